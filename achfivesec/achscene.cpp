@@ -3,8 +3,17 @@
 #include "util.h"
 #include "logger.h"
 #include "gl.h"
+#include "glstatecache.h"
+#include "glgeometrypool.h"
+#include "gldrawbatch.h"
+#include "uniformblocks.h"
 #include "shaderutil.h"
+#include "commonshaders.h"
+#include "glshaderregistry.h"
 #include "font.h"
+#include "framegraph.h"
+#include "profiler.h"
+#include "assetbundle.h"
 #include <sync/sync.h>
 #include <freetype-gl/freetype-gl.h>
 
@@ -13,23 +22,6 @@ using namespace fw;
 namespace
 {
 
-	const std::string QuadVs =
-		FW_GL_SHADER_SOURCE(
-		
-			{{GLShaderVersion}}
-			{{GLVertexAttributes}}
-
-			layout (location = POSITION) in vec3 position;
-			out vec2 vTexCoord;
-
-			void main()
-			{
-				vTexCoord = (position.xy + 1) * 0.5;
-				gl_Position = vec4(position, 1);
-			}
-
-		);
-
 	const std::string QuadFs = 
 		FW_GL_SHADER_SOURCE(
 		
@@ -68,57 +60,6 @@ namespace
 		
 		);
 
-	const std::string GaussianBlurFs =
-		FW_GL_SHADER_SOURCE(
-			
-			{{GLShaderVersion}}
-
-			in vec2 vTexCoord;
-			out vec4 fragColor;
-
-			uniform int Orientation; // 0 : horizontal, 1 : vertical
-			uniform vec2 TexelSize;
-			uniform sampler2D RT;
-			uniform float SigmaFactor; // = 0.5
-			uniform int KernelSize; // = 40
-			uniform float BlurStrength;// = 1;
-
-			float Gaussian(float x, float sigma2)
-			{
-				return (1 / sqrt(3.14159265358979 * sigma2 * 2)) * exp(-((x*x) / (sigma2 * 2)));
-			}
-
-			void main()
-			{
-				vec3 color = vec3(0);
-				float sigma = float(KernelSize) * SigmaFactor;
-				float sigma2 = sigma * sigma;
-				float strength = 1.0 - BlurStrength;
-
-				vec2 offset;
-				if (Orientation == 0)
-				{
-					offset = vec2(TexelSize.x, 0);
-				}
-				else
-				{
-					offset = vec2(0, TexelSize.y);
-				}
-
-				for (int i = -KernelSize; i <= KernelSize; i++)
-				{
-					vec2 vOffset = offset * float(i);
-					color +=
-						texture(RT, vTexCoord + vOffset).rgb *
-						Gaussian(offset * strength, sigma2);
-				}
-
-				fragColor.rgb = color;
-				fragColor.a = texture(RT, vTexCoord).a;
-			}
-
-		);
-
 	const std::string DoFCombineShaderFs =
 		FW_GL_SHADER_SOURCE(
 		
@@ -156,6 +97,7 @@ namespace
 			layout (location = TEXCOORD0) in vec2 texcoord0;
 			layout (location = TEXCOORD1) in vec2 texcoord1;
 			layout (location = COLOR) in vec3 color;
+			layout (location = DRAWID) in uint drawID;
 
 			out VertexAttribute
 			{
@@ -163,14 +105,21 @@ namespace
 				vec2 texcoord0;
 				vec2 texcoord1;
 				vec3 color;
+				flat uint drawID;
 			} vertex;
 
+			out gl_PerVertex
+			{
+				vec4 gl_Position;
+			};
+
 			void main()
 			{
 				vertex.offset = offset;
 				vertex.texcoord0 = texcoord0;
 				vertex.texcoord1 = texcoord1;
 				vertex.color = color;
+				vertex.drawID = drawID;
 				gl_Position = vec4(position, 1);
 			}
 
@@ -180,6 +129,7 @@ namespace
 		FW_GL_SHADER_SOURCE(
 		
 			{{GLShaderVersion}}
+			{{GLDrawBatchExtensions}}
 		
 			layout (points) in;
 			layout (triangle_strip, max_vertices = 4) out;
@@ -190,25 +140,47 @@ namespace
 				vec2 texcoord0;
 				vec2 texcoord1;
 				vec3 color;
+				flat uint drawID;
 			} vertex[];
 
+			in gl_PerVertex
+			{
+				vec4 gl_Position;
+			} gl_in[];
+
+			out gl_PerVertex
+			{
+				vec4 gl_Position;
+			};
+
 			out vec3 color;
 			out vec2 texcoord;
 			out vec3 viewvec;
+			flat out float drawAlpha;
+			flat out int drawMode;
+
+			{{CameraBlock}}
+
+			struct DrawParams
+			{
+				vec2 WordScale;
+				float Alpha;
+				int Mode;
+			};
+
+			{{DrawBlock}}
 
 			uniform mat4 ModelMatrix;
-			uniform mat4 ViewMatrix;
-			uniform mat4 ProjectionMatrix;
-			uniform vec2 WordScale;
 			uniform float DistanceScale;
 
 			void main()
 			{
 				mat4 mvMatrix = ViewMatrix * ModelMatrix;
 				mat4 mvpMatrix = ProjectionMatrix * mvMatrix;
+				DrawParams params = Draws[vertex[0].drawID];
 
 				vec4 center = gl_in[0].gl_Position;
-				vec2 offset = vertex[0].offset * WordScale;
+				vec2 offset = vertex[0].offset * params.WordScale;
 
 				float s0 = vertex[0].texcoord0.s;
 				float t0 = vertex[0].texcoord0.t;
@@ -223,6 +195,8 @@ namespace
 				gl_Position = mvpMatrix * p;
 				viewvec = (mvMatrix * p).xyz * DistanceScale;
 				color = vertex[0].color;
+				drawAlpha = params.Alpha;
+				drawMode = params.Mode;
 				texcoord = vec2(s0, t1);
 				EmitVertex();
 
@@ -232,6 +206,8 @@ namespace
 				gl_Position = mvpMatrix * p;
 				viewvec = (mvMatrix * p).xyz * DistanceScale;
 				color = vertex[0].color;
+				drawAlpha = params.Alpha;
+				drawMode = params.Mode;
 				texcoord = vec2(s1, t1);
 				EmitVertex();
 
@@ -241,6 +217,8 @@ namespace
 				gl_Position = mvpMatrix * p;
 				viewvec = (mvMatrix * p).xyz * DistanceScale;
 				color = vertex[0].color;
+				drawAlpha = params.Alpha;
+				drawMode = params.Mode;
 				texcoord = vec2(s0, t0);
 				EmitVertex();
 
@@ -250,6 +228,8 @@ namespace
 				gl_Position = mvpMatrix * p;
 				viewvec = (mvMatrix * p).xyz * DistanceScale;
 				color = vertex[0].color;
+				drawAlpha = params.Alpha;
+				drawMode = params.Mode;
 				texcoord = vec2(s1, t0);
 				EmitVertex();
 
@@ -266,13 +246,13 @@ namespace
 			in vec2 texcoord;
 			in vec3 color;
 			in vec3 viewvec;
+			flat in float drawAlpha;
+			flat in int drawMode;
 
 			out vec4 fragColor;
 			out vec4 depth;
 
 			uniform sampler2D Tex;
-			uniform float Alpha;
-			uniform bool Mode;
 
 			void main()
 			{
@@ -283,8 +263,8 @@ namespace
 
 				//float alpha = texture(Tex, texcoord).r;
 
-				fragColor.rgb = Mode ? color : vec3(0);
-				fragColor.a = alpha * Alpha;
+				fragColor.rgb = drawMode != 0 ? color : vec3(0);
+				fragColor.a = alpha * drawAlpha;
 				depth.r = length(viewvec);
 				depth.a = 1;
 
@@ -294,9 +274,75 @@ namespace
 		
 		);
 
+	// Parameters of a text draw, matching DrawParams of TextRenderShaderGs (std430)
+	struct TextDrawParams
+	{
+		glm::vec2 wordScale;
+		float alpha;
+		int mode;
+	};
+
+	static_assert(sizeof(TextDrawParams) == 16, "TextDrawParams does not match std430 layout");
+
+	// Number of texts in the storage and maximum number of text draws in a submission
+	const int MaxTexts = 2;
+	const int MaxTextDraws = 16;
+
 }
 
-bool AchScene::Setup( sf::RenderWindow& window, sync_device* rocket )
+bool AchScene::Load( fw::AssetBundleWriter& writer )
+{
+	FW_PROFILE_SCOPE("AchScene::Load");
+
+	// Font
+	const std::string font = "OpenSans-Semibold.ttf";
+	const float kerningOffset = -5.0f;
+	const glm::vec2 basePos(-400.0f, -200.0f);
+
+	FormattedString morning;
+	morning.text = L"Morning";
+	morning.colors.emplace_back(0.9f, 0.9f, 0.0f);	// Yellow
+	morning.colors.emplace_back(0.9f, 0.0f, 0.0f);	// Red
+	morning.colors.emplace_back(0.0f, 0.9f, 0.9f);	// Aqua
+	morning.colors.emplace_back(0.0f, 0.5f, 0.9f);	// Dark aqua
+	morning.colors.emplace_back(0.9f, 0.0f, 0.0f);	// Red
+	morning.colors.emplace_back(0.5f, 0.9f, 0.0f);	// Yellowish green
+	morning.colors.emplace_back(0.9f, 0.6f, 0.0f);	// Orange
+
+	FormattedString arch;
+	arch.text = L"Arch";
+	arch.colors.emplace_back(0.0f, 0.9f, 0.0f);	// Green
+	arch.colors.emplace_back(0.5f, 0.9f, 0.5f);	// Purple
+	arch.colors.emplace_back(0.9f, 0.9f, 0.0f);	// Yellow
+	arch.colors.emplace_back(0.7f, 0.1f, 0.5f);
+
+	// Distance maps of the texts are built in parallel
+	text_Morning = std::make_shared<FontText>();
+	text_Arch = std::make_shared<FontText>();
+	auto morningResult = std::async(std::launch::async, [&]()
+	{
+		FW_PROFILE_SCOPE("AchScene::Load::Morning");
+		return text_Morning->Build(font, morning, basePos + glm::vec2(0.0f, 200.0f), 150.0f, kerningOffset);
+	});
+
+	bool archResult;
+	{
+		FW_PROFILE_SCOPE("AchScene::Load::Arch");
+		archResult = text_Arch->Build(font, arch, basePos + glm::vec2(230.0f, 70.0f), 150.0f, kerningOffset);
+	}
+
+	if (!morningResult.get() || !archResult)
+	{
+		return false;
+	}
+
+	text_Morning->Write(writer.AddEntry("AchScene.Morning"));
+	text_Arch->Write(writer.AddEntry("AchScene.Arch"));
+
+	return true;
+}
+
+bool AchScene::Setup( sf::RenderWindow& window, sync_device* rocket, fw::GLShaderRegistry& shaders )
 {
 	// Tracks
 	track_WordScale = sync_get_track(rocket, "achscene.WordScale");
@@ -309,46 +355,43 @@ bool AchScene::Setup( sf::RenderWindow& window, sync_device* rocket )
 	// --------------------------------------------------------------------------------
 
 	// Shaders
+	// Only requested here and compiled while the assets are loaded, collected in Upload.
 	ShaderUtil::ShaderTemplateDict dict;
+	dict["DrawBlock"] = ShaderUtil::DrawBlock(MaxTextDraws);
 
 	FW_LOG_INFO("Loading quadShader");
-	quadShader = std::make_shared<GLShader>();
-	quadShader->CompileString(GLShaderType::VertexShader, ShaderUtil::GenerateShaderString(QuadVs, dict));
-	quadShader->CompileString(GLShaderType::FragmentShader, ShaderUtil::GenerateShaderString(QuadFs, dict));
-	quadShader->Link();
+	quadShader = shaders.Pipeline(
+		ShaderUtil::GenerateShaderString(CommonShaders::QuadVs, dict),
+		ShaderUtil::GenerateShaderString(QuadFs, dict));
 
 	FW_LOG_INFO("Loading renderDepthShader");
-	renderDepthShader = std::make_shared<GLShader>();
-	renderDepthShader->CompileString(GLShaderType::VertexShader, ShaderUtil::GenerateShaderString(QuadVs, dict));
-	renderDepthShader->CompileString(GLShaderType::FragmentShader, ShaderUtil::GenerateShaderString(RenderDepthFs, dict));
-	renderDepthShader->Link();
+	renderDepthShader = shaders.Pipeline(
+		ShaderUtil::GenerateShaderString(CommonShaders::QuadVs, dict),
+		ShaderUtil::GenerateShaderString(RenderDepthFs, dict));
 
 	FW_LOG_INFO("Loading gaussianBlurShader");
-	gaussianBlurShader = std::make_shared<GLShader>();
-	gaussianBlurShader->CompileString(GLShaderType::VertexShader, ShaderUtil::GenerateShaderString(QuadVs, dict));
-	gaussianBlurShader->CompileString(GLShaderType::FragmentShader, ShaderUtil::GenerateShaderString(GaussianBlurFs, dict));
-	gaussianBlurShader->Link();
+	gaussianBlurShader = shaders.Pipeline(
+		ShaderUtil::GenerateShaderString(CommonShaders::QuadVs, dict),
+		ShaderUtil::GenerateShaderString(CommonShaders::GaussianBlurFs, dict));
 
 	FW_LOG_INFO("Loading dofCombineShader");
-	dofCombineShader = std::make_shared<GLShader>();
-	dofCombineShader->CompileString(GLShaderType::VertexShader, ShaderUtil::GenerateShaderString(QuadVs, dict));
-	dofCombineShader->CompileString(GLShaderType::FragmentShader, ShaderUtil::GenerateShaderString(DoFCombineShaderFs, dict));
-	dofCombineShader->Link();
+	dofCombineShader = shaders.Pipeline(
+		ShaderUtil::GenerateShaderString(CommonShaders::QuadVs, dict),
+		ShaderUtil::GenerateShaderString(DoFCombineShaderFs, dict));
 
 	FW_LOG_INFO("Loading renderShader");
-	textRenderShader = std::make_shared<GLShader>();
-	textRenderShader->CompileString(GLShaderType::VertexShader, ShaderUtil::GenerateShaderString(TextRenderShaderVs, dict));
-	textRenderShader->CompileString(GLShaderType::GeometryShader, ShaderUtil::GenerateShaderString(TextRenderShaderGs, dict));
-	textRenderShader->CompileString(GLShaderType::FragmentShader, ShaderUtil::GenerateShaderString(TextRenderShaderFs, dict));
-	textRenderShader->Link();
+	textRenderShader = shaders.Pipeline(
+		ShaderUtil::GenerateShaderString(TextRenderShaderVs, dict),
+		ShaderUtil::GenerateShaderString(TextRenderShaderGs, dict),
+		ShaderUtil::GenerateShaderString(TextRenderShaderFs, dict));
+
+	// Uniform blocks
+	cameraUbo = std::make_shared<GLUniformBuffer>();
+	blurUbo = std::make_shared<GLUniformBuffer>();
 
 	// --------------------------------------------------------------------------------
 
 	// Quad
-	quadVao = std::make_shared<GLVertexArray>();
-	quadPositionVbo = std::make_shared<GLVertexBuffer>();
-	quadIbo = std::make_shared<GLIndexBuffer>();
-
 	const glm::vec3 quadPositions[] =
 	{
 		glm::vec3( 1.0f,  1.0f, 0.0f),
@@ -363,94 +406,122 @@ bool AchScene::Setup( sf::RenderWindow& window, sync_device* rocket )
 		2, 3, 0
 	};
 
-	quadPositionVbo->AddStatic(12, &quadPositions[0].x);
-	quadVao->Add(GLDefaultVertexAttribute::Position, quadPositionVbo.get());
-	quadIbo->AddStatic(6, quadIndices);
+	GLVertexLayout layout(sizeof(glm::vec3));
+	layout.Add(GLDefaultVertexAttribute::Position, GLVertexFormat::Float, 0);
+	geometry = std::make_shared<GLGeometryPool>(layout, 4, 6);
+	quadRange = geometry->Add(quadPositions, 4, quadIndices, 6);
 
-	// --------------------------------------------------------------------------------
+	return true;
+}
 
-	// Font
-	const std::string font = "OpenSans-Semibold.ttf";
-	const float kerningOffset = -5.0f;
-	const glm::vec2 basePos(-400.0f, -200.0f);
-	FormattedString str;
+bool AchScene::Upload( const fw::AssetBundle& bundle )
+{
+	if (!WaitShaders())
+	{
+		return false;
+	}
 
-	text_Morning = std::make_shared<FontText>();
-	str.text = L"Morning";
-	str.colors.emplace_back(0.9f, 0.9f, 0.0f);	// Yellow
-	str.colors.emplace_back(0.9f, 0.0f, 0.0f);	// Red
-	str.colors.emplace_back(0.0f, 0.9f, 0.9f);	// Aqua
-	str.colors.emplace_back(0.0f, 0.5f, 0.9f);	// Dark aqua
-	str.colors.emplace_back(0.9f, 0.0f, 0.0f);	// Red
-	str.colors.emplace_back(0.5f, 0.9f, 0.0f);	// Yellowish green
-	str.colors.emplace_back(0.9f, 0.6f, 0.0f);	// Orange
-	if (!text_Morning->Load(font, str, basePos + glm::vec2(0.0f, 200.0f), 150.0f, kerningOffset))
+	AssetBundleReader morningReader, archReader;
+	if (!bundle.Find("AchScene.Morning", morningReader) || !bundle.Find("AchScene.Arch", archReader))
 	{
 		return false;
 	}
 
-	text_Arch = std::make_shared<FontText>();
-	str.text = L"Arch";
-	str.colors.clear();
-	str.colors.emplace_back(0.0f, 0.9f, 0.0f);	// Green
-	str.colors.emplace_back(0.5f, 0.9f, 0.5f);	// Purple
-	str.colors.emplace_back(0.9f, 0.9f, 0.0f);	// Yellow
-	str.colors.emplace_back(0.7f, 0.1f, 0.5f);
-	if (!text_Arch->Load(font, str, basePos + glm::vec2(230.0f, 70.0f), 150.0f, kerningOffset))
+	// The texts are not built if the assets are read from a bundle
+	if (!text_Morning)
+	{
+		text_Morning = std::make_shared<FontText>();
+		text_Arch = std::make_shared<FontText>();
+	}
+
+	// The texts share the buffers and the texture to be drawn in a batch
+	textStorage = std::make_shared<FontTextStorage>(FontText::AtlasSize, FontText::AtlasSize, MaxTexts, 256);
+	if (!text_Morning->Upload(morningReader, textStorage) || !text_Arch->Upload(archReader, textStorage))
 	{
 		return false;
 	}
 
-	// --------------------------------------------------------------------------------
+	// Both texts are drawn as one range so that the instances keep the order of the texts
+	const auto& morningRange = text_Morning->Range();
+	const auto& archRange = text_Arch->Range();
+	if (archRange.baseVertex != morningRange.baseVertex + morningRange.numVertices)
+	{
+		FW_LOG_ERROR("Glyphs of the texts are not contiguous");
+		return false;
+	}
 
-	// FBOs
-	auto windowSize = window.getSize();
-	primaryRt = std::make_shared<GLTexture2D>();
-	primaryRt->SetMagFilter(GL_LINEAR);
-	primaryRt->SetMinFilter(GL_LINEAR);
-	primaryRt->SetWrap(GL_CLAMP_TO_EDGE);
-	primaryRt->Allocate(windowSize.x, windowSize.y, GL_RGBA16F);
-	primaryFbo = std::make_shared<GLFrameBuffer>(
-		windowSize.x, windowSize.y,
-		glm::vec4(glm::vec3(1.0f), 1.0f));
-	primaryFbo->AddRenderTarget(primaryRt.get());
-
-	primaryDepthRt = std::make_shared<GLTexture2D>();
-	primaryDepthRt->SetMagFilter(GL_LINEAR);
-	primaryDepthRt->SetMinFilter(GL_LINEAR);
-	primaryDepthRt->SetWrap(GL_CLAMP_TO_EDGE);
-	primaryDepthRt->Allocate(windowSize.x, windowSize.y, GL_RGBA16F);
-	//primaryDepthRt->Allocate(windowSize.x, windowSize.y, GL_R16F);
-	primaryFbo->AddRenderTarget(primaryDepthRt.get());
-
-	horizontalBlurRt = std::make_shared<GLTexture2D>();
-	horizontalBlurRt->SetMagFilter(GL_LINEAR);
-	horizontalBlurRt->SetMinFilter(GL_LINEAR);
-	horizontalBlurRt->SetWrap(GL_CLAMP_TO_EDGE);
-	horizontalBlurRt->Allocate(windowSize.x / 2, windowSize.y / 2, GL_RGBA16F);
-	horizontalBlurFbo = std::make_shared<GLFrameBuffer>(
-		windowSize.x / 2, windowSize.y / 2,
-		glm::vec4(glm::vec3(), 1.0f));
-	horizontalBlurFbo->AddRenderTarget(horizontalBlurRt.get());
-
-	verticalBlurRt = std::make_shared<GLTexture2D>();
-	verticalBlurRt->SetMagFilter(GL_LINEAR);
-	verticalBlurRt->SetMinFilter(GL_LINEAR);
-	verticalBlurRt->SetWrap(GL_CLAMP_TO_EDGE);
-	verticalBlurRt->Allocate(windowSize.x / 2, windowSize.y / 2, GL_RGBA16F);
-	verticalBlurFbo = std::make_shared<GLFrameBuffer>(
-		windowSize.x / 2, windowSize.y / 2,
-		glm::vec4(glm::vec3(), 1.0f));
-	verticalBlurFbo->AddRenderTarget(verticalBlurRt.get());
+	textsRange = morningRange;
+	textsRange.numVertices += archRange.numVertices;
+
+	textBatch = std::make_shared<GLDrawBatch>((int)sizeof(TextDrawParams), MaxTextDraws);
+	textBatch->Attach(textStorage->Geometry());
 
 	return true;
 }
 
-void AchScene::Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer& fbo )
+bool AchScene::WaitShaders()
 {
+	if (!quadShader->WaitLink() ||
+		!renderDepthShader->WaitLink() ||
+		!gaussianBlurShader->WaitLink() ||
+		!dofCombineShader->WaitLink() ||
+		!textRenderShader->WaitLink())
+	{
+		return false;
+	}
+
+	// Constant uniforms
+	gaussianBlurShader->Begin();
+	gaussianBlurShader->SetUniform("RT", 0);
+	gaussianBlurShader->End();
+
+	textRenderShader->Begin();
+	textRenderShader->SetUniform("Tex", 0);
+	textRenderShader->SetUniform("DistanceScale", 1.0f);
+	textRenderShader->End();
+
+	dofCombineShader->Begin();
+	dofCombineShader->SetUniform("PrimaryRT", 0);
+	dofCombineShader->SetUniform("DepthRT", 1);
+	dofCombineShader->SetUniform("BlurRT", 2);
+	dofCombineShader->End();
+
+	// Uniforms set every frame
+	if (!textRenderShader->ResolveUniform("ModelMatrix", textRenderShader_ModelMatrix) ||
+		!gaussianBlurShader->ResolveUniform("Orientation", gaussianBlurShader_Orientation) ||
+		!dofCombineShader->ResolveUniform("Range", dofCombineShader_Range) ||
+		!dofCombineShader->ResolveUniform("Focus", dofCombineShader_Focus) ||
+		!dofCombineShader->ResolveUniform("Alpha", dofCombineShader_Alpha))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void AchScene::Draw( sf::RenderWindow& window, double milli, fw::FrameGraph& graph, fw::FrameGraphResource output )
+{
+	graph.BeginGroup("AchScene::Draw");
+
 	// Current row number
 	double row = Util::MilliToRow(milli);
 
+	// Render targets
+	// The output can be smaller than the window with the dynamic resolution.
+	auto size = glm::ivec2(graph.Width(output), graph.Height(output));
+	auto primary = graph.CreateRenderTarget(
+		"AchScene::Primary", size.x, size.y, GL_RGBA16F,
+		glm::vec4(glm::vec3(1.0f), 1.0f));
+	auto primaryDepth = graph.CreateRenderTarget(
+		"AchScene::PrimaryDepth", size.x, size.y, GL_RGBA16F,
+		glm::vec4(glm::vec3(1.0f), 1.0f));
+	auto horizontalBlur = graph.CreateRenderTarget(
+		"AchScene::HorizontalBlur", size.x / 2, size.y / 2, GL_RGBA16F,
+		glm::vec4(glm::vec3(), 1.0f));
+	auto verticalBlur = graph.CreateRenderTarget(
+		"AchScene::VerticalBlur", size.x / 2, size.y / 2, GL_RGBA16F,
+		glm::vec4(glm::vec3(), 1.0f));
+
 	// --------------------------------------------------------------------------------
 
 #if 1
@@ -473,7 +544,6 @@ void AchScene::Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer&
 
 	const float zNear = 0.1f;
 	const float zFar = 10.0f;
-	auto size = window.getSize();
 	auto projectionMatrix = glm::perspective(
 		70.0f,
 		(float)size.x / size.y,
@@ -481,47 +551,54 @@ void AchScene::Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer&
 		zFar);
 	//auto projectionMatrix = glm::ortho(0.0f, (float)size.x, 0.0f, (float)size.y);
 
-	primaryFbo->Begin();
-	glPushAttrib(GL_COLOR_BUFFER_BIT);
-	glPushAttrib(GL_DEPTH_BUFFER_BIT);
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	textRenderShader->Begin();
-	textRenderShader->SetUniform("ModelMatrix", modelMatrix);
-	textRenderShader->SetUniform("ViewMatrix", viewMatrix);
-	textRenderShader->SetUniform("ProjectionMatrix", projectionMatrix);
-	textRenderShader->SetUniform("Tex", 0);
-	textRenderShader->SetUniform("DistanceScale", 1.0f);
-
 	float wordScale = sync_get_val(track_WordScale, row);
-	const float baseXScale = 1.1f;
-	textRenderShader->SetUniform("WordScale", glm::vec2(baseXScale, 1.0f));
-	textRenderShader->SetUniform("Alpha", 1.0f);
-	textRenderShader->SetUniform("Mode", false);
-	text_Morning->Draw();
-	text_Arch->Draw();
-	
-	textRenderShader->SetUniform("WordScale", glm::vec2(baseXScale * wordScale, wordScale));
-	textRenderShader->SetUniform("Alpha", 0.2f);
-	textRenderShader->SetUniform("Mode", true);
-	text_Morning->Draw();
-	text_Arch->Draw();
 
-	textRenderShader->End();
+	CameraBlock camera;
+	camera.viewMatrix = viewMatrix;
+	camera.projectionMatrix = projectionMatrix;
+	cameraUbo->Update(&camera, sizeof(camera), graph.StreamBuffer());
+
+	// Render texts
+	graph.AddPass("AchScene::Text")
+		.Write(primary)
+		.Write(primaryDepth)
+		.Execute([=](FrameGraph& graph)
+		{
+			GLStateCache::PushState();
+			GLStateCache::Disable(GL_DEPTH_TEST);
+			GLStateCache::Enable(GL_BLEND);
+			GLStateCache::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+			textRenderShader->Begin();
+			textRenderShader->SetUniform(textRenderShader_ModelMatrix, modelMatrix);
+			cameraUbo->BindBlock((int)UniformBlockBinding::Camera);
+
+			// The texts are drawn as two instances, the black ones and then the scaled translucent ones
+			const float baseXScale = 1.1f;
+			TextDrawParams params[2];
+			params[0].wordScale = glm::vec2(baseXScale, 1.0f);
+			params[0].alpha = 1.0f;
+			params[0].mode = 0;
+			params[1].wordScale = glm::vec2(baseXScale * wordScale, wordScale);
+			params[1].alpha = 0.2f;
+			params[1].mode = 1;
+			textBatch->Add(textsRange, params, 2, textStorage->Atlas());
+
+			textBatch->Submit(GL_POINTS, textStorage->Geometry(), ShaderUtil::DrawBlockBinding(), graph.StreamBuffer());
+
+			textRenderShader->End();
 	
-	glPopAttrib();
-	glPopAttrib();
-	primaryFbo->End();
+			GLStateCache::PopState();
+		});
 
 #endif
 
 	// --------------------------------------------------------------------------------
 
 	// Texel size
-	auto sizeF = glm::vec2((float)size.x, (float)size.y);
-	glm::vec2 texelSize = 1.0f / sizeF;
+	// Relative to the window so that the width of the blur is independent of the render scale
+	auto windowSize = window.getSize();
+	glm::vec2 texelSize = 1.0f / glm::vec2((float)windowSize.x, (float)windowSize.y);
 
 	// Blur factor
 	//const float sigmaFactor = 0.7f;
@@ -533,78 +610,93 @@ void AchScene::Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer&
 	int kernelSize = 7.0f;
 	float blurStrength = 1.0f;
 
+	BlurBlock blur;
+	blur.texelSize = texelSize;
+	blur.sigmaFactor = sigmaFactor;
+	blur.kernelSize = kernelSize;
+	blur.blurStrength = blurStrength;
+	blurUbo->Update(&blur, sizeof(blur), graph.StreamBuffer());
+
 	// Horizontal blur
-	horizontalBlurFbo->Begin();
-	gaussianBlurShader->Begin();
-	gaussianBlurShader->SetUniform("RT", 0);
-	gaussianBlurShader->SetUniform("Orientation", 0);
-	gaussianBlurShader->SetUniform("TexelSize", texelSize);
-	gaussianBlurShader->SetUniform("SigmaFactor", sigmaFactor);
-	gaussianBlurShader->SetUniform("KernelSize", kernelSize);
-	gaussianBlurShader->SetUniform("BlurStrength", blurStrength);
-	primaryRt->Bind();
-	quadVao->Draw(GL_TRIANGLES, quadIbo.get());
-	primaryRt->Unbind();
-	gaussianBlurShader->End();
-	horizontalBlurFbo->End();
+	graph.AddPass("AchScene::HorizontalBlur")
+		.Read(primary)
+		.Write(horizontalBlur)
+		.Execute([=](FrameGraph& graph)
+		{
+			gaussianBlurShader->Begin();
+			gaussianBlurShader->SetUniform(gaussianBlurShader_Orientation, 0);
+			blurUbo->BindBlock((int)UniformBlockBinding::Blur);
+			graph.Texture(primary)->Bind();
+			geometry->Draw(GL_TRIANGLES, quadRange);
+			graph.Texture(primary)->Unbind();
+			gaussianBlurShader->End();
+		});
 
 	// Vertical blur
-	verticalBlurFbo->Begin();
-	gaussianBlurShader->Begin();
-	gaussianBlurShader->SetUniform("RT", 0);
-	gaussianBlurShader->SetUniform("Orientation", 1);
-	gaussianBlurShader->SetUniform("TexelSize", texelSize);
-	gaussianBlurShader->SetUniform("SigmaFactor", sigmaFactor);
-	gaussianBlurShader->SetUniform("KernelSize", kernelSize);
-	gaussianBlurShader->SetUniform("BlurStrength", blurStrength);
-	horizontalBlurRt->Bind();
-	quadVao->Draw(GL_TRIANGLES, quadIbo.get());
-	horizontalBlurRt->Unbind();
-	gaussianBlurShader->End();
-	verticalBlurFbo->End();
+	graph.AddPass("AchScene::VerticalBlur")
+		.Read(horizontalBlur)
+		.Write(verticalBlur)
+		.Execute([=](FrameGraph& graph)
+		{
+			gaussianBlurShader->Begin();
+			gaussianBlurShader->SetUniform(gaussianBlurShader_Orientation, 1);
+			blurUbo->BindBlock((int)UniformBlockBinding::Blur);
+			graph.Texture(horizontalBlur)->Bind();
+			geometry->Draw(GL_TRIANGLES, quadRange);
+			graph.Texture(horizontalBlur)->Unbind();
+			gaussianBlurShader->End();
+		});
 
 	// Combine
-	fbo.Begin();
-	glPushAttrib(GL_COLOR_BUFFER_BIT);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	dofCombineShader->Begin();
-	dofCombineShader->SetUniform("PrimaryRT", 0);
-	dofCombineShader->SetUniform("DepthRT", 1);
-	dofCombineShader->SetUniform("BlurRT", 2);
-	dofCombineShader->SetUniform("Range", sync_get_val(track_Range, row));
-	dofCombineShader->SetUniform("Focus", sync_get_val(track_Focus, row));
-	dofCombineShader->SetUniform("Alpha", sync_get_val(track_Alpha, row));
-	primaryRt->Bind(0);
-	primaryDepthRt->Bind(1);
-	verticalBlurRt->Bind(2);
-	quadVao->Draw(GL_TRIANGLES, quadIbo.get());
-	verticalBlurRt->Unbind();
-	primaryDepthRt->Unbind();
-	primaryRt->Unbind();
-	dofCombineShader->End();
-	glPopAttrib();
-	fbo.End();
-
-	// --------------------------------------------------------------------------------
+	float range = sync_get_val(track_Range, row);
+	float focus = sync_get_val(track_Focus, row);
+	float alpha = sync_get_val(track_Alpha, row);
+	graph.AddPass("AchScene::DoFCombine")
+		.Read(primary)
+		.Read(primaryDepth)
+		.Read(verticalBlur)
+		.Write(output)
+		.Execute([=](FrameGraph& graph)
+		{
+			GLStateCache::PushState();
+			GLStateCache::Enable(GL_BLEND);
+			GLStateCache::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			dofCombineShader->Begin();
+			dofCombineShader->SetUniform(dofCombineShader_Range, range);
+			dofCombineShader->SetUniform(dofCombineShader_Focus, focus);
+			dofCombineShader->SetUniform(dofCombineShader_Alpha, alpha);
+			graph.Texture(primary)->Bind(0);
+			graph.Texture(primaryDepth)->Bind(1);
+			graph.Texture(verticalBlur)->Bind(2);
+			geometry->Draw(GL_TRIANGLES, quadRange);
+			graph.Texture(verticalBlur)->Unbind();
+			graph.Texture(primaryDepth)->Unbind();
+			graph.Texture(primary)->Unbind();
+			dofCombineShader->End();
+			GLStateCache::PopState();
+
+			// --------------------------------------------------------------------------------
 
 #if 0
-	quadShader->Begin();
-	quadShader->SetUniform("RT", 0);
-	primaryRt->Bind();
-	quadVao->Draw(GL_TRIANGLES, quadIbo.get());
-	primaryRt->Unbind();
-	quadShader->End();
+			quadShader->Begin();
+			quadShader->SetUniform("RT", 0);
+			graph.Texture(primary)->Bind();
+			geometry->Draw(GL_TRIANGLES, quadRange);
+			graph.Texture(primary)->Unbind();
+			quadShader->End();
 #endif
 
 #if 0
-	renderDepthShader->Begin();
-	renderDepthShader->SetUniform("DepthRT", 0);
-	renderDepthShader->SetUniform("Near", zNear);
-	renderDepthShader->SetUniform("Far", zFar);
-	primaryDepthRt->Bind();
-	quadVao->Draw(GL_TRIANGLES, quadIbo.get());
-	primaryDepthRt->Unbind();
-	renderDepthShader->End();
+			renderDepthShader->Begin();
+			renderDepthShader->SetUniform("DepthRT", 0);
+			renderDepthShader->SetUniform("Near", zNear);
+			renderDepthShader->SetUniform("Far", zFar);
+			graph.Texture(primaryDepth)->Bind();
+			geometry->Draw(GL_TRIANGLES, quadRange);
+			graph.Texture(primaryDepth)->Unbind();
+			renderDepthShader->End();
 #endif
+		});
+
+	graph.EndGroup();
 }
@@ -3,28 +3,24 @@
 #define ACHFIVESEC_ACH_SCENE_H
 
 #include "scene.h"
+#include "gl.h"
+#include "glgeometrypool.h"
+#include "gldrawbatch.h"
 
 struct sync_track;
 
-namespace fw
-{
-	class GLShader;
-	class GLVertexArray;
-	class GLVertexBuffer;
-	class GLIndexBuffer;
-	class GLTexture2D;
-	class GLFrameBuffer;
-}
-
 class FontText;
+class FontTextStorage;
 
 class AchScene : public Scene
 {
 public:
 
 	virtual std::string Name() const { return "AchScene"; }
-	virtual bool Setup( sf::RenderWindow& window, sync_device* rocket );
-	virtual void Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer& fbo );
+	virtual bool Load( fw::AssetBundleWriter& writer );
+	virtual bool Setup( sf::RenderWindow& window, sync_device* rocket, fw::GLShaderRegistry& shaders );
+	virtual bool Upload( const fw::AssetBundle& bundle );
+	virtual void Draw( sf::RenderWindow& window, double milli, fw::FrameGraph& graph, fw::FrameGraphResource output );
 
 private:
 
@@ -38,26 +34,38 @@ private:
 
 private:
 
-	std::shared_ptr<fw::GLShader> gaussianBlurShader;
-	std::shared_ptr<fw::GLShader> dofCombineShader;
+	//! Wait for the shaders requested in Setup and resolve the uniforms.
+	bool WaitShaders();
+
+private:
+
+	std::shared_ptr<fw::GLProgramPipeline> gaussianBlurShader;
+	std::shared_ptr<fw::GLProgramPipeline> dofCombineShader;
+
+	std::shared_ptr<fw::GLProgramPipeline> quadShader;
+	std::shared_ptr<fw::GLProgramPipeline> renderDepthShader;
+	std::shared_ptr<fw::GLGeometryPool> geometry;
+	fw::GLGeometryRange quadRange;
+
+	std::shared_ptr<fw::GLUniformBuffer> cameraUbo;
+	std::shared_ptr<fw::GLUniformBuffer> blurUbo;
+
+	std::shared_ptr<fw::GLProgramPipeline> textRenderShader;
 
-	std::shared_ptr<fw::GLShader> quadShader;
-	std::shared_ptr<fw::GLShader> renderDepthShader;
-	std::shared_ptr<fw::GLVertexArray> quadVao;
-	std::shared_ptr<fw::GLVertexBuffer> quadPositionVbo;
-	std::shared_ptr<fw::GLIndexBuffer> quadIbo;
+	// Uniforms set every frame, resolved in Upload
+	fw::GLUniformHandle<glm::mat4> textRenderShader_ModelMatrix;
+	fw::GLUniformHandle<int> gaussianBlurShader_Orientation;
+	fw::GLUniformHandle<float> dofCombineShader_Range;
+	fw::GLUniformHandle<float> dofCombineShader_Focus;
+	fw::GLUniformHandle<float> dofCombineShader_Alpha;
 
-	std::shared_ptr<fw::GLShader> textRenderShader;
 	std::shared_ptr<FontText> text_Morning;
 	std::shared_ptr<FontText> text_Arch;
 
-	std::shared_ptr<fw::GLTexture2D> primaryRt;
-	std::shared_ptr<fw::GLTexture2D> primaryDepthRt;
-	std::shared_ptr<fw::GLFrameBuffer> primaryFbo;
-	std::shared_ptr<fw::GLTexture2D> horizontalBlurRt;
-	std::shared_ptr<fw::GLFrameBuffer> horizontalBlurFbo;
-	std::shared_ptr<fw::GLTexture2D> verticalBlurRt;
-	std::shared_ptr<fw::GLFrameBuffer> verticalBlurFbo;
+	// Glyphs of the texts drawn in one batch
+	std::shared_ptr<FontTextStorage> textStorage;
+	std::shared_ptr<fw::GLDrawBatch> textBatch;
+	fw::GLGeometryRange textsRange;		//!< Glyphs of both texts, which are contiguous in the storage.
 
 };
 
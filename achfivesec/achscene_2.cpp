@@ -3,8 +3,18 @@
 #include "util.h"
 #include "logger.h"
 #include "gl.h"
+#include "glstatecache.h"
+#include "glgeometrypool.h"
+#include "gldrawbatch.h"
+#include "uniformblocks.h"
 #include "shaderutil.h"
+#include "commonshaders.h"
+#include "glshaderregistry.h"
 #include "font.h"
+#include "framegraph.h"
+#include "profiler.h"
+#include "assetbundle.h"
+#include "blockcompressor.h"
 #include <sync/sync.h>
 #include <assimp/Importer.hpp>
 #include <assimp/DefaultLogger.hpp>
@@ -22,29 +32,44 @@ namespace
 		FW_GL_SHADER_SOURCE(
 
 			{{GLShaderVersion}}
+			{{GLDrawBatchExtensions}}
 			{{GLVertexAttributes}}
 
 			layout (location = POSITION) in vec3 position;
 			layout (location = NORMAL) in vec3 normal;
 			layout (location = TEXCOORD0) in vec2 texcoord;
+			layout (location = DRAWID) in uint drawID;
 
 			out vec3 vNormal;
 			out vec2 vTexcoord;
 			out vec3 vViewvec;
+			flat out int vMode;
 
-			uniform mat4 ModelMatrix;
-			uniform mat4 ViewMatrix;
-			uniform mat4 ProjectionMatrix;
+			out gl_PerVertex
+			{
+				vec4 gl_Position;
+			};
+
+			{{CameraBlock}}
+
+			struct DrawParams
+			{
+				mat4 ModelMatrix;
+				int Mode;
+			};
+
+			{{DrawBlock}}
 
 			void main()
 			{
-				mat4 mvMatrix = ViewMatrix * ModelMatrix;
+				mat4 mvMatrix = ViewMatrix * Draws[drawID].ModelMatrix;
 				mat4 mvpMatrix = ProjectionMatrix * mvMatrix;
 				mat3 normalMatrix = mat3(transpose(inverse(mvMatrix)));
 				
 				vNormal = normalMatrix * normal;
 				vTexcoord = texcoord;
 				vViewvec = vec3(mvMatrix * vec4(position, 1));
+				vMode = Draws[drawID].Mode;
 
 				gl_Position = mvpMatrix * vec4(position, 1);
 			}
@@ -59,11 +84,11 @@ namespace
 			in vec3 vNormal;
 			in vec2 vTexcoord;
 			in vec3 vViewvec;
+			flat in int vMode;
 
 			out vec4 fragColor;
 
 			uniform sampler2D RT;
-			uniform bool Mode;
 
 			const vec3 lightDir = vec3(1);
 
@@ -74,7 +99,7 @@ namespace
 				//fragColor.rgb = vec3(1, 0, 0);
 				//fragColor.rgb = vec3(max(dot(nLightDir, nvNormal), 0));
 
-				if (Mode)
+				if (vMode != 0)
 				{
 					vec4 c = texture(RT, vTexcoord);
 					fragColor.rgb = c.rgb;
@@ -89,74 +114,6 @@ namespace
 
 		);
 
-	const std::string QuadVs =
-		FW_GL_SHADER_SOURCE(
-		
-			{{GLShaderVersion}}
-			{{GLVertexAttributes}}
-
-			layout (location = POSITION) in vec3 position;
-			out vec2 vTexCoord;
-
-			void main()
-			{
-				vTexCoord = (position.xy + 1) * 0.5;
-				gl_Position = vec4(position, 1);
-			}
-
-		);
-
-	const std::string GaussianBlurFs =
-		FW_GL_SHADER_SOURCE(
-			
-			{{GLShaderVersion}}
-
-			in vec2 vTexCoord;
-			out vec4 fragColor;
-
-			uniform int Orientation; // 0 : horizontal, 1 : vertical
-			uniform vec2 TexelSize;
-			uniform sampler2D RT;
-			uniform float SigmaFactor; // = 0.5
-			uniform int KernelSize; // = 40
-			uniform float BlurStrength;// = 1;
-
-			float Gaussian(float x, float sigma2)
-			{
-				return (1 / sqrt(3.14159265358979 * sigma2 * 2)) * exp(-((x*x) / (sigma2 * 2)));
-			}
-
-			void main()
-			{
-				vec3 color = vec3(0);
-				float sigma = float(KernelSize) * SigmaFactor;
-				float sigma2 = sigma * sigma;
-				float strength = 1.0 - BlurStrength;
-
-				vec2 offset;
-				if (Orientation == 0)
-				{
-					offset = vec2(TexelSize.x, 0);
-				}
-				else
-				{
-					offset = vec2(0, TexelSize.y);
-				}
-
-				for (int i = -KernelSize; i <= KernelSize; i++)
-				{
-					vec2 vOffset = offset * float(i);
-					color +=
-						texture(RT, vTexCoord + vOffset).rgb *
-						Gaussian(offset * strength, sigma2);
-				}
-
-				fragColor.rgb = color;
-				fragColor.a = texture(RT, vTexCoord).a;
-			}
-
-		);
-
 }
 
 class LogStream : public Assimp::LogStream
@@ -201,7 +158,245 @@ private:
 
 };
 
-bool AchScene_2::Setup( sf::RenderWindow& window, sync_device* rocket )
+namespace
+{
+
+	const std::string SkyTexturePath = "sky.png";
+
+	const std::string SignTexturePaths[] = 
+	{
+		"tsugaku.png",
+		"susume.png",
+		"tsukodome.png",
+		"oudan.png"
+	};
+
+	const std::string MeshPath = "pole.obj";
+
+	// Interleaved vertex of the mesh (20 bytes instead of 32)
+	struct MeshVertex
+	{
+		glm::vec3 position;
+		GLuint normal;			// SNorm2_10_10_10
+		GLuint texcoord;		// Half float x 2
+	};
+
+	// Parameters of a draw, matching DrawParams of RenderVs (std430)
+	struct RenderDrawParams
+	{
+		glm::mat4 modelMatrix;
+		int mode;
+		int padding[3];			// Array stride is a multiple of the alignment of mat4
+	};
+
+	static_assert(sizeof(RenderDrawParams) == 80, "RenderDrawParams does not match std430 layout");
+
+	// Maximum number of poles and signs drawn in a submission
+	const int MaxDraws = 64;
+
+	// Decode an image and write the RGBA8 texels into the bundle
+	bool LoadImageFile(AssetBundleWriter& writer, const std::string& path)
+	{
+		FW_PROFILE_SCOPE("AchScene_2::LoadImage");
+
+		sf::Image image;
+		if (!image.loadFromFile(path))
+		{
+			FW_LOG_ERROR("Failed to load " + path);
+			return false;
+		}
+
+		auto size = image.getSize();
+		auto& entry = writer.AddEntry(path);
+		entry.Write<unsigned int>(size.x);
+		entry.Write<unsigned int>(size.y);
+		entry.WriteArray(image.getPixelsPtr(), size.x * size.y * 4);
+
+		return true;
+	}
+
+	// Decode an image and write the texels compressed to BC7 into the bundle
+	bool LoadCompressedImageFile(AssetBundleWriter& writer, const std::string& path)
+	{
+		FW_PROFILE_SCOPE("AchScene_2::LoadCompressedImage");
+
+		sf::Image image;
+		if (!image.loadFromFile(path))
+		{
+			FW_LOG_ERROR("Failed to load " + path);
+			return false;
+		}
+
+		auto size = image.getSize();
+		std::vector<unsigned char> blocks;
+		BlockCompressor::Compress(BlockFormat::BC7, image.getPixelsPtr(), size.x, size.y, blocks);
+
+		auto& entry = writer.AddEntry(path);
+		entry.Write<unsigned int>(size.x);
+		entry.Write<unsigned int>(size.y);
+		entry.WriteArray(&blocks[0], blocks.size());
+
+		return true;
+	}
+
+	// Read an image written by LoadImageFile
+	const sf::Uint8* FindImage(const AssetBundle& bundle, const std::string& path, unsigned int& width, unsigned int& height)
+	{
+		AssetBundleReader reader;
+		if (!bundle.Find(path, reader))
+		{
+			return nullptr;
+		}
+
+		size_t count;
+		width = reader.Read<unsigned int>();
+		height = reader.Read<unsigned int>();
+		const auto* pixels = reader.ReadArray<sf::Uint8>(count);
+		if (reader.Failed() || count != (size_t)width * height * 4)
+		{
+			FW_LOG_ERROR("Invalid bundle entry: " + path);
+			return nullptr;
+		}
+
+		return pixels;
+	}
+
+	// Read an image written by LoadCompressedImageFile
+	const unsigned char* FindCompressedImage(const AssetBundle& bundle, const std::string& path, unsigned int& width, unsigned int& height, size_t& size)
+	{
+		AssetBundleReader reader;
+		if (!bundle.Find(path, reader))
+		{
+			return nullptr;
+		}
+
+		width = reader.Read<unsigned int>();
+		height = reader.Read<unsigned int>();
+		const auto* blocks = reader.ReadArray<unsigned char>(size);
+		if (reader.Failed() || size != (size_t)BlockCompressor::CompressedSize(BlockFormat::BC7, width, height))
+		{
+			FW_LOG_ERROR("Invalid bundle entry: " + path);
+			return nullptr;
+		}
+
+		return blocks;
+	}
+
+}
+
+bool AchScene_2::Load( fw::AssetBundleWriter& writer )
+{
+	FW_PROFILE_SCOPE("AchScene_2::Load");
+
+	// Images are decoded in parallel with the mesh
+	std::vector<std::future<bool>> imageResults;
+	imageResults.push_back(std::async(std::launch::async, [&writer]()
+	{
+		return LoadImageFile(writer, SkyTexturePath);
+	}));
+
+	for (int i = 0; i < 4; i++)
+	{
+		imageResults.push_back(std::async(std::launch::async, [&writer, i]()
+		{
+			return LoadCompressedImageFile(writer, SignTexturePaths[i]);
+		}));
+	}
+
+	bool result = LoadMesh(writer, MeshPath);
+	for (auto& imageResult : imageResults)
+	{
+		if (!imageResult.get())
+		{
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+bool AchScene_2::LoadMesh( fw::AssetBundleWriter& writer, const std::string& path )
+{
+	FW_PROFILE_SCOPE("AchScene_2::LoadMesh");
+
+	// Prepare for the logger of Assimp
+	Assimp::DefaultLogger::create("", Assimp::Logger::VERBOSE);
+	Assimp::DefaultLogger::get()->attachStream(new LogStream(Logger::LogLevel::Information), Assimp::Logger::Info);
+	Assimp::DefaultLogger::get()->attachStream(new LogStream(Logger::LogLevel::Warning), Assimp::Logger::Warn);
+	Assimp::DefaultLogger::get()->attachStream(new LogStream(Logger::LogLevel::Error), Assimp::Logger::Err);
+#ifdef _DEBUG
+	Assimp::DefaultLogger::get()->attachStream(new LogStream(Logger::LogLevel::Debug), Assimp::Logger::Debugging);
+#endif
+
+	// Load file
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path,
+		//aiProcess_GenNormals |
+		aiProcess_GenSmoothNormals |
+		//aiProcess_CalcTangentSpace |
+		aiProcess_Triangulate);
+		//aiProcess_JoinIdenticalVertices);
+
+	if (!scene)
+	{
+		FW_LOG_ERROR(importer.GetErrorString());
+		Assimp::DefaultLogger::kill();
+		return false;
+	}
+
+	// Load triangle meshes
+	// TODO : select mesh by name
+	std::vector<MeshVertex> vertices;
+	std::vector<unsigned int> faces;
+	unsigned int lastNumFaces = 0;
+	for (unsigned int meshIdx = 0; meshIdx < scene->mNumMeshes; meshIdx++)
+	{
+		auto* mesh = scene->mMeshes[meshIdx];
+
+		// Vertices
+		// Normals and texture coordinates are quantized
+		bool hasTexcoords = mesh->HasTextureCoords(0);
+		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+		{
+			auto& p = mesh->mVertices[i];
+			auto& n = mesh->mNormals[i];
+
+			MeshVertex vertex;
+			vertex.position = glm::vec3(p.x, p.y, p.z);
+			vertex.normal = GLVertexLayout::PackSNorm2_10_10_10(glm::vec4(n.x, n.y, n.z, 0.0f));
+			vertex.texcoord = 0;
+			if (hasTexcoords)
+			{
+				auto& uv = mesh->mTextureCoords[0][i];
+				vertex.texcoord = glm::packHalf2x16(glm::vec2(uv.x, uv.y));
+			}
+
+			vertices.push_back(vertex);
+		}
+
+		// Faces
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		{
+			// The mesh is already triangulated
+			auto& f = mesh->mFaces[i];
+			faces.push_back(lastNumFaces + f.mIndices[0]);
+			faces.push_back(lastNumFaces + f.mIndices[1]);
+			faces.push_back(lastNumFaces + f.mIndices[2]);
+		}
+
+		lastNumFaces += mesh->mNumFaces;
+	}
+
+	Assimp::DefaultLogger::kill();
+
+	auto& entry = writer.AddEntry(path);
+	entry.WriteArray(vertices.empty() ? nullptr : &vertices[0], vertices.size());
+	entry.WriteArray(faces.empty() ? nullptr : &faces[0], faces.size());
+
+	return true;
+}
+
+bool AchScene_2::Setup( sf::RenderWindow& window, sync_device* rocket, fw::GLShaderRegistry& shaders )
 {
 	// Tracks
 	track_Scale = sync_get_track(rocket, "achscene2.Scale");
@@ -219,70 +414,88 @@ bool AchScene_2::Setup( sf::RenderWindow& window, sync_device* rocket )
 
 	// --------------------------------------------------------------------------------
 
-	if (!skyTexture.loadFromFile("sky.png"))
-	{
-		FW_LOG_ERROR("Failed to load image");
-		return false;
-	}
-
-	skySprite.setTexture(skyTexture);
-	skySprite.setPosition(0.0f, 0.0f);
-
-	// --------------------------------------------------------------------------------
-
 	// Shaders
+	// Only requested here and compiled while the assets are loaded, collected in Upload.
 	ShaderUtil::ShaderTemplateDict dict;
+	dict["DrawBlock"] = ShaderUtil::DrawBlock(MaxDraws);
 
 	FW_LOG_INFO("Loading renderShader");
-	renderShader = std::make_shared<GLShader>();
-	renderShader->CompileString(GLShaderType::VertexShader, ShaderUtil::GenerateShaderString(RenderVs, dict));
-	renderShader->CompileString(GLShaderType::FragmentShader, ShaderUtil::GenerateShaderString(RenderFs, dict));
-	renderShader->Link();
+	renderShader = shaders.Pipeline(
+		ShaderUtil::GenerateShaderString(RenderVs, dict),
+		ShaderUtil::GenerateShaderString(RenderFs, dict));
 
 	FW_LOG_INFO("Loading gaussianBlurShader");
-	gaussianBlurShader = std::make_shared<GLShader>();
-	gaussianBlurShader->CompileString(GLShaderType::VertexShader, ShaderUtil::GenerateShaderString(QuadVs, dict));
-	gaussianBlurShader->CompileString(GLShaderType::FragmentShader, ShaderUtil::GenerateShaderString(GaussianBlurFs, dict));
-	gaussianBlurShader->Link();
+	gaussianBlurShader = shaders.Pipeline(
+		ShaderUtil::GenerateShaderString(CommonShaders::QuadVs, dict),
+		ShaderUtil::GenerateShaderString(CommonShaders::GaussianBlurFs, dict));
 
-	// --------------------------------------------------------------------------------
+	// Uniform blocks
+	cameraUbo = std::make_shared<GLUniformBuffer>();
+	blurUbo = std::make_shared<GLUniformBuffer>();
+
+	return true;
+}
 
-	// Sign textures
-	const std::string signTexturePaths[] = 
+bool AchScene_2::Upload( const fw::AssetBundle& bundle )
+{
+	if (!WaitShaders())
 	{
-		"tsugaku.png",
-		"susume.png",
-		"tsukodome.png",
-		"oudan.png"
-	};
+		return false;
+	}
 
-	for (const auto& path : signTexturePaths)
+	// Sky
+	unsigned int width, height;
+	const auto* skyPixels = FindImage(bundle, SkyTexturePath, width, height);
+	if (!skyPixels || !skyTexture.create(width, height))
 	{
-		sf::Image image;
-		if (!image.loadFromFile(path))
+		FW_LOG_ERROR("Failed to load image");
+		return false;
+	}
+
+	skyTexture.update(skyPixels);
+	skySprite.setTexture(skyTexture);
+	skySprite.setPosition(0.0f, 0.0f);
+
+	// --------------------------------------------------------------------------------
+
+	// Sign textures (BC7 compressed while loading)
+	for (const auto& path : SignTexturePaths)
+	{
+		size_t size;
+		const auto* blocks = FindCompressedImage(bundle, path, width, height, size);
+		if (!blocks)
 		{
-			FW_LOG_ERROR("Failed to load " + path);
 			return false;
 		}
 
-		auto size = image.getSize();
 		auto texture = std::make_shared<GLTexture2D>();
 		texture->SetMagFilter(GL_LINEAR);
 		texture->SetMinFilter(GL_LINEAR);
 		texture->SetWrap(GL_CLAMP_TO_EDGE);
-		texture->Allocate(size.x, size.y, GL_RGBA16F, GL_RGBA, GL_UNSIGNED_BYTE, image.getPixelsPtr());
+		texture->AllocateCompressed(width, height, BlockCompressor::InternalFormat(BlockFormat::BC7), (int)size, blocks);
 		
 		signTextures.push_back(texture);
 	}
 
 	// --------------------------------------------------------------------------------
 
-	// Mesh for traffic sign
-	quadVao = std::make_shared<GLVertexArray>();
-	quadPositionVbo = std::make_shared<GLVertexBuffer>();
-	quadTexcoordVbo = std::make_shared<GLVertexBuffer>();
-	quadIbo = std::make_shared<GLIndexBuffer>();
+	// Mesh
+	AssetBundleReader reader;
+	if (!bundle.Find(MeshPath, reader))
+	{
+		return false;
+	}
 
+	size_t numVertices, numFaces;
+	const auto* vertices = reader.ReadArray<MeshVertex>(numVertices);
+	const auto* faces = reader.ReadArray<unsigned int>(numFaces);
+	if (reader.Failed() || numVertices == 0 || numFaces == 0)
+	{
+		FW_LOG_ERROR("Invalid bundle entry: " + MeshPath);
+		return false;
+	}
+
+	// Quad for the traffic signs and the blur passes
 	const glm::vec3 quadPositions[] =
 	{
 		glm::vec3( 1.0f,  1.0f, 0.0f),
@@ -305,251 +518,201 @@ bool AchScene_2::Setup( sf::RenderWindow& window, sync_device* rocket )
 		2, 3, 0
 	};
 
-	quadPositionVbo->AddStatic(12, &quadPositions[0].x);
-	quadVao->Add(GLDefaultVertexAttribute::Position, quadPositionVbo.get());
-
-	quadTexcoordVbo->AddStatic(8, &quadTexcoords[0].x);
-	quadVao->Add(GLDefaultVertexAttribute::TexCoord0, quadTexcoordVbo.get());
-	
-	quadIbo->AddStatic(6, quadIndices);
-
-	// --------------------------------------------------------------------------------
-
-	// Vertex data
-	std::vector<float> positions;
-	std::vector<float> normals;
-	std::vector<float> texcoords;
-	std::vector<unsigned int> faces;
-
+	MeshVertex quadVertices[4];
+	for (int i = 0; i < 4; i++)
 	{
-		FW_LOG_INDENTER();
-
-		// Prepare for the logger of Assimp
-		Assimp::DefaultLogger::create("", Assimp::Logger::VERBOSE);
-		Assimp::DefaultLogger::get()->attachStream(new LogStream(Logger::LogLevel::Information), Assimp::Logger::Info);
-		Assimp::DefaultLogger::get()->attachStream(new LogStream(Logger::LogLevel::Warning), Assimp::Logger::Warn);
-		Assimp::DefaultLogger::get()->attachStream(new LogStream(Logger::LogLevel::Error), Assimp::Logger::Err);
-#ifdef _DEBUG
-		Assimp::DefaultLogger::get()->attachStream(new LogStream(Logger::LogLevel::Debug), Assimp::Logger::Debugging);
-#endif
-
-		// Load file
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile("pole.obj",
-			//aiProcess_GenNormals |
-			aiProcess_GenSmoothNormals |
-			//aiProcess_CalcTangentSpace |
-			aiProcess_Triangulate);
-			//aiProcess_JoinIdenticalVertices);
+		quadVertices[i].position = quadPositions[i];
+		quadVertices[i].normal = GLVertexLayout::PackSNorm2_10_10_10(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
+		quadVertices[i].texcoord = glm::packHalf2x16(quadTexcoords[i]);
+	}
 
-		if (!scene)
-		{
-			FW_LOG_ERROR(importer.GetErrorString());
-			return false;
-		}
+	// The pole and the quad share the buffers
+	GLVertexLayout layout(sizeof(MeshVertex));
+	layout.Add(GLDefaultVertexAttribute::Position, GLVertexFormat::Float, offsetof(MeshVertex, position));
+	layout.Add(GLDefaultVertexAttribute::Normal.index, 4, GLVertexFormat::SNorm2_10_10_10, offsetof(MeshVertex, normal));
+	layout.Add(GLDefaultVertexAttribute::TexCoord0, GLVertexFormat::HalfFloat, offsetof(MeshVertex, texcoord));
 
-		// Load triangle meshes
-		// TODO : select mesh by name
-		unsigned int lastNumFaces = 0;
-		for (unsigned int meshIdx = 0; meshIdx < scene->mNumMeshes; meshIdx++)
-		{
-			auto* mesh = scene->mMeshes[meshIdx];
+	geometry = std::make_shared<GLGeometryPool>(layout, (int)numVertices + 4, (int)numFaces + 6);
+	meshRange = geometry->Add(vertices, (int)numVertices, faces, (int)numFaces);
+	quadRange = geometry->Add(quadVertices, 4, quadIndices, 6);
 
-			// Positions and normals
-			for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-			{
-				auto& p = mesh->mVertices[i];
-				auto& n = mesh->mNormals[i];
-				positions.push_back(p.x);
-				positions.push_back(p.y);
-				positions.push_back(p.z);
-				normals.push_back(n.x);
-				normals.push_back(n.y);
-				normals.push_back(n.z);
-			}
+	drawBatch = std::make_shared<GLDrawBatch>((int)sizeof(RenderDrawParams), MaxDraws);
+	drawBatch->Attach(*geometry);
 
-			// Texture coordinates
-			if (mesh->HasTextureCoords(0))
-			{
-				for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-				{
-					auto& uv = mesh->mTextureCoords[0][i];
-					texcoords.push_back(uv.x);
-					texcoords.push_back(uv.y);
-				}
-			}
-
-			// Faces
-			for (unsigned int i = 0; i < mesh->mNumFaces; i++)
-			{
-				// The mesh is already triangulated
-				auto& f = mesh->mFaces[i];
-				faces.push_back(lastNumFaces + f.mIndices[0]);
-				faces.push_back(lastNumFaces + f.mIndices[1]);
-				faces.push_back(lastNumFaces + f.mIndices[2]);
-			}
-
-			lastNumFaces += mesh->mNumFaces;
-		}
+	return true;
+}
 
-		Assimp::DefaultLogger::kill();
+bool AchScene_2::WaitShaders()
+{
+	if (!renderShader->WaitLink() ||
+		!gaussianBlurShader->WaitLink())
+	{
+		return false;
 	}
 
-	// --------------------------------------------------------------------------------
-
-	// Setup vertex buffer
-	meshVao = std::make_shared<fw::GLVertexArray>();
+	// Constant uniforms
+	renderShader->Begin();
+	renderShader->SetUniform("RT", 0);
+	renderShader->End();
 
-	meshPositionVbo = std::make_shared<fw::GLVertexBuffer>();
-	meshPositionVbo->AddStatic((int)positions.size(), &positions[0]);
-	meshVao->Add(GLDefaultVertexAttribute::Position, meshPositionVbo.get());
-	
-	meshNormalVbo = std::make_shared<fw::GLVertexBuffer>();
-	meshNormalVbo->AddStatic((int)normals.size(), &normals[0]);
-	meshVao->Add(GLDefaultVertexAttribute::Normal, meshNormalVbo.get());
+	gaussianBlurShader->Begin();
+	gaussianBlurShader->SetUniform("RT", 0);
+	gaussianBlurShader->End();
 
-	if (!texcoords.empty())
+	// Uniforms set every frame
+	if (!gaussianBlurShader->ResolveUniform("Orientation", gaussianBlurShader_Orientation))
 	{
-		meshTexcoordVbo = std::make_shared<fw::GLVertexBuffer>();
-		meshTexcoordVbo->AddStatic((int)texcoords.size(), &texcoords[0]);
-		meshVao->Add(GLDefaultVertexAttribute::TexCoord0, meshTexcoordVbo.get());
+		return false;
 	}
-	
-	meshIbo = std::make_shared<GLIndexBuffer>();
-	meshIbo->AddStatic((int)faces.size(), &faces[0]);
-
-	// --------------------------------------------------------------------------------
-
-	// FBOs
-	auto windowSize = window.getSize();
-	primaryRt = std::make_shared<GLTexture2D>();
-	primaryRt->SetMagFilter(GL_LINEAR);
-	primaryRt->SetMinFilter(GL_LINEAR);
-	primaryRt->SetWrap(GL_CLAMP_TO_EDGE);
-	primaryRt->Allocate(windowSize.x, windowSize.y, GL_RGBA16F);
-	primaryFbo = std::make_shared<GLFrameBuffer>(
-		windowSize.x, windowSize.y,
-		glm::vec4(glm::vec3(1.0f), 1.0f));
-	primaryFbo->AddRenderTarget(primaryRt.get());
-
-	horizontalBlurRt = std::make_shared<GLTexture2D>();
-	horizontalBlurRt->SetMagFilter(GL_LINEAR);
-	horizontalBlurRt->SetMinFilter(GL_LINEAR);
-	horizontalBlurRt->SetWrap(GL_CLAMP_TO_EDGE);
-	horizontalBlurRt->Allocate(windowSize.x / 2, windowSize.y / 2, GL_RGBA16F);
-	horizontalBlurFbo = std::make_shared<GLFrameBuffer>(
-		windowSize.x / 2, windowSize.y / 2,
-		glm::vec4(glm::vec3(), 1.0f));
-	horizontalBlurFbo->AddRenderTarget(horizontalBlurRt.get());
 
 	return true;
 }
 
-void AchScene_2::Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer& fbo )
+void AchScene_2::Draw( sf::RenderWindow& window, double milli, fw::FrameGraph& graph, fw::FrameGraphResource output )
 {
+	graph.BeginGroup("AchScene_2::Draw");
+
 	// Current row number
 	double row = Util::MilliToRow(milli);
 
-	// --------------------------------------------------------------------------------
+	// Render targets
+	// The output can be smaller than the window with the dynamic resolution.
+	auto size = glm::ivec2(graph.Width(output), graph.Height(output));
+	auto primary = graph.CreateRenderTarget(
+		"AchScene_2::Primary", size.x, size.y, GL_RGBA16F,
+		glm::vec4(glm::vec3(1.0f), 1.0f));
+	auto horizontalBlur = graph.CreateRenderTarget(
+		"AchScene_2::HorizontalBlur", size.x / 2, size.y / 2, GL_RGBA16F,
+		glm::vec4(glm::vec3(), 1.0f));
 
-	primaryFbo->Begin();
-	
-	// Render background
-	{
-		window.pushGLStates();
-		window.draw(skySprite);
-		window.popGLStates();
-	}
+	// --------------------------------------------------------------------------------
 
 	auto viewMatrix = glm::lookAt(
 		glm::vec3(2.5f, 4.0f, 6.0f),
 		glm::vec3(0.0f, 5.5f, 0.0f),
 		glm::vec3(0.0f, 1.0f, 0.0f));
 
-	auto size = window.getSize();
 	auto projectionMatrix = glm::perspective(
 		60.0f,
 		(float)size.x / size.y,
 		0.1f,
 		1000.0f);
 
-	renderShader->Begin();
-	renderShader->SetUniform("ViewMatrix", viewMatrix);
-	renderShader->SetUniform("ProjectionMatrix", projectionMatrix);
+	glm::mat4 poleModelMatrix = 
+		glm::translate(
+			glm::mat4(1.0f),
+			glm::vec3(
+				sync_get_val(track_X, row),
+				0.0f,
+				0.0f)) *
+		glm::scale(
+			glm::mat4(1.0f),
+			glm::vec3(
+				sync_get_val(track_Scale, row)));
+
+	const float zs[] = { 2.0f, 3.0f };
+	float xs[2] =
+	{
+		sync_get_val(track_X2, row),
+		sync_get_val(track_X3, row)
+	};
+	int texIndices[2] =
+	{
+		glm::clamp((int)sync_get_val(track_TexIndex2, row), 0, (int)signTextures.size()-1),
+		glm::clamp((int)sync_get_val(track_TexIndex3, row), 0, (int)signTextures.size()-1)
+	};
 
-	// Render poles
+	glm::mat4 signModelMatrices[2];
+	for (int i = 0; i < 2; i++)
 	{
-		glm::mat4 modelMatrix = 
+		signModelMatrices[i] = 
 			glm::translate(
 				glm::mat4(1.0f),
-				glm::vec3(
-					sync_get_val(track_X, row),
-					0.0f,
-					0.0f)) *
+				glm::vec3(xs[i], 4.0f, zs[i])) *
+			glm::rotate(glm::mat4(1.0f), -90.0f, glm::vec3(0.0f, 1.0f, 0.0f)) *
 			glm::scale(
 				glm::mat4(1.0f),
-				glm::vec3(
-					sync_get_val(track_Scale, row)));
-
-		renderShader->SetUniform("ModelMatrix", modelMatrix);
-		renderShader->SetUniform("Mode", 0);
-		meshVao->Draw(GL_TRIANGLES, meshIbo.get());
+				glm::vec3(sync_get_val(track_Scale2, row))) *
+			glm::scale(
+				glm::mat4(1.0f),
+				glm::vec3(1.0f, 1.5f, 0.0f));
 	}
 
-	// Render signs
-	{
-		glPushAttrib(GL_ENABLE_BIT);
-		glDisable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_FRONT);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-		const float zs[] = { 2.0f, 3.0f };
-		float xs[2] =
-		{
-			sync_get_val(track_X2, row),
-			sync_get_val(track_X3, row)
-		};
-		int texIndices[2] =
-		{
-			glm::clamp((int)sync_get_val(track_TexIndex2, row), 0, (int)signTextures.size()-1),
-			glm::clamp((int)sync_get_val(track_TexIndex3, row), 0, (int)signTextures.size()-1)
-		};
-		for (int i = 0; i < 2; i++)
+	CameraBlock camera;
+	camera.viewMatrix = viewMatrix;
+	camera.projectionMatrix = projectionMatrix;
+	cameraUbo->Update(&camera, sizeof(camera), graph.StreamBuffer());
+
+	// Render primary
+	graph.AddPass("AchScene_2::Primary")
+		.Write(primary)
+		.Execute([=, &window](FrameGraph& graph)
 		{
-			glm::mat4 modelMatrix = 
-				glm::translate(
-					glm::mat4(1.0f),
-					glm::vec3(xs[i], 4.0f, zs[i])) *
-				glm::rotate(glm::mat4(1.0f), -90.0f, glm::vec3(0.0f, 1.0f, 0.0f)) *
-				glm::scale(
-					glm::mat4(1.0f),
-					glm::vec3(sync_get_val(track_Scale2, row))) *
-				glm::scale(
-					glm::mat4(1.0f),
-					glm::vec3(1.0f, 1.5f, 0.0f));
-		
-			renderShader->SetUniform("ModelMatrix", modelMatrix);
-			renderShader->SetUniform("Mode", 1);
-			renderShader->SetUniform("RT", 0);
-		
-			signTextures[texIndices[i]]->Bind(0);
-			quadVao->Draw(GL_TRIANGLES, quadIbo.get());
-			signTextures[texIndices[i]]->Unbind();
-		}
+			// Render background
+			// SFML sets the viewport from the size of the window,
+			// so the view is shrunk to the lower left part of the size of the render target.
+			{
+				auto windowSize = window.getSize();
+				float sx = (float)size.x / windowSize.x;
+				float sy = (float)size.y / windowSize.y;
+				auto view = window.getDefaultView();
+				view.setViewport(sf::FloatRect(0.0f, 1.0f - sy, sx, sy));
+
+				// SFML modifies the states without the cache
+				GLStateCache::Reset();
+				window.pushGLStates();
+				window.setView(view);
+				window.draw(skySprite);
+				window.setView(window.getDefaultView());
+				window.popGLStates();
+				GLStateCache::Invalidate();
+			}
 
-		glPopAttrib();
-	}
+			renderShader->Begin();
+			cameraUbo->BindBlock((int)UniformBlockBinding::Camera);
 
-	renderShader->End();
-	primaryFbo->End();
+			// Render poles
+			{
+				RenderDrawParams params;
+				params.modelMatrix = poleModelMatrix;
+				params.mode = 0;
+				drawBatch->Add(meshRange, &params);
+				drawBatch->Submit(GL_TRIANGLES, *geometry, ShaderUtil::DrawBlockBinding(), graph.StreamBuffer());
+			}
+
+			// Render signs
+			{
+				GLStateCache::PushState();
+				GLStateCache::Disable(GL_DEPTH_TEST);
+				GLStateCache::Enable(GL_CULL_FACE);
+				GLStateCache::CullFace(GL_FRONT);
+				GLStateCache::Enable(GL_BLEND);
+				GLStateCache::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+				// Signs are blended without depth test, so they are drawn in order.
+				// Signs with the same texture become the instances of one command.
+				for (int i = 0; i < 2; i++)
+				{
+					RenderDrawParams params;
+					params.modelMatrix = signModelMatrices[i];
+					params.mode = 1;
+					drawBatch->Add(quadRange, &params, signTextures[texIndices[i]].get());
+				}
+
+				drawBatch->Submit(GL_TRIANGLES, *geometry, ShaderUtil::DrawBlockBinding(), graph.StreamBuffer());
+
+				GLStateCache::PopState();
+			}
+
+			renderShader->End();
+		});
 
 	// --------------------------------------------------------------------------------
 
 	// Texel size
-	auto sizeF = glm::vec2((float)size.x, (float)size.y);
-	glm::vec2 texelSize = 1.0f / sizeF;
+	// Relative to the window so that the width of the blur is independent of the render scale
+	auto windowSize = window.getSize();
+	glm::vec2 texelSize = 1.0f / glm::vec2((float)windowSize.x, (float)windowSize.y);
 
 	// Blur factor
 	//const float sigmaFactor = 0.7f;
@@ -561,33 +724,42 @@ void AchScene_2::Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer
 	//int kernelSize = 7.0f;
 	//float blurStrength = 1.0f;
 
+	BlurBlock blur;
+	blur.texelSize = texelSize;
+	blur.sigmaFactor = sigmaFactor;
+	blur.kernelSize = kernelSize;
+	blur.blurStrength = blurStrength;
+	blurUbo->Update(&blur, sizeof(blur), graph.StreamBuffer());
+
 	// Horizontal blur
-	horizontalBlurFbo->Begin();
-	gaussianBlurShader->Begin();
-	gaussianBlurShader->SetUniform("RT", 0);
-	gaussianBlurShader->SetUniform("Orientation", 0);
-	gaussianBlurShader->SetUniform("TexelSize", texelSize);
-	gaussianBlurShader->SetUniform("SigmaFactor", sigmaFactor);
-	gaussianBlurShader->SetUniform("KernelSize", kernelSize);
-	gaussianBlurShader->SetUniform("BlurStrength", blurStrength);
-	primaryRt->Bind();
-	quadVao->Draw(GL_TRIANGLES, quadIbo.get());
-	primaryRt->Unbind();
-	gaussianBlurShader->End();
-	horizontalBlurFbo->End();
+	graph.AddPass("AchScene_2::HorizontalBlur")
+		.Read(primary)
+		.Write(horizontalBlur)
+		.Execute([=](FrameGraph& graph)
+		{
+			gaussianBlurShader->Begin();
+			gaussianBlurShader->SetUniform(gaussianBlurShader_Orientation, 0);
+			blurUbo->BindBlock((int)UniformBlockBinding::Blur);
+			graph.Texture(primary)->Bind();
+			geometry->Draw(GL_TRIANGLES, quadRange);
+			graph.Texture(primary)->Unbind();
+			gaussianBlurShader->End();
+		});
 
 	// Vertical blur
-	fbo.Begin();
-	gaussianBlurShader->Begin();
-	gaussianBlurShader->SetUniform("RT", 0);
-	gaussianBlurShader->SetUniform("Orientation", 1);
-	gaussianBlurShader->SetUniform("TexelSize", texelSize);
-	gaussianBlurShader->SetUniform("SigmaFactor", sigmaFactor);
-	gaussianBlurShader->SetUniform("KernelSize", kernelSize);
-	gaussianBlurShader->SetUniform("BlurStrength", blurStrength);
-	horizontalBlurRt->Bind();
-	quadVao->Draw(GL_TRIANGLES, quadIbo.get());
-	horizontalBlurRt->Unbind();
-	gaussianBlurShader->End();
-	fbo.End();
+	graph.AddPass("AchScene_2::VerticalBlur")
+		.Read(horizontalBlur)
+		.Write(output)
+		.Execute([=](FrameGraph& graph)
+		{
+			gaussianBlurShader->Begin();
+			gaussianBlurShader->SetUniform(gaussianBlurShader_Orientation, 1);
+			blurUbo->BindBlock((int)UniformBlockBinding::Blur);
+			graph.Texture(horizontalBlur)->Bind();
+			geometry->Draw(GL_TRIANGLES, quadRange);
+			graph.Texture(horizontalBlur)->Unbind();
+			gaussianBlurShader->End();
+		});
+
+	graph.EndGroup();
 }
@@ -3,27 +3,25 @@
 #define ACHFIVESEC_ACH_SCENE_2_H
 
 #include "scene.h"
+#include "gl.h"
+#include "glgeometrypool.h"
+#include "gldrawbatch.h"
 #include <SFML/Graphics/Texture.hpp>
 #include <SFML/Graphics/Sprite.hpp>
+#include <vector>
 
 struct sync_track;
 
-namespace fw
-{
-	class GLShader;
-	class GLVertexArray;
-	class GLVertexBuffer;
-	class GLIndexBuffer;
-	class GLTexture2D;
-}
 
 class AchScene_2 : public Scene
 {
 public:
 
 	virtual std::string Name() const { return "AchScene_2"; }
-	virtual bool Setup( sf::RenderWindow& window, sync_device* rocket );
-	virtual void Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer& fbo );
+	virtual bool Load( fw::AssetBundleWriter& writer );
+	virtual bool Setup( sf::RenderWindow& window, sync_device* rocket, fw::GLShaderRegistry& shaders );
+	virtual bool Upload( const fw::AssetBundle& bundle );
+	virtual void Draw( sf::RenderWindow& window, double milli, fw::FrameGraph& graph, fw::FrameGraphResource output );
 
 private:
 
@@ -40,6 +38,13 @@ private:
 	const sync_track* track_SigmaFactor;
 	const sync_track* track_BlurStrength;
 
+private:
+
+	bool LoadMesh(fw::AssetBundleWriter& writer, const std::string& path);
+
+	//! Wait for the shaders requested in Setup and resolve the uniforms.
+	bool WaitShaders();
+
 private:
 
 	sf::Texture skyTexture;
@@ -47,26 +52,23 @@ private:
 
 private:
 
-	std::shared_ptr<fw::GLShader> renderShader;
-	std::shared_ptr<fw::GLShader> gaussianBlurShader;
+	std::shared_ptr<fw::GLProgramPipeline> renderShader;
+	std::shared_ptr<fw::GLProgramPipeline> gaussianBlurShader;
+	std::shared_ptr<fw::GLUniformBuffer> cameraUbo;
+	std::shared_ptr<fw::GLUniformBuffer> blurUbo;
 
-	std::shared_ptr<fw::GLVertexArray> meshVao;
-	std::shared_ptr<fw::GLVertexBuffer> meshPositionVbo;
-	std::shared_ptr<fw::GLVertexBuffer> meshNormalVbo;
-	std::shared_ptr<fw::GLVertexBuffer> meshTexcoordVbo;
-	std::shared_ptr<fw::GLIndexBuffer> meshIbo;
+	// Uniforms set every frame, resolved in Upload
+	fw::GLUniformHandle<int> gaussianBlurShader_Orientation;
 
-	std::shared_ptr<fw::GLVertexArray> quadVao;
-	std::shared_ptr<fw::GLVertexBuffer> quadPositionVbo;
-	std::shared_ptr<fw::GLVertexBuffer> quadTexcoordVbo;
-	std::shared_ptr<fw::GLIndexBuffer> quadIbo;
+	// Pole mesh and quad in the same buffers
+	std::shared_ptr<fw::GLGeometryPool> geometry;
+	fw::GLGeometryRange meshRange;
+	fw::GLGeometryRange quadRange;
 
-	std::vector<std::shared_ptr<fw::GLTexture2D>> signTextures;
+	// Poles and signs drawn with the parameters in a storage buffer
+	std::shared_ptr<fw::GLDrawBatch> drawBatch;
 
-	std::shared_ptr<fw::GLTexture2D> primaryRt;
-	std::shared_ptr<fw::GLFrameBuffer> primaryFbo;
-	std::shared_ptr<fw::GLTexture2D> horizontalBlurRt;
-	std::shared_ptr<fw::GLFrameBuffer> horizontalBlurFbo;
+	std::vector<std::shared_ptr<fw::GLTexture2D>> signTextures;
 
 };
 
@@ -0,0 +1,242 @@
+#include "pch.h"
+#include "assetbundle.h"
+#include "logger.h"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace ip = boost::interprocess;
+
+namespace
+{
+	const char BundleMagic[8] = { 'A', 'C', 'H', 'B', 'N', 'D', 'L', '\0' };
+	// Incremented when the layout of an entry changes
+	const unsigned int BundleVersion = 3;
+
+	// Entries begin at page boundaries so that uploads read whole pages
+	const unsigned long long EntryAlignment = 4096;
+
+	const int MaxEntryNameLength = 64;
+
+	struct BundleHeader
+	{
+		char magic[8];
+		unsigned int version;
+		unsigned int numEntries;
+		unsigned long long tableOffset;
+	};
+
+	struct BundleTableEntry
+	{
+		char name[MaxEntryNameLength];
+		unsigned long long offset;
+		unsigned long long size;
+	};
+
+	unsigned long long AlignEntry(unsigned long long offset)
+	{
+		return (offset + EntryAlignment - 1) & ~(EntryAlignment - 1);
+	}
+}
+
+FW_NAMESPACE_BEGIN
+
+AssetBundleWriter::Entry& AssetBundleWriter::AddEntry( const std::string& name )
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	entries.push_back(std::unique_ptr<Entry>(new Entry));
+	entries.back()->name = name;
+	return *entries.back();
+}
+
+bool AssetBundleWriter::Save( const std::string& path ) const
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// Layout
+	std::vector<BundleTableEntry> table(entries.size());
+	unsigned long long offset = AlignEntry(sizeof(BundleHeader));
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const auto& entry = *entries[i];
+		if (entry.name.size() >= MaxEntryNameLength)
+		{
+			FW_LOG_ERROR("Too long entry name: " + entry.name);
+			return false;
+		}
+
+		std::memset(&table[i], 0, sizeof(BundleTableEntry));
+		std::strcpy(table[i].name, entry.name.c_str());
+		table[i].offset = offset;
+		table[i].size = entry.data.size();
+		offset = AlignEntry(offset + entry.data.size());
+	}
+
+	BundleHeader header;
+	std::memcpy(header.magic, BundleMagic, sizeof(BundleMagic));
+	header.version = BundleVersion;
+	header.numEntries = (unsigned int)entries.size();
+	header.tableOffset = offset;
+
+	// Write
+	std::ofstream ofs(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!ofs.is_open())
+	{
+		FW_LOG_ERROR("Failed to open " + path);
+		return false;
+	}
+
+	const std::vector<char> padding((size_t)EntryAlignment, 0);
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofs.write(&padding[0], (std::streamsize)(table.empty() ? offset : table[0].offset) - sizeof(header));
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const auto& data = entries[i]->data;
+		if (!data.empty())
+		{
+			ofs.write(reinterpret_cast<const char*>(&data[0]), (std::streamsize)data.size());
+		}
+
+		unsigned long long end = table[i].offset + table[i].size;
+		ofs.write(&padding[0], (std::streamsize)(AlignEntry(end) - end));
+	}
+
+	if (!table.empty())
+	{
+		ofs.write(reinterpret_cast<const char*>(&table[0]), (std::streamsize)(table.size() * sizeof(BundleTableEntry)));
+	}
+
+	if (!ofs)
+	{
+		FW_LOG_ERROR("Failed to write " + path);
+		return false;
+	}
+
+	FW_LOG_INFO(boost::str(boost::format("Wrote %d entries to %s (%.1f MB)")
+		% entries.size() % path % ((offset + table.size() * sizeof(BundleTableEntry)) / (1024.0 * 1024.0))));
+
+	return true;
+}
+
+// --------------------------------------------------------------------------------
+
+class AssetBundle::Impl
+{
+public:
+
+	struct EntryRef
+	{
+		const unsigned char* data;
+		size_t size;
+	};
+
+public:
+
+	std::unique_ptr<ip::file_mapping> mapping;
+	std::unique_ptr<ip::mapped_region> region;
+	std::unordered_map<std::string, EntryRef> entries;
+
+};
+
+AssetBundle::AssetBundle()
+	: p(new Impl)
+{
+
+}
+
+AssetBundle::~AssetBundle()
+{
+	FW_SAFE_DELETE(p);
+}
+
+bool AssetBundle::Open( const std::string& path )
+{
+	p->entries.clear();
+	p->region.reset();
+	p->mapping.reset();
+
+	try
+	{
+		p->mapping.reset(new ip::file_mapping(path.c_str(), ip::read_only));
+		p->region.reset(new ip::mapped_region(*p->mapping, ip::read_only));
+	}
+	catch (const ip::interprocess_exception& e)
+	{
+		FW_LOG_ERROR(boost::str(boost::format("Failed to map %s: %s") % path % e.what()));
+		return false;
+	}
+
+	const auto* base = static_cast<const unsigned char*>(p->region->get_address());
+	size_t size = p->region->get_size();
+
+	// Header
+	BundleHeader header;
+	if (size < sizeof(header))
+	{
+		FW_LOG_ERROR("Invalid bundle: " + path);
+		return false;
+	}
+
+	std::memcpy(&header, base, sizeof(header));
+	if (std::memcmp(header.magic, BundleMagic, sizeof(BundleMagic)) != 0 || header.version != BundleVersion)
+	{
+		FW_LOG_ERROR("Invalid bundle or version mismatch: " + path);
+		return false;
+	}
+
+	if (header.tableOffset > size || header.numEntries > (size - header.tableOffset) / sizeof(BundleTableEntry))
+	{
+		FW_LOG_ERROR("Invalid bundle: " + path);
+		return false;
+	}
+
+	// Entry table
+	const auto* table = reinterpret_cast<const BundleTableEntry*>(base + header.tableOffset);
+	for (unsigned int i = 0; i < header.numEntries; i++)
+	{
+		const auto& e = table[i];
+		if (e.offset > size || e.size > size - e.offset)
+		{
+			FW_LOG_ERROR("Invalid bundle: " + path);
+			p->entries.clear();
+			return false;
+		}
+
+		Impl::EntryRef ref;
+		ref.data = base + e.offset;
+		ref.size = (size_t)e.size;
+		p->entries[std::string(e.name, strnlen(e.name, MaxEntryNameLength))] = ref;
+	}
+
+	FW_LOG_INFO(boost::str(boost::format("Mapped %d entries from %s") % header.numEntries % path));
+	return true;
+}
+
+void AssetBundle::Open( const AssetBundleWriter& writer )
+{
+	p->entries.clear();
+	p->region.reset();
+	p->mapping.reset();
+
+	for (const auto& entry : writer.Entries())
+	{
+		Impl::EntryRef ref;
+		ref.data = entry->data.empty() ? nullptr : &entry->data[0];
+		ref.size = entry->data.size();
+		p->entries[entry->name] = ref;
+	}
+}
+
+bool AssetBundle::Find( const std::string& name, AssetBundleReader& reader ) const
+{
+	auto it = p->entries.find(name);
+	if (it == p->entries.end())
+	{
+		FW_LOG_ERROR("Missing bundle entry: " + name);
+		return false;
+	}
+
+	reader = AssetBundleReader(it->second.data, it->second.size);
+	return true;
+}
+
+FW_NAMESPACE_END
@@ -0,0 +1,238 @@
+#pragma once
+#ifndef LIB_FW_ASSET_BUNDLE_H
+#define LIB_FW_ASSET_BUNDLE_H
+
+#include "common.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstring>
+
+FW_NAMESPACE_BEGIN
+
+/*!
+	Reader of an asset bundle entry.
+	Values and arrays are read in the order they are written.
+	Arrays are returned as pointers into the bundle without copying.
+*/
+class AssetBundleReader
+{
+public:
+
+	AssetBundleReader()
+		: data(nullptr)
+		, size(0)
+		, offset(0)
+		, failed(true)
+	{
+
+	}
+
+	AssetBundleReader(const unsigned char* data, size_t size)
+		: data(data)
+		, size(size)
+		, offset(0)
+		, failed(false)
+	{
+
+	}
+
+public:
+
+	template <typename T>
+	T Read()
+	{
+		T v = T();
+		if (Check(sizeof(T)))
+		{
+			std::memcpy(&v, data + offset, sizeof(T));
+			offset += sizeof(T);
+		}
+		return v;
+	}
+
+	/*!
+		Read an array.
+		\param count Number of elements.
+		\return Pointer to the first element or nullptr if failed.
+	*/
+	template <typename T>
+	const T* ReadArray(size_t& count)
+	{
+		unsigned long long bytes = Read<unsigned long long>();
+		offset = Align(offset);
+		count = 0;
+		if (!Check((size_t)bytes))
+		{
+			return nullptr;
+		}
+
+		const T* p = reinterpret_cast<const T*>(data + offset);
+		offset += (size_t)bytes;
+		count = (size_t)bytes / sizeof(T);
+		return p;
+	}
+
+	/*!
+		Check if all reads have succeeded.
+		\retval true A read exceeded the entry.
+		\retval false All reads have succeeded.
+	*/
+	bool Failed() const { return failed; }
+
+public:
+
+	// Alignment of the arrays relative to the beginning of the entry
+	static size_t Align(size_t offset) { return (offset + 15) & ~(size_t)15; }
+
+private:
+
+	bool Check(size_t bytes)
+	{
+		if (failed || offset > size || bytes > size - offset)
+		{
+			failed = true;
+			return false;
+		}
+		return true;
+	}
+
+private:
+
+	const unsigned char* data;
+	size_t size;
+	size_t offset;
+	bool failed;
+
+};
+
+/*!
+	Asset bundle writer.
+	Collects the entries in memory and writes them as a bundle file.
+	Entries can be added from multiple threads.
+*/
+class AssetBundleWriter
+{
+public:
+
+	class Entry
+	{
+	public:
+
+		template <typename T>
+		void Write(const T& v)
+		{
+			const unsigned char* p = reinterpret_cast<const unsigned char*>(&v);
+			data.insert(data.end(), p, p + sizeof(T));
+		}
+
+		//! Write an array, read back by AssetBundleReader::ReadArray.
+		template <typename T>
+		void WriteArray(const T* v, size_t count)
+		{
+			Write<unsigned long long>(count * sizeof(T));
+			data.resize(AssetBundleReader::Align(data.size()));
+			if (count > 0)
+			{
+				const unsigned char* p = reinterpret_cast<const unsigned char*>(v);
+				data.insert(data.end(), p, p + count * sizeof(T));
+			}
+		}
+
+	public:
+
+		std::string name;
+		std::vector<unsigned char> data;
+
+	};
+
+public:
+
+	AssetBundleWriter() {}
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(AssetBundleWriter);
+
+public:
+
+	/*!
+		Add an entry.
+		The returned reference stays valid while the writer is alive.
+		\param name Name of the entry.
+		\return Entry.
+	*/
+	Entry& AddEntry(const std::string& name);
+
+	/*!
+		Write the bundle file.
+		\param path Path of the bundle.
+		\retval true Succeeded to write the bundle.
+		\retval false Failed to write the bundle.
+	*/
+	bool Save(const std::string& path) const;
+
+	//! Get entries.
+	const std::vector<std::unique_ptr<Entry>>& Entries() const { return entries; }
+
+private:
+
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<Entry>> entries;
+
+};
+
+/*!
+	Asset bundle.
+	A packed binary file of the assets stored in the layout ready for upload.
+	The file is memory-mapped and the entries are accessed in place,
+	so opening the bundle costs only the page-in of the touched data.
+*/
+class AssetBundle
+{
+public:
+
+	AssetBundle();
+	~AssetBundle();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(AssetBundle);
+
+public:
+
+	/*!
+		Open a bundle file.
+		\param path Path of the bundle.
+		\retval true Succeeded to open the bundle.
+		\retval false Failed to open the bundle.
+	*/
+	bool Open(const std::string& path);
+
+	/*!
+		Open the entries collected by a writer.
+		The writer must be alive while the bundle is used.
+		\param writer Writer.
+	*/
+	void Open(const AssetBundleWriter& writer);
+
+	/*!
+		Find an entry.
+		\param name Name of the entry.
+		\param reader Reader of the entry.
+		\retval true The entry is found.
+		\retval false The entry is not found.
+	*/
+	bool Find(const std::string& name, AssetBundleReader& reader) const;
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_ASSET_BUNDLE_H
@@ -0,0 +1,500 @@
+#include "pch.h"
+#include "blockcompressor.h"
+#include <emmintrin.h>
+
+FW_NAMESPACE_BEGIN
+
+namespace
+{
+
+	// Texels of a 4x4 block with the channels separated, so that 4 texels are processed at once
+	struct BlockTexels
+	{
+		float c[4][16];
+	};
+
+	float HorizontalSum(__m128 v)
+	{
+		v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(v);
+	}
+
+	float HorizontalMin(__m128 v)
+	{
+		v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_min_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(v);
+	}
+
+	float HorizontalMax(__m128 v)
+	{
+		v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(v);
+	}
+
+	// Read a block, repeating the last texels on the right and bottom edges
+	void LoadBlock(const unsigned char* pixels, int width, int height, int channels, int bx, int by, BlockTexels& block)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			int py = std::min(by * 4 + y, height - 1);
+			for (int x = 0; x < 4; x++)
+			{
+				int px = std::min(bx * 4 + x, width - 1);
+				const auto* texel = pixels + (py * width + px) * channels;
+				for (int ch = 0; ch < channels; ch++)
+				{
+					block.c[ch][y * 4 + x] = texel[ch];
+				}
+			}
+		}
+	}
+
+	/*!
+		Fit the endpoints to the extent of the texels along the principal axis.
+		The axis is found by the power iteration on the covariance of the texels.
+	*/
+	void FitEndpoints(const BlockTexels& block, int channels, float e0[4], float e1[4])
+	{
+		// Texels relative to the mean
+		float mean[4] = { 0.0f };
+		__m128 centered[4][4];
+		for (int ch = 0; ch < channels; ch++)
+		{
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < 4; k++)
+			{
+				sum = _mm_add_ps(sum, _mm_loadu_ps(&block.c[ch][k * 4]));
+			}
+
+			mean[ch] = HorizontalSum(sum) / 16.0f;
+			for (int k = 0; k < 4; k++)
+			{
+				centered[ch][k] = _mm_sub_ps(_mm_loadu_ps(&block.c[ch][k * 4]), _mm_set1_ps(mean[ch]));
+			}
+		}
+
+		// Covariance
+		float covariance[4][4];
+		for (int i = 0; i < channels; i++)
+		{
+			for (int j = i; j < channels; j++)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (int k = 0; k < 4; k++)
+				{
+					sum = _mm_add_ps(sum, _mm_mul_ps(centered[i][k], centered[j][k]));
+				}
+
+				covariance[i][j] = covariance[j][i] = HorizontalSum(sum);
+			}
+		}
+
+		// Start from the row of the channel with the largest variance
+		int start = 0;
+		for (int ch = 1; ch < channels; ch++)
+		{
+			if (covariance[ch][ch] > covariance[start][start])
+			{
+				start = ch;
+			}
+		}
+
+		float axis[4] = { 0.0f };
+		for (int ch = 0; ch < channels; ch++)
+		{
+			axis[ch] = covariance[start][ch];
+		}
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = { 0.0f };
+			float scale = 0.0f;
+			for (int i = 0; i < channels; i++)
+			{
+				for (int j = 0; j < channels; j++)
+				{
+					next[i] += covariance[i][j] * axis[j];
+				}
+
+				scale = std::max(scale, std::abs(next[i]));
+			}
+
+			if (scale == 0.0f)
+			{
+				break;
+			}
+
+			for (int ch = 0; ch < channels; ch++)
+			{
+				axis[ch] = next[ch] / scale;
+			}
+		}
+
+		float length = 0.0f;
+		for (int ch = 0; ch < channels; ch++)
+		{
+			length += axis[ch] * axis[ch];
+		}
+
+		// Flat block
+		if (length == 0.0f)
+		{
+			for (int ch = 0; ch < 4; ch++)
+			{
+				e0[ch] = e1[ch] = mean[ch];
+			}
+
+			return;
+		}
+
+		length = std::sqrt(length);
+		for (int ch = 0; ch < channels; ch++)
+		{
+			axis[ch] /= length;
+		}
+
+		// Extent along the axis
+		__m128 minT = _mm_set1_ps(std::numeric_limits<float>::max());
+		__m128 maxT = _mm_set1_ps(-std::numeric_limits<float>::max());
+		for (int k = 0; k < 4; k++)
+		{
+			__m128 t = _mm_setzero_ps();
+			for (int ch = 0; ch < channels; ch++)
+			{
+				t = _mm_add_ps(t, _mm_mul_ps(centered[ch][k], _mm_set1_ps(axis[ch])));
+			}
+
+			minT = _mm_min_ps(minT, t);
+			maxT = _mm_max_ps(maxT, t);
+		}
+
+		float tmin = HorizontalMin(minT);
+		float tmax = HorizontalMax(maxT);
+		for (int ch = 0; ch < 4; ch++)
+		{
+			e0[ch] = glm::clamp(mean[ch] + axis[ch] * tmin, 0.0f, 255.0f);
+			e1[ch] = glm::clamp(mean[ch] + axis[ch] * tmax, 0.0f, 255.0f);
+		}
+	}
+
+	/*!
+		Select the nearest of the evenly spaced points between the endpoints for each texel.
+		The positions go from 0 at e0 to levels - 1 at e1.
+	*/
+	void SelectPositions(const BlockTexels& block, int channels, const float e0[4], const float e1[4], int levels, int positions[16])
+	{
+		float d[4];
+		float dd = 0.0f;
+		for (int ch = 0; ch < channels; ch++)
+		{
+			d[ch] = e1[ch] - e0[ch];
+			dd += d[ch] * d[ch];
+		}
+
+		if (dd == 0.0f)
+		{
+			std::fill(positions, positions + 16, 0);
+			return;
+		}
+
+		const __m128 scale = _mm_set1_ps((float)(levels - 1) / dd);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 last = _mm_set1_ps((float)(levels - 1));
+		for (int k = 0; k < 4; k++)
+		{
+			__m128 t = _mm_setzero_ps();
+			for (int ch = 0; ch < channels; ch++)
+			{
+				__m128 v = _mm_sub_ps(_mm_loadu_ps(&block.c[ch][k * 4]), _mm_set1_ps(e0[ch]));
+				t = _mm_add_ps(t, _mm_mul_ps(v, _mm_set1_ps(d[ch])));
+			}
+
+			// Rounded to the nearest
+			t = _mm_min_ps(_mm_max_ps(_mm_mul_ps(t, scale), zero), last);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&positions[k * 4]), _mm_cvtps_epi32(t));
+		}
+	}
+
+	// Writes bits from the least significant bit of a block
+	class BitWriter
+	{
+	public:
+
+		BitWriter(unsigned char* out, int size)
+			: out(out)
+			, pos(0)
+		{
+			memset(out, 0, size);
+		}
+
+		void Write(unsigned int value, int bits)
+		{
+			for (int i = 0; i < bits; i++, pos++)
+			{
+				out[pos >> 3] |= (unsigned char)(((value >> i) & 1) << (pos & 7));
+			}
+		}
+
+	private:
+
+		unsigned char* out;
+		int pos;
+
+	};
+
+	// --------------------------------------------------------------------------------
+
+	unsigned short ToRGB565(const float c[4])
+	{
+		int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+		int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+		int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+		return (unsigned short)((r << 11) | (g << 5) | b);
+	}
+
+	void FromRGB565(unsigned short v, float c[4])
+	{
+		int r = (v >> 11) & 31;
+		int g = (v >> 5) & 63;
+		int b = v & 31;
+		c[0] = (float)((r << 3) | (r >> 2));
+		c[1] = (float)((g << 2) | (g >> 4));
+		c[2] = (float)((b << 3) | (b >> 2));
+		c[3] = 255.0f;
+	}
+
+	void EncodeBC1(const BlockTexels& block, unsigned char* out)
+	{
+		float e0[4], e1[4];
+		FitEndpoints(block, 3, e0, e1);
+
+		// Inset the endpoints, as the interpolated colors cover the few extreme texels well enough
+		for (int ch = 0; ch < 3; ch++)
+		{
+			float inset = (e1[ch] - e0[ch]) / 16.0f;
+			e0[ch] += inset;
+			e1[ch] -= inset;
+		}
+
+		// color0 > color1 selects the 4 color mode
+		auto color0 = ToRGB565(e1);
+		auto color1 = ToRGB565(e0);
+		if (color0 < color1)
+		{
+			std::swap(color0, color1);
+		}
+
+		unsigned int indices = 0;
+		if (color0 != color1)
+		{
+			// Palette is color0, color1, 2/3 color0 + 1/3 color1, 1/3 color0 + 2/3 color1
+			static const unsigned int PositionToIndex[] = { 0, 2, 3, 1 };
+
+			float q0[4], q1[4];
+			FromRGB565(color0, q0);
+			FromRGB565(color1, q1);
+
+			int positions[16];
+			SelectPositions(block, 3, q0, q1, 4, positions);
+			for (int i = 0; i < 16; i++)
+			{
+				indices |= PositionToIndex[positions[i]] << (i * 2);
+			}
+		}
+
+		BitWriter writer(out, 8);
+		writer.Write(color0, 16);
+		writer.Write(color1, 16);
+		writer.Write(indices, 32);
+	}
+
+	void EncodeBC4(const BlockTexels& block, unsigned char* out)
+	{
+		__m128 minV = _mm_loadu_ps(&block.c[0][0]);
+		__m128 maxV = minV;
+		for (int k = 1; k < 4; k++)
+		{
+			__m128 v = _mm_loadu_ps(&block.c[0][k * 4]);
+			minV = _mm_min_ps(minV, v);
+			maxV = _mm_max_ps(maxV, v);
+		}
+
+		// red0 > red1 selects the 8 value mode
+		int red0 = (int)HorizontalMax(maxV);
+		int red1 = (int)HorizontalMin(minV);
+
+		BitWriter writer(out, 8);
+		writer.Write(red0, 8);
+		writer.Write(red1, 8);
+
+		if (red0 > red1)
+		{
+			// Palette is red0, red1, then 6/7 red0 + 1/7 red1 ... 1/7 red0 + 6/7 red1
+			static const unsigned int PositionToIndex[] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+
+			float e0[4] = { (float)red0 };
+			float e1[4] = { (float)red1 };
+
+			int positions[16];
+			SelectPositions(block, 1, e0, e1, 8, positions);
+			for (int i = 0; i < 16; i++)
+			{
+				writer.Write(PositionToIndex[positions[i]], 3);
+			}
+		}
+	}
+
+	// Quantize an endpoint to 7 bits per channel and a shared p-bit, choosing the p-bit with the smaller error
+	void QuantizeMode6Endpoint(const float e[4], int q[4], int& pbit)
+	{
+		float bestError = std::numeric_limits<float>::max();
+		for (int bit = 0; bit < 2; bit++)
+		{
+			int candidate[4];
+			float error = 0.0f;
+			for (int ch = 0; ch < 4; ch++)
+			{
+				candidate[ch] = glm::clamp((int)((e[ch] - bit) * 0.5f + 0.5f), 0, 127);
+				float diff = (float)(candidate[ch] * 2 + bit) - e[ch];
+				error += diff * diff;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				pbit = bit;
+				std::copy(candidate, candidate + 4, q);
+			}
+		}
+	}
+
+	void EncodeBC7(const BlockTexels& block, unsigned char* out)
+	{
+		float e0[4], e1[4];
+		FitEndpoints(block, 4, e0, e1);
+
+		int q0[4], q1[4], p0, p1;
+		QuantizeMode6Endpoint(e0, q0, p0);
+		QuantizeMode6Endpoint(e1, q1, p1);
+
+		// The weights of the 4-bit indices are close enough to evenly spaced
+		float v0[4], v1[4];
+		for (int ch = 0; ch < 4; ch++)
+		{
+			v0[ch] = (float)(q0[ch] * 2 + p0);
+			v1[ch] = (float)(q1[ch] * 2 + p1);
+		}
+
+		int positions[16];
+		SelectPositions(block, 4, v0, v1, 16, positions);
+
+		// The highest bit of the index of the first texel is implicitly zero
+		if (positions[0] >= 8)
+		{
+			std::swap(q0, q1);
+			std::swap(p0, p1);
+			for (int i = 0; i < 16; i++)
+			{
+				positions[i] = 15 - positions[i];
+			}
+		}
+
+		BitWriter writer(out, 16);
+		writer.Write(1 << 6, 7);
+		for (int ch = 0; ch < 4; ch++)
+		{
+			writer.Write(q0[ch], 7);
+			writer.Write(q1[ch], 7);
+		}
+
+		writer.Write(p0, 1);
+		writer.Write(p1, 1);
+		writer.Write(positions[0], 3);
+		for (int i = 1; i < 16; i++)
+		{
+			writer.Write(positions[i], 4);
+		}
+	}
+
+	int BlockSize(BlockFormat format)
+	{
+		return format == BlockFormat::BC7 ? 16 : 8;
+	}
+
+}
+
+void BlockCompressor::Compress( BlockFormat format, const unsigned char* pixels, int width, int height, std::vector<unsigned char>& blocks, int numThreads )
+{
+	blocks.resize(CompressedSize(format, width, height));
+	if (blocks.empty())
+	{
+		return;
+	}
+
+	int blocksX = (width + 3) / 4;
+	int blocksY = (height + 3) / 4;
+	int blockSize = BlockSize(format);
+	int channels = format == BlockFormat::BC4 ? 1 : 4;
+	auto* output = &blocks[0];
+
+	auto compressRows = [=](int beginRow, int endRow)
+	{
+		BlockTexels block;
+		for (int by = beginRow; by < endRow; by++)
+		{
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				LoadBlock(pixels, width, height, channels, bx, by, block);
+				auto* out = output + (by * blocksX + bx) * blockSize;
+				switch (format)
+				{
+					case BlockFormat::BC1: EncodeBC1(block, out); break;
+					case BlockFormat::BC4: EncodeBC4(block, out); break;
+					case BlockFormat::BC7: EncodeBC7(block, out); break;
+				}
+			}
+		}
+	};
+
+	if (numThreads <= 0)
+	{
+		numThreads = (int)std::thread::hardware_concurrency();
+	}
+
+	numThreads = std::max(1, std::min(numThreads, blocksY));
+
+	// The first range of the rows is compressed in this thread
+	std::vector<std::future<void>> results;
+	for (int i = 1; i < numThreads; i++)
+	{
+		results.push_back(std::async(std::launch::async, compressRows, blocksY * i / numThreads, blocksY * (i + 1) / numThreads));
+	}
+
+	compressRows(0, blocksY / numThreads);
+	for (auto& result : results)
+	{
+		result.get();
+	}
+}
+
+int BlockCompressor::CompressedSize( BlockFormat format, int width, int height )
+{
+	return ((width + 3) / 4) * ((height + 3) / 4) * BlockSize(format);
+}
+
+GLenum BlockCompressor::InternalFormat( BlockFormat format )
+{
+	switch (format)
+	{
+		case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case BlockFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+		case BlockFormat::BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+
+	return GL_NONE;
+}
+
+FW_NAMESPACE_END
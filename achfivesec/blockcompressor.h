@@ -0,0 +1,65 @@
+#pragma once
+#ifndef LIB_FW_BLOCK_COMPRESSOR_H
+#define LIB_FW_BLOCK_COMPRESSOR_H
+
+#include "common.h"
+#include <GL/glew.h>
+#include <vector>
+
+FW_NAMESPACE_BEGIN
+
+//! Block compression formats encoded by BlockCompressor.
+enum class BlockFormat
+{
+	BC1,	//!< RGB, 8 bytes per 4x4 block (GL_COMPRESSED_RGB_S3TC_DXT1_EXT). Alpha is ignored.
+	BC4,	//!< Single channel, 8 bytes per 4x4 block (GL_COMPRESSED_RED_RGTC1).
+	BC7		//!< RGBA, 16 bytes per 4x4 block (GL_COMPRESSED_RGBA_BPTC_UNORM).
+};
+
+/*!
+	CPU encoder of block compressed textures.
+	Intended for static art compressed while the assets are loaded,
+	so the textures take 4-8x less memory and bandwidth than RGBA8 (16x less than RGBA16F).
+	The block rows are split among worker threads, and the texels of a block are processed with SSE2.
+	BC1 and BC4 fit the endpoints along the principal axis of the block.
+	BC7 is encoded with the mode 6 only (one subset, RGBA endpoints with 4-bit indices),
+	which is fast and handles the alpha, but does not use the partitions for blocks with several colors.
+	Does not use OpenGL so it can be called from any thread.
+*/
+class BlockCompressor
+{
+private:
+
+	BlockCompressor() {}
+	FW_DISABLE_COPY_AND_MOVE(BlockCompressor);
+
+public:
+
+	/*!
+		Compress an image.
+		The blocks on the right and bottom edges repeat the last texels if the size is not a multiple of 4.
+		\param format Block format.
+		\param pixels Texels from the top left, 4 bytes (RGBA) per texel for BC1 and BC7, 1 byte for BC4.
+		\param width Width of the image.
+		\param height Height of the image.
+		\param blocks Compressed blocks, resized to CompressedSize.
+		\param numThreads Number of threads. Zero uses the number of hardware threads.
+	*/
+	static void Compress(BlockFormat format, const unsigned char* pixels, int width, int height, std::vector<unsigned char>& blocks, int numThreads = 0);
+
+	/*!
+		Get size in bytes of a compressed image.
+		\param format Block format.
+		\param width Width of the image.
+		\param height Height of the image.
+	*/
+	static int CompressedSize(BlockFormat format, int width, int height);
+
+	//! Get the OpenGL internal format of a block format.
+	static GLenum InternalFormat(BlockFormat format);
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_BLOCK_COMPRESSOR_H
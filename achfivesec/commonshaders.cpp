@@ -0,0 +1,75 @@
+#include "pch.h"
+#include "commonshaders.h"
+#include "gl.h"
+
+const std::string CommonShaders::QuadVs =
+	FW_GL_SHADER_SOURCE(
+	
+		{{GLShaderVersion}}
+		{{GLVertexAttributes}}
+
+		layout (location = POSITION) in vec3 position;
+		out vec2 vTexCoord;
+
+		// Required to use the stage in a program pipeline
+		out gl_PerVertex
+		{
+			vec4 gl_Position;
+		};
+
+		void main()
+		{
+			vTexCoord = (position.xy + 1) * 0.5;
+			gl_Position = vec4(position, 1);
+		}
+
+	);
+
+const std::string CommonShaders::GaussianBlurFs =
+	FW_GL_SHADER_SOURCE(
+		
+		{{GLShaderVersion}}
+
+		in vec2 vTexCoord;
+		out vec4 fragColor;
+
+		{{BlurBlock}}
+
+		uniform int Orientation; // 0 : horizontal, 1 : vertical
+		uniform sampler2D RT;
+
+		float Gaussian(float x, float sigma2)
+		{
+			return (1 / sqrt(3.14159265358979 * sigma2 * 2)) * exp(-((x*x) / (sigma2 * 2)));
+		}
+
+		void main()
+		{
+			vec3 color = vec3(0);
+			float sigma = float(KernelSize) * SigmaFactor;
+			float sigma2 = sigma * sigma;
+			float strength = 1.0 - BlurStrength;
+
+			vec2 offset;
+			if (Orientation == 0)
+			{
+				offset = vec2(TexelSize.x, 0);
+			}
+			else
+			{
+				offset = vec2(0, TexelSize.y);
+			}
+
+			for (int i = -KernelSize; i <= KernelSize; i++)
+			{
+				vec2 vOffset = offset * float(i);
+				color +=
+					texture(RT, vTexCoord + vOffset).rgb *
+					Gaussian(offset * strength, sigma2);
+			}
+
+			fragColor.rgb = color;
+			fragColor.a = texture(RT, vTexCoord).a;
+		}
+
+	);
@@ -0,0 +1,30 @@
+#pragma once
+#ifndef ACHFIVESEC_COMMON_SHADERS_H
+#define ACHFIVESEC_COMMON_SHADERS_H
+
+#include "common.h"
+#include <string>
+
+/*!
+	Shader sources shared by the scenes and the compositor.
+	The sources are templates expanded by ShaderUtil,
+	and the stages are shared through GLShaderRegistry.
+*/
+class CommonShaders
+{
+private:
+
+	CommonShaders();
+	FW_DISABLE_COPY_AND_MOVE(CommonShaders);
+
+public:
+
+	//! Vertex shader of the full screen quad. Outputs vTexCoord.
+	static const std::string QuadVs;
+
+	//! Separable Gaussian blur of RT along Orientation (0 : horizontal, 1 : vertical), reads BlurBlock.
+	static const std::string GaussianBlurFs;
+
+};
+
+#endif // ACHFIVESEC_COMMON_SHADERS_H
@@ -0,0 +1,298 @@
+#include "pch.h"
+#include "compositor.h"
+#include "scene.h"
+#include "logger.h"
+#include "framegraph.h"
+#include "gl.h"
+#include "glstatecache.h"
+#include "glgeometrypool.h"
+#include "glstreambuffer.h"
+#include "gltextureuploader.h"
+#include "shaderutil.h"
+#include "commonshaders.h"
+#include "glshaderregistry.h"
+#include "util.h"
+#include <sync/sync.h>
+
+using namespace fw;
+
+namespace
+{
+
+	const std::string QuadFs =
+		FW_GL_SHADER_SOURCE(
+
+			{{GLShaderVersion}}
+
+			in vec2 vTexCoord;
+			out vec4 fragColor;
+
+			uniform sampler2D RT[{{MaxLayers}}];
+			uniform float Weight[{{MaxLayers}}];
+			uniform int NumLayers;
+			uniform float Alpha;
+
+			void main()
+			{
+				vec3 c = vec3(0);
+				for (int i = 0; i < NumLayers; i++)
+				{
+					c += Weight[i] * texture(RT[i], vTexCoord).rgb;
+				}
+
+				fragColor.rgb = c;
+				fragColor.a = Alpha;
+			}
+
+		);
+
+	// Maximum number of scenes mixed at the same time
+	const int MaxLayers = 8;
+
+	// Size of the per-frame data of the scenes and number of frames in flight
+	const int StreamBufferFrameSize = 4 * 1024 * 1024;
+	const int StreamBufferFramesInFlight = 3;
+
+	// Maximum size of a streamed image (a 1080p RGBA8 frame) and number of uploads in flight
+	const int TextureUploadSlotSize = 8 * 1024 * 1024;
+	const int TextureUploadSlots = 4;
+
+	struct VisibleLayer
+	{
+		int index;
+		float weight;
+	};
+
+}
+
+Compositor::Compositor()
+	: track_Alpha(nullptr)
+	, renderScale(1.0f)
+	, width(0)
+	, height(0)
+{
+
+}
+
+Compositor::~Compositor()
+{
+
+}
+
+bool Compositor::Setup( sf::RenderWindow& window, sync_device* rocket, const std::vector<Scene*>& scenes, fw::GLShaderRegistry& shaders )
+{
+	// Tracks
+	track_Alpha = sync_get_track(rocket, "global.Alpha");
+	for (auto* scene : scenes)
+	{
+		Layer layer;
+		layer.scene = scene;
+		layer.track_Weight = sync_get_track(rocket, ("global.Weight." + scene->Name()).c_str());
+		layers.push_back(layer);
+	}
+
+	// --------------------------------------------------------------------------------
+
+	// Shaders
+	ShaderUtil::ShaderTemplateDict dict;
+	dict["MaxLayers"] = std::to_string((long long)MaxLayers);
+
+	FW_LOG_INFO("Loading compositor quadShader");
+	quadShader = shaders.Pipeline(
+		ShaderUtil::GenerateShaderString(CommonShaders::QuadVs, dict),
+		ShaderUtil::GenerateShaderString(QuadFs, dict));
+	if (!quadShader->WaitLink())
+	{
+		return false;
+	}
+
+	GLUniformHandle<int> quadShader_RT;
+	if (!quadShader->ResolveUniform("RT", quadShader_RT) ||
+		!quadShader->ResolveUniform("NumLayers", quadShader_NumLayers) ||
+		!quadShader->ResolveUniform("Weight", quadShader_Weight) ||
+		!quadShader->ResolveUniform("Alpha", quadShader_Alpha))
+	{
+		return false;
+	}
+
+	// Samplers are bound to the fixed units
+	int units[MaxLayers];
+	for (int i = 0; i < MaxLayers; i++)
+	{
+		units[i] = i;
+	}
+
+	quadShader->Begin();
+	quadShader->SetUniform(quadShader_RT, units, MaxLayers);
+	quadShader->End();
+
+	// --------------------------------------------------------------------------------
+
+	// Quad
+	const glm::vec3 quadPositions[] =
+	{
+		glm::vec3( 1.0f,  1.0f, 0.0f),
+		glm::vec3(-1.0f,  1.0f, 0.0f),
+		glm::vec3(-1.0f, -1.0f, 0.0f),
+		glm::vec3( 1.0f, -1.0f, 0.0f)
+	};
+
+	const GLuint quadIndices[] =
+	{
+		0, 1, 2,
+		2, 3, 0
+	};
+
+	GLVertexLayout layout(sizeof(glm::vec3));
+	layout.Add(GLDefaultVertexAttribute::Position, GLVertexFormat::Float, 0);
+	geometry = std::make_shared<GLGeometryPool>(layout, 4, 6);
+	quadRange = geometry->Add(quadPositions, 4, quadIndices, 6);
+
+	// --------------------------------------------------------------------------------
+
+	// Render targets are allocated on demand
+	renderTargetPool = std::make_shared<GLRenderTargetPool>();
+
+	// Per-frame data of the scenes
+	// The scenes fall back to their own buffers if not available.
+	streamBuffer = std::make_shared<GLStreamBuffer>();
+	if (!streamBuffer->Create(StreamBufferFrameSize, StreamBufferFramesInFlight))
+	{
+		FW_LOG_WARN("Stream buffer is disabled");
+		streamBuffer.reset();
+	}
+
+	// Image sequences streamed by the scenes, allocating the buffer only when used
+	textureUploader = std::make_shared<GLTextureUploader>();
+	if (!textureUploader->Create(TextureUploadSlotSize, TextureUploadSlots))
+	{
+		FW_LOG_WARN("Texture uploader is disabled");
+		textureUploader.reset();
+	}
+
+	return true;
+}
+
+void Compositor::Draw( sf::RenderWindow& window, double milli, fw::GLFrameBuffer& output )
+{
+	// Current row number
+	double row = Util::MilliToRow(milli);
+	float alpha = sync_get_val(track_Alpha, row);
+
+	// Determine the scenes reaching the screen
+	std::vector<VisibleLayer> visibleLayers;
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		float weight = sync_get_val(layers[i].track_Weight, row);
+		if (alpha > 0.0f && weight > 0.0f)
+		{
+			VisibleLayer visibleLayer;
+			visibleLayer.index = (int)i;
+			visibleLayer.weight = weight;
+			visibleLayers.push_back(visibleLayer);
+		}
+	}
+
+	if ((int)visibleLayers.size() > MaxLayers)
+	{
+		// Drop the layers with smallest contribution
+		std::sort(visibleLayers.begin(), visibleLayers.end(), [](const VisibleLayer& a, const VisibleLayer& b)
+		{
+			return a.weight > b.weight;
+		});
+
+		visibleLayers.resize(MaxLayers);
+	}
+
+	// Size of the scenes
+	int scaledWidth = std::max(1, (int)(output.Width() * renderScale + 0.5f));
+	int scaledHeight = std::max(1, (int)(output.Height() * renderScale + 0.5f));
+	if (scaledWidth != width || scaledHeight != height)
+	{
+		// Render targets of the old size are never requested again
+		renderTargetPool->Clear();
+		width = scaledWidth;
+		height = scaledHeight;
+	}
+
+	// Render targets of the scenes are transient resources of the frame graph,
+	// so the targets of a scene are reused by the scenes drawn after it.
+	if (streamBuffer)
+	{
+		streamBuffer->BeginFrame();
+	}
+
+	FrameGraph graph(*renderTargetPool, streamBuffer.get(), textureUploader.get());
+	auto outputResource = graph.ImportFrameBuffer("Output", &output);
+
+	if (visibleLayers.empty())
+	{
+		// Nothing to draw, only clear the output
+		graph.AddPass("Clear").Write(outputResource);
+	}
+	else if (visibleLayers.size() == 1 && visibleLayers[0].weight == 1.0f && alpha >= 1.0f && width == output.Width() && height == output.Height())
+	{
+		// A single fully visible scene is identical to its intermediate render target,
+		// so the scene is rendered directly into the output unless it needs upscaling.
+		layers[visibleLayers[0].index].scene->Draw(window, milli, graph, outputResource);
+	}
+	else
+	{
+		// Draw scenes
+		std::vector<FrameGraphResource> layerResources;
+		for (const auto& visibleLayer : visibleLayers)
+		{
+			auto layerResource = graph.CreateRenderTarget(
+				layers[visibleLayer.index].scene->Name(),
+				width, height, GL_RGBA16F,
+				glm::vec4(glm::vec3(1.0f), 1.0f));
+			layers[visibleLayer.index].scene->Draw(window, milli, graph, layerResource);
+			layerResources.push_back(layerResource);
+		}
+
+		// Draw mixed scene
+		// The layers are upscaled to the output by the bilinear filtering.
+		auto pass = graph.AddPass("Composite");
+		for (auto layerResource : layerResources)
+		{
+			pass.Read(layerResource);
+		}
+
+		pass.Write(outputResource).Execute([=](FrameGraph& graph)
+		{
+			GLStateCache::PushState();
+			GLStateCache::Enable(GL_BLEND);
+			GLStateCache::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			quadShader->Begin();
+			float weights[MaxLayers];
+			for (size_t i = 0; i < visibleLayers.size(); i++)
+			{
+				weights[i] = visibleLayers[i].weight;
+				graph.Texture(layerResources[i])->Bind((int)i);
+			}
+
+			quadShader->SetUniform(quadShader_NumLayers, (int)visibleLayers.size());
+			quadShader->SetUniform(quadShader_Alpha, alpha);
+			quadShader->SetUniform(quadShader_Weight, weights, (int)visibleLayers.size());
+			geometry->Draw(GL_TRIANGLES, quadRange);
+			for (size_t i = layerResources.size(); i > 0; i--)
+			{
+				graph.Texture(layerResources[i-1])->Unbind();
+			}
+			quadShader->End();
+			GLStateCache::PopState();
+		});
+	}
+
+	graph.Execute();
+
+	if (streamBuffer)
+	{
+		streamBuffer->EndFrame();
+	}
+}
+
+int Compositor::NumAllocatedRenderTargets() const
+{
+	return renderTargetPool->NumAllocatedTextures();
+}
@@ -0,0 +1,110 @@
+#pragma once
+#ifndef ACHFIVESEC_COMPOSITOR_H
+#define ACHFIVESEC_COMPOSITOR_H
+
+#include "common.h"
+#include "gl.h"
+#include "glgeometrypool.h"
+#include <memory>
+#include <vector>
+
+namespace sf
+{
+	class RenderWindow;
+}
+
+namespace fw
+{
+	class GLRenderTargetPool;
+	class GLStreamBuffer;
+	class GLTextureUploader;
+	class GLShaderRegistry;
+}
+
+struct sync_device;
+struct sync_track;
+class Scene;
+
+/*!
+	Compositor.
+	Mixes the outputs of any number of scenes into the output framebuffer.
+	Each scene is weighted by the rocket track global.Weight.<scene name>
+	and the mixed result is blended over white by the track global.Alpha.
+	Only the scenes which actually reach the screen are rendered,
+	and a single fully visible scene is rendered directly into the output
+	without going through the intermediate render target.
+	The scenes add their passes to a frame graph built every frame,
+	and all render targets including the intermediate ones of the scenes
+	come from one pool shared by the passes whose lifetimes do not overlap.
+	The scenes can be rendered at a lower resolution than the output,
+	in which case they are upscaled when mixed.
+	The per-frame data of the scenes is sub-allocated from a stream buffer
+	shared through the frame graph, as well as the uploader streaming texel data into the textures.
+*/
+class Compositor
+{
+public:
+
+	Compositor();
+	~Compositor();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(Compositor);
+
+public:
+
+	bool Setup(sf::RenderWindow& window, sync_device* rocket, const std::vector<Scene*>& scenes, fw::GLShaderRegistry& shaders);
+
+	/*!
+		Draw the mixed scenes.
+		The output is cleared to white and the scenes are blended over it.
+		\param window Window.
+		\param milli Current time in milliseconds.
+		\param output Output framebuffer.
+	*/
+	void Draw(sf::RenderWindow& window, double milli, fw::GLFrameBuffer& output);
+
+	/*!
+		Set the render scale.
+		The scenes are rendered at the size of the output multiplied by the scale.
+		\param scale Render scale in (0, 1].
+	*/
+	void SetRenderScale(float scale) { renderScale = scale; }
+
+	/*!
+		Get number of allocated render targets.
+		\return Number of render targets.
+	*/
+	int NumAllocatedRenderTargets() const;
+
+private:
+
+	struct Layer
+	{
+		Scene* scene;
+		const sync_track* track_Weight;
+	};
+
+private:
+
+	const sync_track* track_Alpha;
+
+	std::shared_ptr<fw::GLProgramPipeline> quadShader;
+	fw::GLUniformHandle<int> quadShader_NumLayers;
+	fw::GLUniformHandle<float> quadShader_Weight;
+	fw::GLUniformHandle<float> quadShader_Alpha;
+	std::shared_ptr<fw::GLGeometryPool> geometry;
+	fw::GLGeometryRange quadRange;
+
+	float renderScale;
+	int width;					//!< Width of the render targets of the scenes.
+	int height;					//!< Height of the render targets of the scenes.
+	std::vector<Layer> layers;
+	std::shared_ptr<fw::GLRenderTargetPool> renderTargetPool;
+	std::shared_ptr<fw::GLStreamBuffer> streamBuffer;
+	std::shared_ptr<fw::GLTextureUploader> textureUploader;
+
+};
+
+#endif // ACHFIVESEC_COMPOSITOR_H
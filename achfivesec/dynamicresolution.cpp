@@ -0,0 +1,172 @@
+#include "pch.h"
+#include "dynamicresolution.h"
+#include "logger.h"
+
+namespace
+{
+	// Smoothing factor of the GPU time
+	const double GPUTimeSmoothing = 0.1;
+
+	// Number of samples required after a change before the next change
+	const int MinSamples = 30;
+
+	// The scale is lowered above this fraction of the budget
+	// and raised below the other, the gap avoids oscillation.
+	const double LowerThreshold = 0.9;
+	const double RaiseThreshold = 0.7;
+
+	// Fraction of the budget aimed at when the scale is changed
+	const double TargetUtilization = 0.8;
+
+	// The scale is quantized to limit the number of distinct render target sizes
+	const float ScaleStep = 0.05f;
+
+	// Maximum relative change of the scale at once
+	const float MaxScaleChange = 0.25f;
+}
+
+DynamicResolution::DynamicResolution()
+	: enabled(false)
+	, minScale(1.0f)
+	, maxScale(1.0f)
+	, targetMilli(1000.0 / 60.0)
+	, scale(1.0f)
+	, gpuMilli(0)
+	, numSamples(0)
+	, current(0)
+{
+	for (auto& query : queries)
+	{
+		query.begin = 0;
+		query.end = 0;
+		query.pending = false;
+	}
+}
+
+DynamicResolution::~DynamicResolution()
+{
+	for (auto& query : queries)
+	{
+		if (query.begin != 0)
+		{
+			glDeleteQueries(1, &query.begin);
+			glDeleteQueries(1, &query.end);
+		}
+	}
+}
+
+void DynamicResolution::Setup( float minScale, float maxScale, double targetMilli )
+{
+	this->minScale = std::min(minScale, maxScale);
+	this->maxScale = maxScale;
+	this->targetMilli = targetMilli;
+	scale = maxScale;
+	enabled = false;
+
+	if (this->minScale == maxScale)
+	{
+		return;
+	}
+
+	if (!GLEW_ARB_timer_query)
+	{
+		FW_LOG_WARN("GL_ARB_timer_query is not supported, dynamic resolution is disabled");
+		return;
+	}
+
+	for (auto& query : queries)
+	{
+		if (query.begin == 0)
+		{
+			glGenQueries(1, &query.begin);
+			glGenQueries(1, &query.end);
+		}
+	}
+
+	FW_LOG_INFO(boost::str(boost::format("Dynamic resolution enabled (scale %.2f - %.2f, target %.2f ms)")
+		% this->minScale % maxScale % targetMilli));
+
+	enabled = true;
+}
+
+void DynamicResolution::BeginFrame()
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	// Read the results from the oldest frame
+	for (int i = 1; i <= FrameLatency; i++)
+	{
+		auto& query = queries[(current + i) % FrameLatency];
+		if (!query.pending)
+		{
+			continue;
+		}
+
+		GLint available = 0;
+		glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			break;
+		}
+
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(query.begin, GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+		query.pending = false;
+
+		double milli = (end - begin) / 1000000.0;
+		gpuMilli = numSamples == 0 ? milli : gpuMilli + (milli - gpuMilli) * GPUTimeSmoothing;
+		numSamples++;
+	}
+
+	Adjust();
+
+	// The result of the slot is dropped if it is not available yet
+	auto& query = queries[current];
+	query.pending = false;
+	glQueryCounter(query.begin, GL_TIMESTAMP);
+}
+
+void DynamicResolution::EndFrame()
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	auto& query = queries[current];
+	glQueryCounter(query.end, GL_TIMESTAMP);
+	query.pending = true;
+	current = (current + 1) % FrameLatency;
+}
+
+void DynamicResolution::Adjust()
+{
+	if (numSamples < MinSamples)
+	{
+		return;
+	}
+
+	if (gpuMilli < targetMilli * LowerThreshold && gpuMilli > targetMilli * RaiseThreshold)
+	{
+		return;
+	}
+
+	// GPU time is roughly proportional to the number of pixels
+	float newScale = scale * (float)std::sqrt(targetMilli * TargetUtilization / gpuMilli);
+	newScale = glm::clamp(newScale, scale * (1.0f - MaxScaleChange), scale * (1.0f + MaxScaleChange));
+	newScale = std::floor(newScale / ScaleStep + 0.001f) * ScaleStep;
+	newScale = glm::clamp(newScale, minScale, maxScale);
+
+	if (std::abs(newScale - scale) < ScaleStep * 0.5f)
+	{
+		return;
+	}
+
+	FW_LOG_INFO(boost::str(boost::format("Render scale %.2f -> %.2f (GPU %.2f ms)") % scale % newScale % gpuMilli));
+	scale = newScale;
+	numSamples = 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef ACHFIVESEC_DYNAMIC_RESOLUTION_H
+#define ACHFIVESEC_DYNAMIC_RESOLUTION_H
+
+#include "common.h"
+#include <GL/glew.h>
+
+/*!
+	Dynamic resolution controller.
+	Measures the GPU time of the frames with timestamp queries
+	and adjusts the render scale of the scenes so that the GPU time fits in the frame budget.
+	The results of the queries are read a few frames later without stalling the pipeline.
+	The scale changes in coarse steps and not too often,
+	because the render targets are reallocated on every change.
+*/
+class DynamicResolution
+{
+public:
+
+	DynamicResolution();
+	~DynamicResolution();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(DynamicResolution);
+
+public:
+
+	/*!
+		Setup the controller.
+		Must be called in the thread owning the OpenGL context.
+		The scale is fixed to maxScale if minScale equals to maxScale
+		or the timer queries are not supported.
+		\param minScale Minimum render scale.
+		\param maxScale Maximum render scale, also the initial scale.
+		\param targetMilli Frame budget of the GPU in milliseconds.
+	*/
+	void Setup(float minScale, float maxScale, double targetMilli);
+
+	/*!
+		Begin a frame.
+		Reads the available results of the previous frames and updates the scale.
+	*/
+	void BeginFrame();
+
+	//! End a frame.
+	void EndFrame();
+
+	//! Get the render scale for the current frame.
+	float Scale() const { return scale; }
+
+	//! Get the smoothed GPU time of the frames in milliseconds.
+	double GPUMilli() const { return gpuMilli; }
+
+private:
+
+	void Adjust();
+
+private:
+
+	// Number of frames to wait before reading back the queries
+	static const int FrameLatency = 4;
+
+	struct FrameQuery
+	{
+		GLuint begin;
+		GLuint end;
+		bool pending;
+	};
+
+private:
+
+	bool enabled;
+	float minScale;
+	float maxScale;
+	double targetMilli;
+
+	float scale;
+	double gpuMilli;			//!< Smoothed GPU time.
+	int numSamples;				//!< Number of samples since the last change of the scale.
+
+	FrameQuery queries[FrameLatency];
+	int current;
+
+};
+
+#endif // ACHFIVESEC_DYNAMIC_RESOLUTION_H
@@ -2,6 +2,7 @@
 #include "font.h"
 #include "gl.h"
 #include "logger.h"
+#include "blockcompressor.h"
 #include "edtaa3func.h"
 #include <freetype-gl/freetype-gl.h>
 
@@ -11,6 +12,9 @@ FontText::FontText()
 	: loaded(false)
 	, atlas(nullptr)
 	, font(nullptr)
+	, atlasWidth(0)
+	, atlasHeight(0)
+	, textLength(0)
 {
 
 }
@@ -32,11 +36,16 @@ bool FontText::Load( const std::string& path, const std::wstring& text, const gl
 }
 
 bool FontText::Load( const std::string& path, const FormattedString& str, const glm::vec2& pos, float size, float kerningOffset )
+{
+	return Build(path, str, pos, size, kerningOffset) && Upload();
+}
+
+bool FontText::Build( const std::string& path, const FormattedString& str, const glm::vec2& pos, float size, float kerningOffset )
 {
 	if (loaded) return false;
 
 	// Create texture atlas
-	atlas = texture_atlas_new(512, 512, 1);
+	atlas = texture_atlas_new(AtlasSize, AtlasSize, 1);
 	
 	// Load font
 	font = texture_font_new_from_file(atlas, size, path.c_str());
@@ -48,28 +57,23 @@ bool FontText::Load( const std::string& path, const FormattedString& str, const
 	}
 
 	// Load glyphs
+	// Note that freetype-gl also uploads the atlas to its own texture here, which we do not use.
+	// Without the current context (in a worker thread) the upload is ignored.
 	if (texture_font_load_glyphs(font, str.text.c_str()) > 0)
 	{
 		FW_LOG_ERROR("Failed to load glyphs");
 		return false;
 	}
 
-	// Create atlas texture using distance map
-	auto* distanceMap = MakeDistanceMap(atlas->data, (int)atlas->width, (int)atlas->height);
-	textAtlasDistanceMap = std::make_shared<GLTexture2D>();
-	textAtlasDistanceMap->SetMagFilter(GL_LINEAR);
-	textAtlasDistanceMap->SetMinFilter(GL_LINEAR);
-	textAtlasDistanceMap->SetWrap(GL_CLAMP_TO_EDGE);
-	textAtlasDistanceMap->Allocate((int)atlas->width, (int)atlas->height, GL_RED, GL_RED, GL_UNSIGNED_BYTE, distanceMap);
-	free(distanceMap);
+	// Create distance map of the atlas
+	atlasWidth = (int)atlas->width;
+	atlasHeight = (int)atlas->height;
+	auto* distanceMapData = MakeDistanceMap(atlas->data, atlasWidth, atlasHeight);
+	distanceMap.assign(distanceMapData, distanceMapData + atlasWidth * atlasHeight);
+	free(distanceMapData);
 
 	// Create vertices
-	std::vector<glm::vec3> textPositions;
-	std::vector<glm::vec2> textPositionOffsets;
-	std::vector<glm::vec2> textTexcoords0;
-	std::vector<glm::vec2> textTexcoords1;
-	std::vector<glm::vec3> textColors;
-	std::vector<GLuint> textIndices;
+	textVertices.clear();
 
 	glm::vec2 pen = pos;
 	textLength = (int)str.text.size();
@@ -92,33 +96,81 @@ bool FontText::Load( const std::string& path, const FormattedString& str, const
 			int y1  = static_cast<int>(y0 - glyph->height);
 
 			auto center = glm::vec2(x0 + x1, y0 + y1) * 0.5f;
-			textPositions.push_back(glm::vec3(center, 0.0f));
-			textPositionOffsets.push_back(glm::vec2(glyph->width, glyph->height) * 0.5f);
-			textTexcoords0.push_back(glm::vec2(glyph->s0, glyph->t0));
-			textTexcoords1.push_back(glm::vec2(glyph->s1, glyph->t1));
-			textColors.push_back(str.colors[i]);
+			GlyphVertex vertex;
+			vertex.position = glm::vec3(center, 0.0f);
+			vertex.offset = glm::packHalf2x16(glm::vec2(glyph->width, glyph->height) * 0.5f);
+			vertex.texcoord0 = glm::packUnorm2x16(glm::vec2(glyph->s0, glyph->t0));
+			vertex.texcoord1 = glm::packUnorm2x16(glm::vec2(glyph->s1, glyph->t1));
+			vertex.color = glm::packUnorm4x8(glm::vec4(str.colors[i], 1.0f));
+			textVertices.push_back(vertex);
 
 			pen.x += glyph->advance_x;
 		}
 	}
 
-	textVao = std::make_shared<GLVertexArray>();
-	textPositionVbo = std::make_shared<GLVertexBuffer>();
-	textPositionOffsetVbo = std::make_shared<GLVertexBuffer>();
-	textTexcoord0Vbo = std::make_shared<GLVertexBuffer>();
-	textTexcoord1Vbo = std::make_shared<GLVertexBuffer>();
-	textColorVbo = std::make_shared<GLVertexBuffer>();
-
-	textPositionVbo->AddStatic((int)textPositions.size() * 3, &textPositions[0].x);
-	textPositionOffsetVbo->AddStatic((int)textPositionOffsets.size() * 2, &textPositionOffsets[0].x);
-	textTexcoord0Vbo->AddStatic((int)textTexcoords0.size() * 2, &textTexcoords0[0].x);
-	textTexcoord1Vbo->AddStatic((int)textTexcoords1.size() * 2, &textTexcoords1[0].x);
-	textColorVbo->AddStatic((int)textColors.size() * 3, &textColors[0].x);
-	textVao->Add(GLDefaultVertexAttribute::Position, textPositionVbo.get());
-	textVao->Add(10, 2, textPositionOffsetVbo.get());
-	textVao->Add(GLDefaultVertexAttribute::TexCoord0, textTexcoord0Vbo.get());
-	textVao->Add(GLDefaultVertexAttribute::TexCoord1, textTexcoord1Vbo.get());
-	textVao->Add(GLDefaultVertexAttribute::Color, textColorVbo.get());
+	return true;
+}
+
+bool FontText::Upload()
+{
+	if (loaded || distanceMap.empty()) return false;
+
+	// Go through the same layout as the bundle
+	fw::AssetBundleWriter::Entry entry;
+	Write(entry);
+	fw::AssetBundleReader reader(&entry.data[0], entry.data.size());
+	return Upload(reader);
+}
+
+void FontText::Write( fw::AssetBundleWriter::Entry& entry )
+{
+	entry.Write<int>(atlasWidth);
+	entry.Write<int>(atlasHeight);
+	entry.Write<int>(textLength);
+
+	// The distance map is stored as BC4
+	std::vector<unsigned char> blocks;
+	if (!distanceMap.empty())
+	{
+		BlockCompressor::Compress(BlockFormat::BC4, &distanceMap[0], atlasWidth, atlasHeight, blocks);
+	}
+	entry.WriteArray(blocks.empty() ? nullptr : &blocks[0], blocks.size());
+	entry.WriteArray(textVertices.empty() ? nullptr : &textVertices[0], textVertices.size());
+
+	// Release the built data
+	std::vector<unsigned char>().swap(distanceMap);
+	std::vector<GlyphVertex>().swap(textVertices);
+}
+
+bool FontText::Upload( fw::AssetBundleReader& reader, const std::shared_ptr<FontTextStorage>& storage )
+{
+	if (loaded) return false;
+
+	size_t distanceMapSize, numVertices;
+	int width = reader.Read<int>();
+	int height = reader.Read<int>();
+	textLength = reader.Read<int>();
+	const auto* distanceMapData = reader.ReadArray<unsigned char>(distanceMapSize);
+	const auto* vertices = reader.ReadArray<GlyphVertex>(numVertices);
+	if (reader.Failed() || distanceMapSize == 0 || distanceMapSize != (size_t)BlockCompressor::CompressedSize(BlockFormat::BC4, width, height) || numVertices == 0)
+	{
+		FW_LOG_ERROR("Invalid font data");
+		return false;
+	}
+
+	// Distance map and glyphs go to the shared storage, or to the own one
+	if (storage && (width != storage->atlasWidth || height != storage->atlasHeight))
+	{
+		FW_LOG_ERROR("Size of distance map does not match the font text storage");
+		return false;
+	}
+
+	this->storage = storage ? storage : std::make_shared<FontTextStorage>(width, height, 1, (int)numVertices);
+	if (!this->storage->Add(distanceMapData, (int)distanceMapSize, vertices, (int)numVertices, range))
+	{
+		this->storage = nullptr;
+		return false;
+	}
 
 	loaded = true;
 	return true;
@@ -129,32 +181,29 @@ void FontText::Unload()
 	loaded = false;
 	if (atlas != nullptr) texture_atlas_delete(atlas);
 	if (font != nullptr) texture_font_delete(font);
-	textVao = nullptr;
-	textPositionVbo = nullptr;
-	textTexcoord0Vbo = nullptr;
-	textTexcoord1Vbo = nullptr;
-	textColorVbo = nullptr;
-	textAtlasDistanceMap = nullptr;
+	atlas = nullptr;
+	font = nullptr;
+	distanceMap.clear();
+	storage = nullptr;
 }
 
 void FontText::Draw( int unit /*= 0*/ ) const
 {
 	Bind(unit);
-	textVao->Draw(GL_POINTS, textLength);
-	glActiveTexture(GL_TEXTURE0);
+	storage->Geometry().Draw(GL_POINTS, range);
 	Unbind();
 }
 
 void FontText::Bind( int unit /*= 0*/ ) const
 {
-	textAtlasDistanceMap->Bind(unit);
+	storage->Atlas()->Bind(unit);
 	//glActiveTexture((GLenum)(GL_TEXTURE0 + unit));
 	//glBindTexture(GL_TEXTURE_2D, atlas->id);
 }
 
 void FontText::Unbind() const
 {
-	textAtlasDistanceMap->Unbind();
+	storage->Atlas()->Unbind();
 	//glBindTexture(GL_TEXTURE_2D, 0);
 }
 
@@ -234,4 +283,62 @@ unsigned char* FontText::MakeDistanceMap( unsigned char *img, int width, int hei
 	free(inside);
 
 	return out;
+}
+
+// --------------------------------------------------------------------------------
+
+FontTextStorage::FontTextStorage( int atlasWidth, int atlasHeight, int maxTexts, int glyphCapacity )
+	: atlasWidth(atlasWidth)
+	, atlasHeight(atlasHeight)
+	, maxTexts(maxTexts)
+	, numTexts(0)
+{
+	// All attributes in one interleaved buffer
+	typedef FontText::GlyphVertex GlyphVertex;
+	GLVertexLayout layout(sizeof(GlyphVertex));
+	layout.Add(GLDefaultVertexAttribute::Position, GLVertexFormat::Float, offsetof(GlyphVertex, position));
+	layout.Add(10, 2, GLVertexFormat::HalfFloat, offsetof(GlyphVertex, offset));
+	layout.Add(GLDefaultVertexAttribute::TexCoord0, GLVertexFormat::UNorm16, offsetof(GlyphVertex, texcoord0));
+	layout.Add(GLDefaultVertexAttribute::TexCoord1, GLVertexFormat::UNorm16, offsetof(GlyphVertex, texcoord1));
+	layout.Add(GLDefaultVertexAttribute::Color.index, 4, GLVertexFormat::UNorm8, offsetof(GlyphVertex, color));
+	geometry.reset(new GLGeometryPool(layout, glyphCapacity, 0));
+
+	// BC4 distance maps stacked vertically, whose heights are multiples of the block size
+	atlas.reset(new GLTexture2D);
+	atlas->SetMagFilter(GL_LINEAR);
+	atlas->SetMinFilter(GL_LINEAR);
+	atlas->SetWrap(GL_CLAMP_TO_EDGE);
+	atlas->AllocateCompressed(atlasWidth, atlasHeight * maxTexts, BlockCompressor::InternalFormat(BlockFormat::BC4), 0, nullptr);
+}
+
+FontTextStorage::~FontTextStorage()
+{
+
+}
+
+bool FontTextStorage::Add( const unsigned char* distanceMap, int distanceMapSize, const FontText::GlyphVertex* vertices, int numVertices, fw::GLGeometryRange& range )
+{
+	if (numTexts >= maxTexts)
+	{
+		FW_LOG_ERROR(boost::str(boost::format("Font text storage is full (%d texts)") % maxTexts));
+		return false;
+	}
+
+	int slot = numTexts++;
+	atlas->ReplaceCompressed(glm::ivec4(0, slot * atlasHeight, atlasWidth, atlasHeight), distanceMapSize, distanceMap);
+
+	// Move the texture coordinates into the slot
+	std::vector<FontText::GlyphVertex> remapped(vertices, vertices + numVertices);
+	for (auto& vertex : remapped)
+	{
+		auto t0 = glm::unpackUnorm2x16(vertex.texcoord0);
+		auto t1 = glm::unpackUnorm2x16(vertex.texcoord1);
+		t0.y = (t0.y + slot) / maxTexts;
+		t1.y = (t1.y + slot) / maxTexts;
+		vertex.texcoord0 = glm::packUnorm2x16(t0);
+		vertex.texcoord1 = glm::packUnorm2x16(t1);
+	}
+
+	range = geometry->Add(&remapped[0], numVertices);
+	return true;
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 #define ACHFIVESEC_FONT_H
 
 #include "common.h"
+#include "assetbundle.h"
+#include "glgeometrypool.h"
 #include <string>
 #include <memory>
 #include <vector>
@@ -13,12 +15,11 @@ struct texture_font_t;
 
 namespace fw
 {
-	class GLVertexArray;
-	class GLVertexBuffer;
-	class GLIndexBuffer;
 	class GLTexture2D;
 }
 
+class FontTextStorage;
+
 struct FormattedString
 {
 	std::wstring text;
@@ -36,15 +37,71 @@ private:
 
 	FW_DISABLE_COPY_AND_MOVE(FontText);
 
+public:
+
+	//! Width and height of the distance map of a text.
+	static const int AtlasSize = 512;
+
 public:
 
 	bool Load(const std::string& path, const FormattedString& str, const glm::vec2& pos, float size, float kerningOffset);
 	bool Load(const std::string& path, const std::wstring& text, const glm::vec2& pos, float size, float kerningOffset);
+
+	/*!
+		Rasterize the glyphs and build the distance map and the vertices.
+		Does not use OpenGL so it can be called in a worker thread.
+		Upload must be called afterwards in the thread owning the OpenGL context.
+	*/
+	bool Build(const std::string& path, const FormattedString& str, const glm::vec2& pos, float size, float kerningOffset);
+
+	/*!
+		Create the texture and the vertex buffers from the data built by Build.
+	*/
+	bool Upload();
+
+	/*!
+		Write the data built by Build into a bundle entry.
+		The distance map is compressed to BC4 (a quarter of the size of R8).
+		The built data is released afterwards.
+		\param entry Bundle entry.
+	*/
+	void Write(fw::AssetBundleWriter::Entry& entry);
+
+	/*!
+		Create the texture and the vertex buffers from a bundle entry written by Write.
+		\param reader Reader of the entry.
+		\param storage Storage shared with the other texts. If null, the text creates its own storage.
+	*/
+	bool Upload(fw::AssetBundleReader& reader, const std::shared_ptr<FontTextStorage>& storage = nullptr);
+
 	void Unload();
 	void Bind(int unit = 0) const;
 	void Unbind() const;
 	void Draw(int unit = 0) const;
 
+	//! Get the storage holding the glyphs and the distance map.
+	FontTextStorage* Storage() const { return storage.get(); }
+
+	//! Get the range of the glyphs in the geometry pool of the storage (drawn as points).
+	const fw::GLGeometryRange& Range() const { return range; }
+
+private:
+
+	friend class FontTextStorage;
+
+	/*!
+		Vertex of a glyph, expanded to a quad by the geometry shader.
+		The attributes other than the position are quantized (28 bytes instead of 48).
+	*/
+	struct GlyphVertex
+	{
+		glm::vec3 position;		//!< Center point (in pixels).
+		unsigned int offset;	//!< Offset of the corners relative to the center point (in pixels), half float x 2.
+		unsigned int texcoord0;	//!< UNorm16 x 2.
+		unsigned int texcoord1;	//!< UNorm16 x 2.
+		unsigned int color;		//!< UNorm8 x 4.
+	};
+
 private:
 
 	unsigned char* MakeDistanceMap(unsigned char *img, int width, int height);
@@ -55,16 +112,78 @@ private:
 	texture_atlas_t* atlas;
 	texture_font_t* font;
 
+private:
+
+	// Built data waiting for Upload
+	int atlasWidth;
+	int atlasHeight;
+	std::vector<unsigned char> distanceMap;
+	std::vector<GlyphVertex> textVertices;
+
 private:
 
 	int textLength;
-	std::shared_ptr<fw::GLVertexArray> textVao;
-	std::shared_ptr<fw::GLVertexBuffer> textPositionVbo;		// Center points (in pixels)
-	std::shared_ptr<fw::GLVertexBuffer> textPositionOffsetVbo;	// Offset of positions relative to cente point (in pixels)
-	std::shared_ptr<fw::GLVertexBuffer> textTexcoord0Vbo;
-	std::shared_ptr<fw::GLVertexBuffer> textTexcoord1Vbo;
-	std::shared_ptr<fw::GLVertexBuffer> textColorVbo;
-	std::shared_ptr<fw::GLTexture2D> textAtlasDistanceMap;
+	std::shared_ptr<FontTextStorage> storage;
+	fw::GLGeometryRange range;
+
+};
+
+/*!
+	Storage of the glyphs shared by texts.
+	The glyph vertices of the texts are sub-allocated from one geometry pool
+	and their distance maps are stacked vertically in one texture,
+	so the texts are drawn with the same buffers and texture (e.g. in one fw::GLDrawBatch).
+	The texture coordinates of the glyphs are remapped into the stacked texture when a text is added.
+*/
+class FontTextStorage
+{
+public:
+
+	/*!
+		Create the geometry pool and the texture.
+		\param atlasWidth Width of the distance map of a text.
+		\param atlasHeight Height of the distance map of a text.
+		\param maxTexts Number of distance maps the texture holds.
+		\param glyphCapacity Initial number of glyphs of the geometry pool.
+	*/
+	FontTextStorage(int atlasWidth, int atlasHeight, int maxTexts, int glyphCapacity);
+	~FontTextStorage();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(FontTextStorage);
+
+public:
+
+	//! Get the geometry pool of the glyph vertices.
+	fw::GLGeometryPool& Geometry() { return *geometry; }
+
+	//! Get the texture of the stacked distance maps.
+	fw::GLTexture2D* Atlas() { return atlas.get(); }
+
+private:
+
+	friend class FontText;
+
+	/*!
+		Add the distance map and the glyphs of a text.
+		\param distanceMap BC4 blocks of the distance map of atlasWidth x atlasHeight.
+		\param distanceMapSize Size in bytes of the blocks.
+		\param vertices Glyphs with the texture coordinates relative to the distance map.
+		\param numVertices Number of glyphs.
+		\param range Range of the glyphs in the geometry pool.
+		\retval false The texture is full.
+	*/
+	bool Add(const unsigned char* distanceMap, int distanceMapSize, const FontText::GlyphVertex* vertices, int numVertices, fw::GLGeometryRange& range);
+
+private:
+
+	int atlasWidth;
+	int atlasHeight;
+	int maxTexts;
+	int numTexts;
+	std::unique_ptr<fw::GLGeometryPool> geometry;
+	std::unique_ptr<fw::GLTexture2D> atlas;
 
 };
 
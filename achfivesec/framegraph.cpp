@@ -0,0 +1,506 @@
+#include "pch.h"
+#include "framegraph.h"
+#include "gl.h"
+#include "logger.h"
+#include "profiler.h"
+#include <map>
+
+namespace
+{
+	// Approximate size of a pixel in bytes
+	int BytesPerPixel(GLenum internalFormat)
+	{
+		switch (internalFormat)
+		{
+			case GL_RGBA32F:	return 16;
+			case GL_RGB32F:		return 12;
+			case GL_RGBA16F:	return 8;
+			case GL_RGB16F:		return 6;
+			case GL_RG16F:		return 4;
+			case GL_R32F:		return 4;
+			case GL_R16F:		return 2;
+			case GL_R8:			return 1;
+			case GL_RGB8:		return 3;
+			default:			return 4;
+		}
+	}
+}
+
+FW_NAMESPACE_BEGIN
+
+class GLRenderTargetPool::Impl
+{
+public:
+
+	Impl() : allocatedBytes(0) {}
+
+public:
+
+	long long allocatedBytes;
+	std::vector<std::unique_ptr<GLTexture2D>> textures;
+	std::vector<GLTexture2D*> freeTextures;
+
+	// Framebuffers refer to the depth-stencil buffers,
+	// so they are declared later to be destroyed first.
+	std::map<std::pair<int, int>, std::unique_ptr<GLRenderBuffer>> depthStencilBuffers;
+	std::map<std::vector<GLuint>, std::unique_ptr<GLFrameBuffer>> frameBuffers;
+
+};
+
+GLRenderTargetPool::GLRenderTargetPool()
+	: p(new Impl)
+{
+
+}
+
+GLRenderTargetPool::~GLRenderTargetPool()
+{
+	FW_SAFE_DELETE(p);
+}
+
+GLTexture2D* GLRenderTargetPool::Acquire( int width, int height, GLenum internalFormat )
+{
+	for (auto it = p->freeTextures.begin(); it != p->freeTextures.end(); ++it)
+	{
+		auto* texture = *it;
+		if (texture->Width() == width && texture->Height() == height && texture->InternalFormat() == internalFormat)
+		{
+			p->freeTextures.erase(it);
+			return texture;
+		}
+	}
+
+	auto* texture = new GLTexture2D;
+	texture->SetMagFilter(GL_LINEAR);
+	texture->SetMinFilter(GL_LINEAR);
+	texture->SetWrap(GL_CLAMP_TO_EDGE);
+	texture->Allocate(width, height, internalFormat);
+	p->textures.push_back(std::unique_ptr<GLTexture2D>(texture));
+	p->allocatedBytes += (long long)width * height * BytesPerPixel(internalFormat);
+
+	FW_LOG_INFO(boost::str(boost::format("Allocated render target %dx%d (%d in total, %.1f MB)")
+		% width % height % p->textures.size() % (p->allocatedBytes / (1024.0 * 1024.0))));
+
+	return texture;
+}
+
+void GLRenderTargetPool::Release( GLTexture2D* texture )
+{
+	if (std::find(p->freeTextures.begin(), p->freeTextures.end(), texture) != p->freeTextures.end())
+	{
+		FW_LOG_WARN("Render target is released twice");
+		return;
+	}
+
+	p->freeTextures.push_back(texture);
+}
+
+GLFrameBuffer* GLRenderTargetPool::FrameBuffer( const std::vector<GLTexture2D*>& renderTargets )
+{
+	std::vector<GLuint> key;
+	for (auto* texture : renderTargets)
+	{
+		key.push_back(texture->ID());
+	}
+
+	auto& fbo = p->frameBuffers[key];
+	if (!fbo)
+	{
+		int width = renderTargets[0]->Width();
+		int height = renderTargets[0]->Height();
+
+		// Depth-stencil buffer shared by the framebuffers of the same size
+		auto& depthStencil = p->depthStencilBuffers[std::make_pair(width, height)];
+		if (!depthStencil)
+		{
+			depthStencil.reset(new GLRenderBuffer(width, height, GL_DEPTH_STENCIL));
+			p->allocatedBytes += (long long)width * height * 4;
+		}
+
+		fbo.reset(new GLFrameBuffer(width, height, glm::vec4(), depthStencil.get()));
+		for (auto* texture : renderTargets)
+		{
+			fbo->AddRenderTarget(texture);
+		}
+	}
+
+	return fbo.get();
+}
+
+void GLRenderTargetPool::Clear()
+{
+	if (p->freeTextures.size() != p->textures.size())
+	{
+		FW_LOG_WARN("Render target pool is cleared while render targets are in use");
+		return;
+	}
+
+	if (p->textures.empty())
+	{
+		return;
+	}
+
+	FW_LOG_INFO(boost::str(boost::format("Destroyed %d render targets (%.1f MB)")
+		% p->textures.size() % (p->allocatedBytes / (1024.0 * 1024.0))));
+
+	// Framebuffers first because they refer to the others
+	p->frameBuffers.clear();
+	p->depthStencilBuffers.clear();
+	p->freeTextures.clear();
+	p->textures.clear();
+	p->allocatedBytes = 0;
+}
+
+int GLRenderTargetPool::NumAllocatedTextures()
+{
+	return (int)p->textures.size();
+}
+
+long long GLRenderTargetPool::AllocatedBytes()
+{
+	return p->allocatedBytes;
+}
+
+// --------------------------------------------------------------------------------
+
+struct FrameGraphResourceNode
+{
+	std::string name;
+	int width;
+	int height;
+	GLenum internalFormat;
+	glm::vec4 clearColor;
+	GLFrameBuffer* imported;	//!< Imported framebuffer or nullptr for render targets.
+	GLTexture2D* texture;		//!< Texture acquired from the pool while the resource is alive.
+	int writer;					//!< Index of the pass writing the resource.
+	int lastUse;				//!< Index of the last pass using the resource.
+};
+
+struct FrameGraphPassNode
+{
+	const char* name;
+	const char* group;		//!< Name of the group or nullptr.
+	std::vector<FrameGraphResource> reads;
+	std::vector<FrameGraphResource> writes;
+	FrameGraphPassBuilder::ExecuteFunc func;
+	bool culled;
+	std::vector<FrameGraphResource> releases;	//!< Render targets released after the pass.
+};
+
+class FrameGraph::Impl
+{
+public:
+
+	Impl(GLRenderTargetPool& pool, GLStreamBuffer* streamBuffer, GLTextureUploader* textureUploader)
+		: pool(pool), streamBuffer(streamBuffer), textureUploader(textureUploader), group(nullptr) {}
+
+public:
+
+	bool Compile();
+	void ExecutePass(FrameGraph& graph, FrameGraphPassNode& pass);
+
+public:
+
+	GLRenderTargetPool& pool;
+	GLStreamBuffer* streamBuffer;
+	GLTextureUploader* textureUploader;
+	std::vector<FrameGraphResourceNode> resources;
+	std::vector<FrameGraphPassNode> passes;
+	const char* group;		//!< Group of the passes being added.
+
+};
+
+bool FrameGraph::Impl::Compile()
+{
+	// Validate the declarations
+	for (int i = 0; i < (int)passes.size(); i++)
+	{
+		auto& pass = passes[i];
+		if (pass.writes.empty())
+		{
+			FW_LOG_ERROR(boost::str(boost::format("Pass %s writes nothing") % pass.name));
+			return false;
+		}
+
+		for (auto r : pass.reads)
+		{
+			auto& resource = resources[r];
+			if (resource.imported)
+			{
+				FW_LOG_ERROR(boost::str(boost::format("Pass %s reads imported framebuffer %s") % pass.name % resource.name));
+				return false;
+			}
+			if (resource.writer < 0)
+			{
+				FW_LOG_ERROR(boost::str(boost::format("Pass %s reads %s before written") % pass.name % resource.name));
+				return false;
+			}
+		}
+
+		for (auto w : pass.writes)
+		{
+			auto& resource = resources[w];
+			if (resource.writer >= 0)
+			{
+				FW_LOG_ERROR(boost::str(boost::format("%s is written by both %s and %s") % resource.name % passes[resource.writer].name % pass.name));
+				return false;
+			}
+			if (resource.imported && pass.writes.size() > 1)
+			{
+				FW_LOG_ERROR(boost::str(boost::format("Pass %s writes imported framebuffer %s with other resources") % pass.name % resource.name));
+				return false;
+			}
+			if (resource.width != resources[pass.writes[0]].width || resource.height != resources[pass.writes[0]].height)
+			{
+				FW_LOG_ERROR(boost::str(boost::format("Pass %s writes render targets of different sizes") % pass.name));
+				return false;
+			}
+
+			resource.writer = i;
+		}
+	}
+
+	// Cull the passes not contributing to the imported framebuffers
+	std::vector<bool> required(resources.size(), false);
+	for (int i = (int)passes.size() - 1; i >= 0; i--)
+	{
+		auto& pass = passes[i];
+		pass.culled = true;
+		for (auto w : pass.writes)
+		{
+			if (resources[w].imported || required[w])
+			{
+				pass.culled = false;
+			}
+		}
+
+		if (!pass.culled)
+		{
+			for (auto r : pass.reads)
+			{
+				required[r] = true;
+			}
+		}
+	}
+
+	// Lifetimes of the render targets
+	for (int i = 0; i < (int)passes.size(); i++)
+	{
+		auto& pass = passes[i];
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		for (auto r : pass.reads)
+		{
+			resources[r].lastUse = i;
+		}
+		for (auto w : pass.writes)
+		{
+			resources[w].lastUse = i;
+		}
+	}
+
+	for (int r = 0; r < (int)resources.size(); r++)
+	{
+		auto& resource = resources[r];
+		if (!resource.imported && resource.lastUse >= 0)
+		{
+			passes[resource.lastUse].releases.push_back(r);
+		}
+	}
+
+	return true;
+}
+
+void FrameGraph::Impl::ExecutePass( FrameGraph& graph, FrameGraphPassNode& pass )
+{
+	ProfileScope scope(pass.name, true);
+
+	// Acquire the render targets written in the pass.
+	// The first write is always the first use of a resource.
+	GLFrameBuffer* fbo;
+	auto& firstWrite = resources[pass.writes[0]];
+	if (firstWrite.imported)
+	{
+		fbo = firstWrite.imported;
+	}
+	else
+	{
+		std::vector<GLTexture2D*> renderTargets;
+		for (auto w : pass.writes)
+		{
+			auto& resource = resources[w];
+			resource.texture = pool.Acquire(resource.width, resource.height, resource.internalFormat);
+			renderTargets.push_back(resource.texture);
+		}
+
+		fbo = pool.FrameBuffer(renderTargets);
+		fbo->SetClearColor(firstWrite.clearColor);
+	}
+
+	fbo->Begin();
+	if (pass.func)
+	{
+		pass.func(graph);
+	}
+	fbo->End();
+
+	// Release the render targets no longer used,
+	// which are handed out to the following passes.
+	for (auto r : pass.releases)
+	{
+		pool.Release(resources[r].texture);
+		resources[r].texture = nullptr;
+	}
+}
+
+// --------------------------------------------------------------------------------
+
+FrameGraphPassBuilder& FrameGraphPassBuilder::Read( FrameGraphResource resource )
+{
+	graph.p->passes[pass].reads.push_back(resource);
+	return *this;
+}
+
+FrameGraphPassBuilder& FrameGraphPassBuilder::Write( FrameGraphResource resource )
+{
+	graph.p->passes[pass].writes.push_back(resource);
+	return *this;
+}
+
+void FrameGraphPassBuilder::Execute( const ExecuteFunc& func )
+{
+	graph.p->passes[pass].func = func;
+}
+
+// --------------------------------------------------------------------------------
+
+FrameGraph::FrameGraph( GLRenderTargetPool& pool, GLStreamBuffer* streamBuffer, GLTextureUploader* textureUploader )
+	: p(new Impl(pool, streamBuffer, textureUploader))
+{
+
+}
+
+FrameGraph::~FrameGraph()
+{
+	FW_SAFE_DELETE(p);
+}
+
+FrameGraphResource FrameGraph::CreateRenderTarget( const std::string& name, int width, int height, GLenum internalFormat, const glm::vec4& clearColor )
+{
+	FrameGraphResourceNode resource;
+	resource.name = name;
+	resource.width = width;
+	resource.height = height;
+	resource.internalFormat = internalFormat;
+	resource.clearColor = clearColor;
+	resource.imported = nullptr;
+	resource.texture = nullptr;
+	resource.writer = -1;
+	resource.lastUse = -1;
+	p->resources.push_back(resource);
+	return (FrameGraphResource)p->resources.size() - 1;
+}
+
+FrameGraphResource FrameGraph::ImportFrameBuffer( const std::string& name, GLFrameBuffer* fbo )
+{
+	FrameGraphResourceNode resource;
+	resource.name = name;
+	resource.width = fbo->Width();
+	resource.height = fbo->Height();
+	resource.internalFormat = GL_NONE;
+	resource.imported = fbo;
+	resource.texture = nullptr;
+	resource.writer = -1;
+	resource.lastUse = -1;
+	p->resources.push_back(resource);
+	return (FrameGraphResource)p->resources.size() - 1;
+}
+
+FrameGraphPassBuilder FrameGraph::AddPass( const char* name )
+{
+	FrameGraphPassNode pass;
+	pass.name = name;
+	pass.group = p->group;
+	pass.culled = false;
+	p->passes.push_back(pass);
+	return FrameGraphPassBuilder(*this, (int)p->passes.size() - 1);
+}
+
+void FrameGraph::BeginGroup( const char* name )
+{
+	if (p->group)
+	{
+		FW_LOG_WARN(boost::str(boost::format("Group %s is begun inside group %s") % name % p->group));
+	}
+
+	p->group = name;
+}
+
+void FrameGraph::EndGroup()
+{
+	p->group = nullptr;
+}
+
+bool FrameGraph::Execute()
+{
+	if (!p->Compile())
+	{
+		return false;
+	}
+
+	// The consecutive passes of a group share its profile scope.
+	// The scope is closed before the next one is opened so that they do not nest.
+	std::unique_ptr<ProfileScope> groupScope;
+	const char* group = nullptr;
+	for (auto& pass : p->passes)
+	{
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		if (pass.group != group)
+		{
+			groupScope.reset();
+			if (pass.group)
+			{
+				groupScope.reset(new ProfileScope(pass.group, true));
+			}
+			group = pass.group;
+		}
+
+		p->ExecutePass(*this, pass);
+	}
+
+	return true;
+}
+
+GLTexture2D* FrameGraph::Texture( FrameGraphResource resource )
+{
+	return p->resources[resource].texture;
+}
+
+int FrameGraph::Width( FrameGraphResource resource )
+{
+	return p->resources[resource].width;
+}
+
+int FrameGraph::Height( FrameGraphResource resource )
+{
+	return p->resources[resource].height;
+}
+
+GLStreamBuffer* FrameGraph::StreamBuffer()
+{
+	return p->streamBuffer;
+}
+
+GLTextureUploader* FrameGraph::TextureUploader()
+{
+	return p->textureUploader;
+}
+
+FW_NAMESPACE_END
@@ -0,0 +1,256 @@
+#pragma once
+#ifndef LIB_FW_FRAME_GRAPH_H
+#define LIB_FW_FRAME_GRAPH_H
+
+#include "common.h"
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+FW_NAMESPACE_BEGIN
+
+class GLTexture2D;
+class GLFrameBuffer;
+class GLStreamBuffer;
+class GLTextureUploader;
+
+/*!
+	Render target pool.
+	Owns the textures used as transient render targets.
+	A released texture is handed out again to the next request
+	with the same size and format, so the textures are aliased
+	between the passes whose lifetimes do not overlap.
+	Framebuffers are cached per set of attached textures and
+	the framebuffers of the same size share one depth-stencil buffer.
+*/
+class GLRenderTargetPool
+{
+public:
+
+	GLRenderTargetPool();
+	~GLRenderTargetPool();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(GLRenderTargetPool);
+
+public:
+
+	/*!
+		Acquire a render target.
+		A new texture is allocated only if no free texture matches.
+		\param width Width of the texture.
+		\param height Height of the texture.
+		\param internalFormat Internal format of the texture.
+		\return Texture.
+	*/
+	GLTexture2D* Acquire(int width, int height, GLenum internalFormat);
+
+	/*!
+		Release a render target.
+		The texture is returned to the pool and can be reused by the next Acquire.
+		\param texture Texture acquired from the pool.
+	*/
+	void Release(GLTexture2D* texture);
+
+	/*!
+		Get a framebuffer with the given render targets attached.
+		All textures must have the same size.
+		\param renderTargets Textures acquired from the pool.
+		\return Framebuffer.
+	*/
+	GLFrameBuffer* FrameBuffer(const std::vector<GLTexture2D*>& renderTargets);
+
+	/*!
+		Destroy all textures, framebuffers and depth-stencil buffers.
+		Used when the sizes of the render targets change and the old ones are no longer requested.
+		Must be called while no texture is acquired.
+	*/
+	void Clear();
+
+	/*!
+		Get number of allocated textures.
+		\return Number of textures.
+	*/
+	int NumAllocatedTextures();
+
+	/*!
+		Get total size of allocated textures and depth-stencil buffers.
+		\return Size in bytes.
+	*/
+	long long AllocatedBytes();
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+//! Handle of a resource in the frame graph.
+typedef int FrameGraphResource;
+
+class FrameGraph;
+
+/*!
+	Frame graph pass builder.
+	Returned by FrameGraph::AddPass to declare the resources used by the pass.
+*/
+class FrameGraphPassBuilder
+{
+public:
+
+	typedef std::function<void (FrameGraph& graph)> ExecuteFunc;
+
+public:
+
+	FrameGraphPassBuilder(FrameGraph& graph, int pass)
+		: graph(graph)
+		, pass(pass)
+	{
+
+	}
+
+public:
+
+	//! Declare a resource read in the pass.
+	FrameGraphPassBuilder& Read(FrameGraphResource resource);
+
+	/*!
+		Declare a resource written in the pass.
+		Either one imported framebuffer or render targets of the same size can be written.
+	*/
+	FrameGraphPassBuilder& Write(FrameGraphResource resource);
+
+	/*!
+		Set the function executing the pass.
+		Framebuffer of the written resources is bound and cleared before the function is called.
+		The function is called after the passes added before,
+		so the values used in the function must be captured by value.
+	*/
+	void Execute(const ExecuteFunc& func);
+
+private:
+
+	FrameGraph& graph;
+	int pass;
+
+};
+
+/*!
+	Frame graph.
+	Passes declare the resources they read and write, and the graph executes them in the order of addition.
+	Transient render targets are acquired from the pool just before the first pass using them
+	and released right after the last pass using them, so the memory is shared
+	by the passes (and scenes) which are not alive at the same time.
+	Passes which do not contribute to any imported framebuffer are culled.
+	The graph is intended to be built and executed every frame.
+*/
+class FrameGraph
+{
+public:
+
+	/*!
+		Constructor.
+		\param pool Pool of the transient render targets.
+		\param streamBuffer Stream buffer from which the passes allocate per-frame data. Can be null.
+		\param textureUploader Uploader through which the passes stream texel data into textures. Can be null.
+	*/
+	FrameGraph(GLRenderTargetPool& pool, GLStreamBuffer* streamBuffer = nullptr, GLTextureUploader* textureUploader = nullptr);
+	~FrameGraph();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(FrameGraph);
+
+public:
+
+	/*!
+		Create a transient render target.
+		\param name Name of the resource used for error messages.
+		\param width Width of the render target.
+		\param height Height of the render target.
+		\param internalFormat Internal format of the render target.
+		\param clearColor Color with which the render target is cleared before written.
+		\return Handle of the resource.
+	*/
+	FrameGraphResource CreateRenderTarget(const std::string& name, int width, int height, GLenum internalFormat, const glm::vec4& clearColor);
+
+	/*!
+		Import an external framebuffer.
+		A pass writing to the framebuffer is never culled.
+		The framebuffer cannot be read in the graph.
+		\param name Name of the resource used for error messages.
+		\param fbo Framebuffer. Must be alive until the graph is executed.
+		\return Handle of the resource.
+	*/
+	FrameGraphResource ImportFrameBuffer(const std::string& name, GLFrameBuffer* fbo);
+
+	/*!
+		Add a pass.
+		\param name Name of the pass. Must be a string literal because it is used as a profile scope name.
+		\return Builder to declare the resources and the function of the pass.
+	*/
+	FrameGraphPassBuilder AddPass(const char* name);
+
+	/*!
+		Begin a group of passes (e.g. the passes of a scene).
+		The passes added until EndGroup are executed in a GPU profile scope of the group,
+		which includes the scopes of the passes.
+		Groups cannot be nested.
+		\param name Name of the group. Must be a string literal because it is used as a profile scope name.
+	*/
+	void BeginGroup(const char* name);
+
+	//! End the group of passes.
+	void EndGroup();
+
+	/*!
+		Execute the passes.
+		\retval true Succeeded to execute the passes.
+		\retval false The graph is invalid. No pass is executed.
+	*/
+	bool Execute();
+
+	/*!
+		Get the texture of a render target.
+		Valid only inside the passes reading or writing the resource.
+		\param resource Handle of the render target.
+		\return Texture.
+	*/
+	GLTexture2D* Texture(FrameGraphResource resource);
+
+	//! Get width of a resource.
+	int Width(FrameGraphResource resource);
+
+	//! Get height of a resource.
+	int Height(FrameGraphResource resource);
+
+	/*!
+		Get the stream buffer.
+		The regions allocated in the passes are valid until the end of the frame.
+		\return Stream buffer, or null if not available.
+	*/
+	GLStreamBuffer* StreamBuffer();
+
+	/*!
+		Get the texture uploader.
+		The textures written by an upload can be sampled by the passes issued after it.
+		\return Texture uploader, or null if not available.
+	*/
+	GLTextureUploader* TextureUploader();
+
+private:
+
+	friend class FrameGraphPassBuilder;
+
+	class Impl;
+	Impl* p;
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_FRAME_GRAPH_H
@@ -1,9 +1,37 @@
 ﻿#include "pch.h"
 #include "gl.h"
 #include "logger.h"
+#include "glstatecache.h"
+#include "glstreambuffer.h"
+#ifdef FW_PLATFORM_WINDOWS
+#include <Windows.h>
+#endif
 
 FW_NAMESPACE_BEGIN
 
+// True if the resources are modified with GL_EXT_direct_state_access
+static bool directStateAccess = false;
+
+// True if GL_ARB_parallel_shader_compile or GL_KHR_parallel_shader_compile is supported
+// GLEW 1.10 does not know the extensions, thus the definitions are given here.
+static bool parallelShaderCompile = false;
+#define GL_MAX_SHADER_COMPILER_THREADS_ARB 0x91B0
+#define GL_COMPLETION_STATUS_ARB 0x91B1
+typedef void (GLAPIENTRY * PFNGLMAXSHADERCOMPILERTHREADSPROC) (GLuint count);
+
+// Directory of the program binary cache, empty if disabled
+static std::string programCacheDirectory;
+
+// Header of the files in the program binary cache
+struct ProgramBinaryHeader
+{
+	char magic[8];
+	GLenum format;
+	GLint length;
+};
+
+static const char ProgramBinaryMagic[8] = { 'A', 'C', 'H', 'P', 'R', 'O', 'G', '\0' };
+
 static void _stdcall DebugOutput( GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, GLvoid* userParam )
 {
 	std::string sourceString;
@@ -150,6 +178,36 @@ bool GLUtils::InitializeGlew(bool experimental)
 	glGetError();
 	FW_GL_CHECK_ERRORS();
 
+	directStateAccess = GLEW_EXT_direct_state_access != GL_FALSE;
+	if (!directStateAccess)
+	{
+		FW_LOG_WARN("GL_EXT_direct_state_access is not supported, resources are modified by binding");
+	}
+
+	// Let the driver compile the shaders in its own threads
+	const char* parallelExtensions[][2] =
+	{
+		{ "GL_ARB_parallel_shader_compile", "glMaxShaderCompilerThreadsARB" },
+		{ "GL_KHR_parallel_shader_compile", "glMaxShaderCompilerThreadsKHR" }
+	};
+
+	for (auto& ext : parallelExtensions)
+	{
+		if (CheckExtension(ext[0]))
+		{
+			parallelShaderCompile = true;
+#ifdef FW_PLATFORM_WINDOWS
+			auto maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSPROC)wglGetProcAddress(ext[1]);
+			if (maxShaderCompilerThreads)
+			{
+				// Number of threads is chosen by the driver
+				maxShaderCompilerThreads(0xFFFFFFFF);
+			}
+#endif
+			break;
+		}
+	}
+
 	return true;
 }
 
@@ -200,6 +258,39 @@ bool GLUtils::CheckExtension( const std::string& name )
 	return false;
 }
 
+bool GLUtils::EnableProgramCache( const std::string& directory )
+{
+	programCacheDirectory.clear();
+
+	GLint numFormats = 0;
+	if (GLEW_ARB_get_program_binary)
+	{
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	}
+
+	if (numFormats == 0)
+	{
+		FW_LOG_WARN("Program binaries are not supported, the program cache is disabled");
+		return false;
+	}
+
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(directory, ec);
+	if (ec)
+	{
+		FW_LOG_ERROR("Failed to create directory " + directory);
+		return false;
+	}
+
+	programCacheDirectory = directory;
+	return true;
+}
+
+bool GLUtils::DirectStateAccess()
+{
+	return directStateAccess;
+}
+
 void GLUtils::CheckGLErrors( const char* filename, const int line )
 {
 	int err;
@@ -242,6 +333,7 @@ const GLVertexAttribute GLDefaultVertexAttribute::TexCoord3(5, 2);
 const GLVertexAttribute GLDefaultVertexAttribute::TexCoord4(6, 2);
 const GLVertexAttribute GLDefaultVertexAttribute::Tangent(7, 2);
 const GLVertexAttribute GLDefaultVertexAttribute::Color(8, 3);
+const GLVertexAttribute GLDefaultVertexAttribute::DrawID(9, 1);
 
 // ----------------------------------------------------------------------
 
@@ -269,67 +361,145 @@ GLBufferObject::GLBufferObject()
 
 GLBufferObject::~GLBufferObject()
 {
+	GLStateCache::BufferDeleted(id);
 	glDeleteBuffers(1, &id);
 }
 
 void GLBufferObject::Bind()
 {
+	if (target == GL_ELEMENT_ARRAY_BUFFER)
+	{
+		// The element buffer binding is the state of the vertex array
+		GLStateCache::BindVertexArray(0);
+		GLStateCache::BindElementBuffer(ID());
+		return;
+	}
+
 	glBindBuffer(target, ID());
 }
 
 void GLBufferObject::Unbind()
 {
+	if (target == GL_ELEMENT_ARRAY_BUFFER)
+	{
+		GLStateCache::BindVertexArray(0);
+		GLStateCache::BindElementBuffer(0);
+		return;
+	}
+
 	glBindBuffer(target, 0);
 }
 
 void GLBufferObject::Allocate( int size, const void* data, GLenum usage )
 {
-	Bind();
-	glBufferData(target, size, data, usage);
-	Unbind();
+	if (directStateAccess)
+	{
+		glNamedBufferDataEXT(id, size, data, usage);
+	}
+	else
+	{
+		BindForEdit();
+		glBufferData(EditTarget(), size, data, usage);
+		UnbindForEdit();
+	}
+
 	this->size = size;
 }
 
 void GLBufferObject::Replace( int offset, int size, const void* data )
 {
-	Bind();
-	glBufferSubData(target, offset, size, data);
-	Unbind();
+	if (directStateAccess)
+	{
+		glNamedBufferSubDataEXT(id, offset, size, data);
+		return;
+	}
+
+	BindForEdit();
+	glBufferSubData(EditTarget(), offset, size, data);
+	UnbindForEdit();
 }
 
 void GLBufferObject::Clear( GLenum internalformat, GLenum format, GLenum type, const void* data )
 {
-	Bind();
-	glClearBufferData(target, internalformat, format, type, data);
-	Unbind();
+	if (directStateAccess)
+	{
+		glClearNamedBufferDataEXT(id, internalformat, format, type, data);
+		return;
+	}
+
+	BindForEdit();
+	glClearBufferData(EditTarget(), internalformat, format, type, data);
+	UnbindForEdit();
 }
 
 void GLBufferObject::Clear( GLenum internalformat, int offset, int size, GLenum format, GLenum type, const void* data )
 {
-	Bind();
-	glClearBufferSubData(target, internalformat, offset, size, format, type, data);
-	Unbind();
+	if (directStateAccess)
+	{
+		glClearNamedBufferSubDataEXT(id, internalformat, offset, size, format, type, data);
+		return;
+	}
+
+	BindForEdit();
+	glClearBufferSubData(EditTarget(), internalformat, offset, size, format, type, data);
+	UnbindForEdit();
 }
 
 void GLBufferObject::Copy( GLBufferObject& writetarget, int readoffset, int writeoffset, int size )
 {
-	Bind();
-	writetarget.Bind();
-	glCopyBufferSubData(target, writetarget.target, readoffset, writeoffset, size);
-	writetarget.Unbind();
-	Unbind();
+	if (directStateAccess)
+	{
+		glNamedCopyBufferSubDataEXT(id, writetarget.id, readoffset, writeoffset, size);
+		return;
+	}
+
+	// Bound to the copy targets because both buffers can have the same target
+	glBindBuffer(GL_COPY_READ_BUFFER, id);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, writetarget.id);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, readoffset, writeoffset, size);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
 }
 
 void GLBufferObject::Map( int offset, int length, unsigned int access, void** data )
 {
-	Bind();
-	*data = glMapBufferRange(target, offset, length, access);
+	if (directStateAccess)
+	{
+		*data = glMapNamedBufferRangeEXT(id, offset, length, access);
+		return;
+	}
+
+	BindForEdit();
+	*data = glMapBufferRange(EditTarget(), offset, length, access);
 }
 
 void GLBufferObject::Unmap()
 {
-	glUnmapBuffer(target);
-	Unbind();
+	if (directStateAccess)
+	{
+		glUnmapNamedBufferEXT(id);
+		return;
+	}
+
+	glUnmapBuffer(EditTarget());
+	UnbindForEdit();
+}
+
+GLenum GLBufferObject::EditTarget() const
+{
+	// The element buffer binding is the state of the vertex array,
+	// so the index data is staged through the copy target leaving the vertex array as it is
+	return target == GL_ELEMENT_ARRAY_BUFFER ? GL_COPY_WRITE_BUFFER : target;
+}
+
+void GLBufferObject::BindForEdit()
+{
+	glBindBuffer(EditTarget(), id);
+}
+
+void GLBufferObject::UnbindForEdit()
+{
+	glBindBuffer(EditTarget(), 0);
 }
 
 // ----------------------------------------------------------------------
@@ -372,9 +542,97 @@ void GLIndexBuffer::AddStatic( int n, const GLuint* idx )
 
 void GLIndexBuffer::Draw( GLenum mode )
 {
-	Bind();
+	// Draws with the current vertex array
+	GLStateCache::BindElementBuffer(ID());
 	glDrawElements(mode, size / sizeof(GLuint), GL_UNSIGNED_INT, NULL);
-	Unbind();
+}
+
+void GLIndexBuffer::DrawInstanced( GLenum mode, int instanceCount )
+{
+	// Draws with the current vertex array
+	GLStateCache::BindElementBuffer(ID());
+	glDrawElementsInstanced(mode, size / sizeof(GLuint), GL_UNSIGNED_INT, NULL, instanceCount);
+}
+
+// ----------------------------------------------------------------------
+
+GLUniformBuffer::GLUniformBuffer()
+	: blockBuffer(0)
+	, blockOffset(0)
+	, blockSize(0)
+{
+	target = GL_UNIFORM_BUFFER;
+	size = 0;
+}
+
+void GLUniformBuffer::Update( const void* data, int size, GLStreamBuffer* streamBuffer )
+{
+	GLStreamAllocation allocation;
+	if (streamBuffer && streamBuffer->Allocate(size, streamBuffer->UniformBufferAlignment(), allocation))
+	{
+		memcpy(allocation.data, data, size);
+		blockBuffer = allocation.buffer;
+		blockOffset = allocation.offset;
+		blockSize = size;
+		return;
+	}
+
+	if (this->size != size)
+	{
+		Allocate(size, data, GL_DYNAMIC_DRAW);
+	}
+	else
+	{
+		Replace(0, size, data);
+	}
+
+	blockBuffer = id;
+	blockOffset = 0;
+	blockSize = size;
+}
+
+void GLUniformBuffer::BindBlock( int binding )
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, blockBuffer, blockOffset, blockSize);
+}
+
+// ----------------------------------------------------------------------
+
+GLVertexLayout::GLVertexLayout( int stride )
+	: stride(stride)
+{
+
+}
+
+void GLVertexLayout::Add( const GLVertexAttribute& attr, GLVertexFormat format, int offset )
+{
+	Add(attr.index, attr.size, format, offset);
+}
+
+void GLVertexLayout::Add( int index, int size, GLVertexFormat format, int offset )
+{
+	if ((format == GLVertexFormat::UNorm2_10_10_10 || format == GLVertexFormat::SNorm2_10_10_10) && size != 4)
+	{
+		FW_LOG_ERROR(boost::str(boost::format("Packed vertex format requires 4 components (attribute %d)") % index));
+		return;
+	}
+
+	Element element;
+	element.index = index;
+	element.size = size;
+	element.format = format;
+	element.offset = offset;
+	elements.push_back(element);
+}
+
+GLuint GLVertexLayout::PackSNorm2_10_10_10( const glm::vec4& v )
+{
+	auto c = glm::clamp(v, -1.0f, 1.0f);
+	auto x = (GLuint)(int)glm::round(c.x * 511.0f) & 0x3ff;
+	auto y = (GLuint)(int)glm::round(c.y * 511.0f) & 0x3ff;
+	auto z = (GLuint)(int)glm::round(c.z * 511.0f) & 0x3ff;
+	auto w = (GLuint)(int)glm::round(c.w) & 0x3;
+	return x | (y << 10) | (z << 20) | (w << 30);
 }
 
 // ----------------------------------------------------------------------
@@ -382,35 +640,48 @@ void GLIndexBuffer::Draw( GLenum mode )
 GLVertexArray::GLVertexArray()
 {
 	glGenVertexArrays(1, &id);
+
+	if (directStateAccess)
+	{
+		// The name becomes an object when it is bound first,
+		// and the direct state access functions require the object.
+		GLint current;
+		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &current);
+		glBindVertexArray(id);
+		glBindVertexArray(current);
+	}
 }
 
 GLVertexArray::~GLVertexArray()
 {
+	GLStateCache::VertexArrayDeleted(id);
 	glDeleteVertexArrays(1, &id);
 }
 
 void GLVertexArray::Bind()
 {
-	glBindVertexArray(ID());
+	GLStateCache::BindVertexArray(ID());
 }
 
 void GLVertexArray::Unbind()
 {
-	glBindVertexArray(0);
+	GLStateCache::BindVertexArray(0);
 }
 
 void GLVertexArray::Add( const GLVertexAttribute& attr, GLVertexBuffer* vb )
 {
-	Bind();
-	vb->Bind();
-	glVertexAttribPointer(attr.index, attr.size, GL_FLOAT, GL_FALSE, 0, NULL);
-	glEnableVertexAttribArray(attr.index);
-	vb->Unbind();
-	Unbind();
+	Add(attr.index, attr.size, vb);
 }
 
 void GLVertexArray::Add( int index, int size, GLVertexBuffer* vb )
 {
+	if (directStateAccess)
+	{
+		glVertexArrayVertexAttribOffsetEXT(id, vb->ID(), index, size, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexArrayAttribEXT(id, index);
+		return;
+	}
+
 	Bind();
 	vb->Bind();
 	glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, 0, NULL);
@@ -419,25 +690,131 @@ void GLVertexArray::Add( int index, int size, GLVertexBuffer* vb )
 	Unbind();
 }
 
+void GLVertexArray::SetDivisor( const GLVertexAttribute& attr, int divisor )
+{
+	SetDivisor(attr.index, divisor);
+}
+
+void GLVertexArray::SetDivisor( int index, int divisor )
+{
+	Bind();
+	glVertexAttribDivisor(index, divisor);
+	Unbind();
+}
+
+void GLVertexArray::Add( const GLVertexLayout& layout, GLVertexBuffer* vb, int binding, int divisor )
+{
+	// GLEW 1.10 has no direct state access variants of ARB_vertex_attrib_binding.
+	// Without the extension (GL 4.2) each attribute is specified with the buffer bound
+	// and the binding point is not used.
+	bool attribBinding = GLEW_ARB_vertex_attrib_binding != GL_FALSE;
+	Bind();
+	if (attribBinding)
+	{
+		glBindVertexBuffer(binding, vb->ID(), 0, layout.Stride());
+		glVertexBindingDivisor(binding, divisor);
+	}
+	else
+	{
+		vb->Bind();
+	}
+
+	for (const auto& element : layout.Elements())
+	{
+		GLenum type = GL_FLOAT;
+		GLboolean normalized = GL_TRUE;
+		switch (element.format)
+		{
+			case GLVertexFormat::Float:				type = GL_FLOAT; normalized = GL_FALSE; break;
+			case GLVertexFormat::HalfFloat:			type = GL_HALF_FLOAT; normalized = GL_FALSE; break;
+			case GLVertexFormat::UNorm8:			type = GL_UNSIGNED_BYTE; break;
+			case GLVertexFormat::SNorm8:			type = GL_BYTE; break;
+			case GLVertexFormat::UNorm16:			type = GL_UNSIGNED_SHORT; break;
+			case GLVertexFormat::SNorm16:			type = GL_SHORT; break;
+			case GLVertexFormat::UNorm2_10_10_10:	type = GL_UNSIGNED_INT_2_10_10_10_REV; break;
+			case GLVertexFormat::SNorm2_10_10_10:	type = GL_INT_2_10_10_10_REV; break;
+			case GLVertexFormat::UInt:				type = GL_UNSIGNED_INT; break;
+		}
+
+		if (attribBinding)
+		{
+			if (element.format == GLVertexFormat::UInt)
+			{
+				glVertexAttribIFormat(element.index, element.size, GL_UNSIGNED_INT, element.offset);
+			}
+			else
+			{
+				glVertexAttribFormat(element.index, element.size, type, normalized, element.offset);
+			}
+
+			glVertexAttribBinding(element.index, binding);
+		}
+		else
+		{
+			const GLvoid* pointer = (const GLvoid*)(size_t)element.offset;
+			if (element.format == GLVertexFormat::UInt)
+			{
+				glVertexAttribIPointer(element.index, element.size, GL_UNSIGNED_INT, layout.Stride(), pointer);
+			}
+			else
+			{
+				glVertexAttribPointer(element.index, element.size, type, normalized, layout.Stride(), pointer);
+			}
+
+			glVertexAttribDivisor(element.index, divisor);
+		}
+
+		glEnableVertexAttribArray(element.index);
+	}
+
+	if (!attribBinding)
+	{
+		vb->Unbind();
+	}
+
+	Unbind();
+}
+
+void GLVertexArray::SetIndexBuffer( GLIndexBuffer* ib )
+{
+	Bind();
+	GLStateCache::BindElementBuffer(ib->ID());
+	Unbind();
+}
+
 void GLVertexArray::Draw( GLenum mode, GLIndexBuffer* ib )
 {
 	Bind();
 	ib->Draw(mode);
-	Unbind();
 }
 
 void GLVertexArray::Draw( GLenum mode, int count )
 {
 	Bind();
 	glDrawArrays(mode, 0, count);
-	Unbind();
 }
 
 void GLVertexArray::Draw( GLenum mode, int first, int count )
 {
 	Bind();
 	glDrawArrays(mode, first, count);
-	Unbind();
+}
+
+void GLVertexArray::DrawInstanced( GLenum mode, int count, int instanceCount )
+{
+	DrawInstanced(mode, 0, count, instanceCount);
+}
+
+void GLVertexArray::DrawInstanced( GLenum mode, int first, int count, int instanceCount )
+{
+	Bind();
+	glDrawArraysInstanced(mode, first, count, instanceCount);
+}
+
+void GLVertexArray::DrawElementsInstanced( GLenum mode, GLIndexBuffer* ib, int instanceCount )
+{
+	Bind();
+	ib->DrawInstanced(mode, instanceCount);
 }
 
 // ----------------------------------------------------------------------
@@ -449,36 +826,63 @@ public:
 	std::string ShaderTypeString(GLShaderType type);
 	bool InferShaderType(const std::string& path, GLShaderType& type);
 	bool LoadShaderFile(const std::string& path, std::string& content);
-	GLuint GetOrCreateUniformID(const std::string& name);
+	bool CheckCompileStatus(GLShaderType type, GLuint shaderID);
+	std::string ProgramCachePath();
+	bool LoadProgramBinary(const std::string& path);
+	void SaveProgramBinary(const std::string& path);
+	GLint GetOrCreateUniformID(const std::string& name);
+	void IntrospectUniforms();
+	bool IsUniformTypeCompatible(GLenum type, GLenum activeType);
+
+public:
+
+	struct ActiveUniform
+	{
+		GLint location;
+		GLenum type;
+		int size;			//!< Number of the elements of arrays.
+	};
 
 public:
 
 	GLuint id;
-	typedef boost::unordered_map<std::string, GLuint> UniformLocationMap;
+	std::vector<std::pair<GLShaderType, std::string>> sources;		//!< Sources compiled in LinkAsync.
+	std::vector<std::pair<GLShaderType, GLuint>> pendingShaders;	//!< Shaders submitted in LinkAsync.
+	std::string cachePath;
+	bool separable;
+	bool linkPending;
+	bool linked;
+	typedef boost::unordered_map<std::string, GLint> UniformLocationMap;
 	UniformLocationMap uniformLocationMap;
+	typedef boost::unordered_map<std::string, ActiveUniform> ActiveUniformMap;
+	ActiveUniformMap activeUniforms;
 
 };
 
 GLShader::GLShader()
 	: p(new Impl)
 {
+	p->separable = false;
+	p->linkPending = false;
+	p->linked = false;
 	id = p->id = glCreateProgram();
 }
 
 GLShader::~GLShader()
 {
+	GLStateCache::ProgramDeleted(ID());
 	glDeleteProgram(ID());
 	FW_SAFE_DELETE(p);
 }
 
 void GLShader::Begin()
 {
-	glUseProgram(ID());
+	GLStateCache::UseProgram(ID());
 }
 
 void GLShader::End()
 {
-	glUseProgram(0);
+	// The program is left bound and replaced by the next one
 }
 
 bool GLShader::Compile( const std::string& path )
@@ -507,56 +911,61 @@ bool GLShader::Compile( GLShaderType type, const std::string& path )
 
 void GLShader::SetUniform( const std::string& name, const glm::mat4& mat )
 {
-	GLuint uniformID = p->GetOrCreateUniformID(name);
+	GLint uniformID = p->GetOrCreateUniformID(name);
 	glUniformMatrix4fv(uniformID, 1, GL_FALSE, glm::value_ptr(mat));
 }
 
 void GLShader::SetUniform( const std::string& name, const glm::mat3& mat )
 {
-	GLuint uniformID = p->GetOrCreateUniformID(name);
+	GLint uniformID = p->GetOrCreateUniformID(name);
 	glUniformMatrix3fv(uniformID, 1, GL_FALSE, glm::value_ptr(mat));
 }
 
 void GLShader::SetUniform( const std::string& name, float v )
 {
-	GLuint uniformID = p->GetOrCreateUniformID(name);
+	GLint uniformID = p->GetOrCreateUniformID(name);
 	glUniform1f(uniformID, v);
 }
 
 void GLShader::SetUniform( const std::string& name, const glm::vec2& v )
 {
-	GLuint uniformID = p->GetOrCreateUniformID(name);
+	GLint uniformID = p->GetOrCreateUniformID(name);
 	glUniform2fv(uniformID, 1, glm::value_ptr(v));
 }
 
 void GLShader::SetUniform( const std::string& name, const glm::vec3& v )
 {
-	GLuint uniformID = p->GetOrCreateUniformID(name);
+	GLint uniformID = p->GetOrCreateUniformID(name);
 	glUniform3fv(uniformID, 1, glm::value_ptr(v));
 }
 
 void GLShader::SetUniform( const std::string& name, const glm::vec4& v )
 {
-	GLuint uniformID = p->GetOrCreateUniformID(name);
+	GLint uniformID = p->GetOrCreateUniformID(name);
 	glUniform4fv(uniformID, 1, glm::value_ptr(v));
 }
 
 void GLShader::SetUniform( const std::string& name, int v )
 {
-	GLuint uniformID = p->GetOrCreateUniformID(name);
+	GLint uniformID = p->GetOrCreateUniformID(name);
 	glUniform1i(uniformID, v);
 }
 
 bool GLShader::CompileString( GLShaderType type, const std::string& content )
 {
-	// Create and compile shader
-	GLuint shaderID = glCreateShader((GLenum)type);
-	const char* contentPtr = content.c_str();
+	// Compilation is deferred to LinkAsync,
+	// where it is skipped if the program is found in the cache.
+	p->sources.push_back(std::make_pair(type, content));
+	return true;
+}
 
-	glShaderSource(shaderID, 1, &contentPtr, NULL);
-	glCompileShader(shaderID);
+void GLShader::SetSeparable( bool separable )
+{
+	p->separable = separable;
+}
 
-	// Check errors
+bool GLShader::Impl::CheckCompileStatus( GLShaderType type, GLuint shaderID )
+{
 	int ret;
 	glGetShaderiv(shaderID, GL_COMPILE_STATUS, &ret);
 
@@ -569,29 +978,102 @@ bool GLShader::CompileString( GLShaderType type, const std::string& content )
 		// Get info log
 		boost::scoped_array<char> infoLog(new char[length]);
 		glGetShaderInfoLog(shaderID, length, NULL, infoLog.get());
-		glDeleteShader(shaderID);
 
 		std::stringstream ss;
-		ss << "[" << p->ShaderTypeString(type) << "]" << std::endl;
+		ss << "[" << ShaderTypeString(type) << "]" << std::endl;
 		ss << infoLog.get() << std::endl;
 
 		FW_LOG_ERROR(ss.str());
 		return false;
 	}
 
-	// Attach to the program
-	glAttachShader(id, shaderID);
-	glDeleteShader(shaderID);
-
 	return true;
 }
 
 bool GLShader::Link()
 {
-	// Link program
+	LinkAsync();
+	return WaitLink();
+}
+
+void GLShader::LinkAsync()
+{
+	p->linked = false;
+	p->linkPending = false;
+
+	// Applied to both linking and loading the binary
+	glProgramParameteri(id, GL_PROGRAM_SEPARABLE, p->separable ? GL_TRUE : GL_FALSE);
+
+	// Load the program from the cache
+	p->cachePath = p->ProgramCachePath();
+	if (!p->cachePath.empty() && p->LoadProgramBinary(p->cachePath))
+	{
+		p->sources.clear();
+		p->IntrospectUniforms();
+		p->linked = true;
+		return;
+	}
+
+	// Submit compilation and linking without querying the status,
+	// so that the driver can process them in the background.
+	for (const auto& source : p->sources)
+	{
+		GLuint shaderID = glCreateShader((GLenum)source.first);
+		const char* contentPtr = source.second.c_str();
+		glShaderSource(shaderID, 1, &contentPtr, NULL);
+		glCompileShader(shaderID);
+		glAttachShader(id, shaderID);
+		p->pendingShaders.push_back(std::make_pair(source.first, shaderID));
+	}
+
+	p->sources.clear();
+
+	if (!p->cachePath.empty())
+	{
+		glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
 	glLinkProgram(id);
+	p->linkPending = true;
+}
+
+bool GLShader::IsLinkCompleted()
+{
+	if (!p->linkPending || !parallelShaderCompile)
+	{
+		return true;
+	}
+
+	GLint completed;
+	glGetProgramiv(id, GL_COMPLETION_STATUS_ARB, &completed);
+	return completed != GL_FALSE;
+}
+
+bool GLShader::WaitLink()
+{
+	if (!p->linkPending)
+	{
+		return p->linked;
+	}
+
+	p->linkPending = false;
+
+	// Check compile errors
+	// The shaders are deleted with the program.
+	bool compiled = true;
+	for (const auto& shader : p->pendingShaders)
+	{
+		compiled = p->CheckCompileStatus(shader.first, shader.second) && compiled;
+		glDeleteShader(shader.second);
+	}
+
+	p->pendingShaders.clear();
+	if (!compiled)
+	{
+		return false;
+	}
 
-	// Check error
+	// Check link errors
 	GLint ret;
 	glGetProgramiv(id, GL_LINK_STATUS, &ret);
 
@@ -608,23 +1090,102 @@ bool GLShader::Link()
 		return false;
 	}
 
+	if (!p->cachePath.empty())
+	{
+		p->SaveProgramBinary(p->cachePath);
+	}
+
+	p->IntrospectUniforms();
+	p->linked = true;
+
 	return true;
 }
 
-std::string GLShader::Impl::ShaderTypeString( GLShaderType type )
+bool GLShader::IsUniformActive( const std::string& name ) const
 {
-	switch (type)
-	{
-		case GLShaderType::VertexShader:
-			return "VertexShader";
+	return p->activeUniforms.find(name) != p->activeUniforms.end();
+}
 
-		case GLShaderType::TessControlShader:
-			return "TessControlShader";
+bool GLShader::ResolveUniformLocation( const std::string& name, GLenum type, GLint& location )
+{
+	location = -1;
 
-		case GLShaderType::TessEvaluationShader:
-			return "TessEvaluationShader";
+	auto it = p->activeUniforms.find(name);
+	if (it == p->activeUniforms.end())
+	{
+		FW_LOG_ERROR(boost::str(boost::format("Uniform '%s' is not active") % name));
+		return false;
+	}
 
-		case GLShaderType::GeometryShader:
+	if (!p->IsUniformTypeCompatible(type, it->second.type))
+	{
+		FW_LOG_ERROR(boost::str(boost::format("Type of uniform '%s' does not match (0x%04x requested, 0x%04x in the program)") % name % type % it->second.type));
+		return false;
+	}
+
+	location = it->second.location;
+	return true;
+}
+
+void GLShader::SetUniform( GLUniformHandle<glm::mat4> handle, const glm::mat4& mat )
+{
+	glUniformMatrix4fv(handle.Location(), 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void GLShader::SetUniform( GLUniformHandle<glm::mat3> handle, const glm::mat3& mat )
+{
+	glUniformMatrix3fv(handle.Location(), 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void GLShader::SetUniform( GLUniformHandle<float> handle, float v )
+{
+	glUniform1f(handle.Location(), v);
+}
+
+void GLShader::SetUniform( GLUniformHandle<glm::vec2> handle, const glm::vec2& v )
+{
+	glUniform2fv(handle.Location(), 1, glm::value_ptr(v));
+}
+
+void GLShader::SetUniform( GLUniformHandle<glm::vec3> handle, const glm::vec3& v )
+{
+	glUniform3fv(handle.Location(), 1, glm::value_ptr(v));
+}
+
+void GLShader::SetUniform( GLUniformHandle<glm::vec4> handle, const glm::vec4& v )
+{
+	glUniform4fv(handle.Location(), 1, glm::value_ptr(v));
+}
+
+void GLShader::SetUniform( GLUniformHandle<int> handle, int v )
+{
+	glUniform1i(handle.Location(), v);
+}
+
+void GLShader::SetUniform( GLUniformHandle<float> handle, const float* v, int count )
+{
+	glUniform1fv(handle.Location(), count, v);
+}
+
+void GLShader::SetUniform( GLUniformHandle<int> handle, const int* v, int count )
+{
+	glUniform1iv(handle.Location(), count, v);
+}
+
+std::string GLShader::Impl::ShaderTypeString( GLShaderType type )
+{
+	switch (type)
+	{
+		case GLShaderType::VertexShader:
+			return "VertexShader";
+
+		case GLShaderType::TessControlShader:
+			return "TessControlShader";
+
+		case GLShaderType::TessEvaluationShader:
+			return "TessEvaluationShader";
+
+		case GLShaderType::GeometryShader:
 			return "GeometryShader";
 
 		case GLShaderType::FragmentShader:
@@ -689,13 +1250,121 @@ bool GLShader::Impl::LoadShaderFile( const std::string& path, std::string& conte
 	return true;
 }
 
-GLuint GLShader::Impl::GetOrCreateUniformID( const std::string& name )
+std::string GLShader::Impl::ProgramCachePath()
+{
+	if (programCacheDirectory.empty() || sources.empty())
+	{
+		return "";
+	}
+
+	// Key is the hash (64-bit FNV-1a) of the sources and the driver,
+	// because the binaries are rejected by other drivers or versions.
+	unsigned long long hash = 14695981039346656037ULL;
+	auto update = [&hash](const std::string& s)
+	{
+		for (auto c : s)
+		{
+			hash ^= (unsigned char)c;
+			hash *= 1099511628211ULL;
+		}
+
+		// Separator
+		hash ^= 0xff;
+		hash *= 1099511628211ULL;
+	};
+
+	const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (auto name : names)
+	{
+		auto* s = (const char*)glGetString(name);
+		update(s ? s : "");
+	}
+
+	// Separable programs are linked differently
+	update(separable ? "separable" : "");
+
+	for (const auto& source : sources)
+	{
+		update(std::to_string((long long)source.first));
+		update(source.second);
+	}
+
+	auto filename = boost::str(boost::format("%016x.bin") % hash);
+	return (boost::filesystem::path(programCacheDirectory) / filename).string();
+}
+
+bool GLShader::Impl::LoadProgramBinary( const std::string& path )
+{
+	std::ifstream ifs(path.c_str(), std::ios::in | std::ios::binary);
+	if (!ifs.is_open())
+	{
+		// Not cached yet
+		return false;
+	}
+
+	ProgramBinaryHeader header;
+	if (!ifs.read((char*)&header, sizeof(header)) ||
+		std::memcmp(header.magic, ProgramBinaryMagic, sizeof(ProgramBinaryMagic)) != 0 ||
+		header.length <= 0)
+	{
+		FW_LOG_WARN("Invalid program binary " + path);
+		return false;
+	}
+
+	std::vector<char> binary(header.length);
+	if (!ifs.read(&binary[0], header.length))
+	{
+		FW_LOG_WARN("Invalid program binary " + path);
+		return false;
+	}
+
+	glProgramBinary(id, header.format, &binary[0], header.length);
+
+	// The binary is rejected after the driver is updated
+	GLint status;
+	glGetProgramiv(id, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE)
+	{
+		FW_LOG_INFO("Program binary is rejected, recompiling " + path);
+		return false;
+	}
+
+	return true;
+}
+
+void GLShader::Impl::SaveProgramBinary( const std::string& path )
+{
+	ProgramBinaryHeader header;
+	std::memcpy(header.magic, ProgramBinaryMagic, sizeof(ProgramBinaryMagic));
+
+	glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &header.length);
+	if (header.length <= 0)
+	{
+		return;
+	}
+
+	std::vector<char> binary(header.length);
+	glGetProgramBinary(id, header.length, &header.length, &header.format, &binary[0]);
+
+	std::ofstream ofs(path.c_str(), std::ios::out | std::ios::binary);
+	if (!ofs.write((const char*)&header, sizeof(header)) || !ofs.write(&binary[0], header.length))
+	{
+		FW_LOG_WARN("Failed to write program binary " + path);
+	}
+}
+
+GLint GLShader::Impl::GetOrCreateUniformID( const std::string& name )
 {
 	UniformLocationMap::iterator it = uniformLocationMap.find(name);
 
 	if (it == uniformLocationMap.end())
 	{
-		GLuint loc = glGetUniformLocation(id, name.c_str());
+		GLint loc = glGetUniformLocation(id, name.c_str());
+		if (loc < 0)
+		{
+			// Warned once, the call with -1 is silently ignored afterwards
+			FW_LOG_WARN(boost::str(boost::format("Uniform '%s' is not active") % name));
+		}
 
 		uniformLocationMap[name] = loc;
 
@@ -705,6 +1374,302 @@ GLuint GLShader::Impl::GetOrCreateUniformID( const std::string& name )
 	return it->second;
 }
 
+void GLShader::Impl::IntrospectUniforms()
+{
+	uniformLocationMap.clear();
+	activeUniforms.clear();
+
+	GLint numUniforms;
+	GLint maxLength;
+	glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &numUniforms);
+	glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+	std::vector<char> nameBuffer(maxLength + 1);
+	for (GLint i = 0; i < numUniforms; i++)
+	{
+		GLsizei length;
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(id, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &size, &type, &nameBuffer[0]);
+		std::string name(&nameBuffer[0], length);
+
+		// Uniforms in the blocks have no location
+		GLint location = glGetUniformLocation(id, name.c_str());
+		if (location < 0)
+		{
+			continue;
+		}
+
+		// Arrays are reported with the subscript of the first element
+		const std::string subscript = "[0]";
+		if (name.size() > subscript.size() && name.compare(name.size() - subscript.size(), subscript.size(), subscript) == 0)
+		{
+			name.erase(name.size() - subscript.size());
+		}
+
+		ActiveUniform uniform;
+		uniform.location = location;
+		uniform.type = type;
+		uniform.size = size;
+		activeUniforms[name] = uniform;
+	}
+}
+
+bool GLShader::Impl::IsUniformTypeCompatible( GLenum type, GLenum activeType )
+{
+	if (type == activeType)
+	{
+		return true;
+	}
+
+	if (type == GL_INT)
+	{
+		// Booleans and samplers are set as integers
+		switch (activeType)
+		{
+			case GL_BOOL:
+			case GL_SAMPLER_1D:
+			case GL_SAMPLER_2D:
+			case GL_SAMPLER_3D:
+			case GL_SAMPLER_CUBE:
+			case GL_SAMPLER_2D_SHADOW:
+			case GL_SAMPLER_2D_ARRAY:
+			case GL_SAMPLER_2D_MULTISAMPLE:
+			case GL_SAMPLER_BUFFER:
+			case GL_INT_SAMPLER_2D:
+			case GL_UNSIGNED_INT_SAMPLER_2D:
+				return true;
+		}
+	}
+
+	return false;
+}
+
+// ----------------------------------------------------------------------
+
+class GLProgramPipeline::Impl
+{
+public:
+
+	GLbitfield StageBit(GLShaderType type);
+
+public:
+
+	std::vector<std::pair<GLShaderType, std::shared_ptr<GLShader>>> stages;
+	bool attached;
+
+};
+
+GLbitfield GLProgramPipeline::Impl::StageBit( GLShaderType type )
+{
+	switch (type)
+	{
+		case GLShaderType::VertexShader:
+			return GL_VERTEX_SHADER_BIT;
+
+		case GLShaderType::TessControlShader:
+			return GL_TESS_CONTROL_SHADER_BIT;
+
+		case GLShaderType::TessEvaluationShader:
+			return GL_TESS_EVALUATION_SHADER_BIT;
+
+		case GLShaderType::GeometryShader:
+			return GL_GEOMETRY_SHADER_BIT;
+
+		case GLShaderType::FragmentShader:
+			return GL_FRAGMENT_SHADER_BIT;
+	}
+
+	return 0;
+}
+
+// Set a constant uniform by the name through a temporary handle
+template <typename T>
+static void SetPipelineUniform( GLProgramPipeline& pipeline, const std::string& name, const T& v )
+{
+	GLUniformHandle<T> handle;
+	if (pipeline.ResolveUniform(name, handle))
+	{
+		pipeline.SetUniform(handle, v);
+	}
+}
+
+GLProgramPipeline::GLProgramPipeline()
+	: p(new Impl)
+{
+	p->attached = false;
+	glGenProgramPipelines(1, &id);
+}
+
+GLProgramPipeline::~GLProgramPipeline()
+{
+	GLStateCache::ProgramPipelineDeleted(id);
+	glDeleteProgramPipelines(1, &id);
+	FW_SAFE_DELETE(p);
+}
+
+void GLProgramPipeline::Begin()
+{
+	// A program in use takes precedence over the pipeline
+	GLStateCache::UseProgram(0);
+	GLStateCache::BindProgramPipeline(id);
+}
+
+void GLProgramPipeline::End()
+{
+	// The pipeline is left bound and replaced by the next one
+}
+
+void GLProgramPipeline::AddStage( GLShaderType type, const std::shared_ptr<GLShader>& program )
+{
+	p->stages.push_back(std::make_pair(type, program));
+	p->attached = false;
+}
+
+bool GLProgramPipeline::WaitLink()
+{
+	if (p->attached)
+	{
+		return true;
+	}
+
+	// Stages can be attached only after they are linked
+	for (const auto& stage : p->stages)
+	{
+		if (!stage.second->WaitLink())
+		{
+			return false;
+		}
+
+		glUseProgramStages(id, p->StageBit(stage.first), stage.second->ID());
+	}
+
+	// Check the interfaces between the stages
+	GLint status;
+	glValidateProgramPipeline(id);
+	glGetProgramPipelineiv(id, GL_VALIDATE_STATUS, &status);
+	if (status == GL_FALSE)
+	{
+		GLint length;
+		glGetProgramPipelineiv(id, GL_INFO_LOG_LENGTH, &length);
+		if (length > 0)
+		{
+			boost::scoped_array<char> infoLog(new char[length]);
+			glGetProgramPipelineInfoLog(id, length, NULL, infoLog.get());
+			FW_LOG_WARN(infoLog.get());
+		}
+	}
+
+	p->attached = true;
+	return true;
+}
+
+GLShader* GLProgramPipeline::FindUniformProgram( const std::string& name )
+{
+	GLShader* found = nullptr;
+	for (const auto& stage : p->stages)
+	{
+		if (stage.second->IsUniformActive(name))
+		{
+			if (found && found != stage.second.get())
+			{
+				// Variables of different stages are distinct, a handle cannot set both
+				FW_LOG_ERROR(boost::str(boost::format("Uniform '%s' is active in multiple stages") % name));
+				return nullptr;
+			}
+
+			found = stage.second.get();
+		}
+	}
+
+	if (!found)
+	{
+		FW_LOG_ERROR(boost::str(boost::format("Uniform '%s' is not active") % name));
+	}
+
+	return found;
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<glm::mat4> handle, const glm::mat4& mat )
+{
+	glProgramUniformMatrix4fv(handle.Program(), handle.Location(), 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<glm::mat3> handle, const glm::mat3& mat )
+{
+	glProgramUniformMatrix3fv(handle.Program(), handle.Location(), 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<float> handle, float v )
+{
+	glProgramUniform1f(handle.Program(), handle.Location(), v);
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<glm::vec2> handle, const glm::vec2& v )
+{
+	glProgramUniform2fv(handle.Program(), handle.Location(), 1, glm::value_ptr(v));
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<glm::vec3> handle, const glm::vec3& v )
+{
+	glProgramUniform3fv(handle.Program(), handle.Location(), 1, glm::value_ptr(v));
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<glm::vec4> handle, const glm::vec4& v )
+{
+	glProgramUniform4fv(handle.Program(), handle.Location(), 1, glm::value_ptr(v));
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<int> handle, int v )
+{
+	glProgramUniform1i(handle.Program(), handle.Location(), v);
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<float> handle, const float* v, int count )
+{
+	glProgramUniform1fv(handle.Program(), handle.Location(), count, v);
+}
+
+void GLProgramPipeline::SetUniform( GLUniformHandle<int> handle, const int* v, int count )
+{
+	glProgramUniform1iv(handle.Program(), handle.Location(), count, v);
+}
+
+void GLProgramPipeline::SetUniform( const std::string& name, const glm::mat4& mat )
+{
+	SetPipelineUniform(*this, name, mat);
+}
+
+void GLProgramPipeline::SetUniform( const std::string& name, const glm::mat3& mat )
+{
+	SetPipelineUniform(*this, name, mat);
+}
+
+void GLProgramPipeline::SetUniform( const std::string& name, float v )
+{
+	SetPipelineUniform(*this, name, v);
+}
+
+void GLProgramPipeline::SetUniform( const std::string& name, const glm::vec2& v )
+{
+	SetPipelineUniform(*this, name, v);
+}
+
+void GLProgramPipeline::SetUniform( const std::string& name, const glm::vec3& v )
+{
+	SetPipelineUniform(*this, name, v);
+}
+
+void GLProgramPipeline::SetUniform( const std::string& name, const glm::vec4& v )
+{
+	SetPipelineUniform(*this, name, v);
+}
+
+void GLProgramPipeline::SetUniform( const std::string& name, int v )
+{
+	SetPipelineUniform(*this, name, v);
+}
+
 // ----------------------------------------------------------------------
 
 GLProxyTexture2D::GLProxyTexture2D( GLuint id )
@@ -714,14 +1679,12 @@ GLProxyTexture2D::GLProxyTexture2D( GLuint id )
 
 void GLProxyTexture2D::Bind( int unit )
 {
-	glActiveTexture((GLenum)(GL_TEXTURE0 + unit));
-	glBindTexture(GL_TEXTURE_2D, id);
+	GLStateCache::BindTexture(unit, GL_TEXTURE_2D, id);
 }
 
 void GLProxyTexture2D::Unbind()
 {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	// The texture is left bound and replaced by the next one
 }
 
 // ----------------------------------------------------------------------
@@ -733,19 +1696,23 @@ GLTexture::GLTexture()
 
 GLTexture::~GLTexture()
 {
+	GLStateCache::TextureDeleted(id);
 	glDeleteTextures(1, &id);
 }
 
 void GLTexture::Bind( int unit )
 {
-	glActiveTexture((GLenum)(GL_TEXTURE0 + unit));
-	glBindTexture(target, id);
+	GLStateCache::BindTexture(unit, target, id);
 }
 
 void GLTexture::Unbind()
 {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(target, 0);
+	// The texture is left bound and replaced by the next one
+}
+
+void GLTexture::BindForEdit()
+{
+	GLStateCache::BindTextureForEdit(0, target, id);
 }
 
 // ----------------------------------------------------------------------
@@ -753,6 +1720,11 @@ void GLTexture::Unbind()
 GLTexture2D::GLTexture2D()
 {
 	target = GL_TEXTURE_2D;
+	width = 0;
+	height = 0;
+	internalFormat = GL_RGBA8;
+	levels = 1;
+	allocatedLevels = 0;
 	minFilter = GL_LINEAR_MIPMAP_LINEAR;
 	magFilter = GL_LINEAR;
 	wrap = GL_REPEAT;
@@ -771,22 +1743,60 @@ void GLTexture2D::Allocate( int width, int height, GLenum internalFormat )
 
 void GLTexture2D::Allocate( int width, int height, GLenum internalFormat, GLenum format, GLenum type, const void* data )
 {
+	AllocateStorage(width, height, internalFormat);
+	if (data)
+	{
+		Replace(glm::ivec4(0, 0, width, height), format, type, data);
+	}
+}
+
+void GLTexture2D::AllocateCompressed( int width, int height, GLenum internalFormat, int imageSize, const void* data )
+{
+	AllocateStorage(width, height, internalFormat);
+	if (data)
+	{
+		ReplaceCompressed(glm::ivec4(0, 0, width, height), imageSize, data);
+	}
+}
+
+void GLTexture2D::AllocateStorage( int width, int height, GLenum internalFormat )
+{
+	// The immutable storage cannot be respecified, so a new object is created
+	if (allocatedLevels > 0)
+	{
+		GLStateCache::TextureDeleted(id);
+		glDeleteTextures(1, &id);
+		glGenTextures(1, &id);
+	}
+
 	this->width = width;
 	this->height = height;
 	this->internalFormat = internalFormat;
+	allocatedLevels = levels > 0 ? std::min(levels, FullMipmapLevels(width, height)) : FullMipmapLevels(width, height);
 
-	Bind();
-	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, data);
-	GenerateMipmap();
+	if (directStateAccess)
+	{
+		glTextureStorage2DEXT(id, GL_TEXTURE_2D, allocatedLevels, internalFormat, width, height);
+		UpdateTextureParams();
+		return;
+	}
+
+	BindForEdit();
+	glTexStorage2D(GL_TEXTURE_2D, allocatedLevels, internalFormat, width, height);
 	UpdateTextureParams();
 	Unbind();
 }
 
 void GLTexture2D::Replace( const glm::ivec4& rect, GLenum format, GLenum type, const void* data )
 {
-	Bind();
+	if (directStateAccess)
+	{
+		glTextureSubImage2DEXT(id, GL_TEXTURE_2D, 0, rect.x, rect.y, rect.z, rect.w, format, type, data);
+		return;
+	}
+
+	BindForEdit();
 	glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.z, rect.w, format, type, data);
-	GenerateMipmap();
 	Unbind();
 }
 
@@ -797,23 +1807,77 @@ void GLTexture2D::Replace( GLPixelUnpackBuffer* pbo, const glm::ivec4& rect, GLe
 	pbo->Unbind();
 }
 
+void GLTexture2D::ReplaceCompressed( const glm::ivec4& rect, int imageSize, const void* data )
+{
+	if (directStateAccess)
+	{
+		glCompressedTextureSubImage2DEXT(id, GL_TEXTURE_2D, 0, rect.x, rect.y, rect.z, rect.w, internalFormat, imageSize, data);
+		return;
+	}
+
+	BindForEdit();
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.z, rect.w, internalFormat, imageSize, data);
+	Unbind();
+}
+
 void GLTexture2D::GetInternalData( GLenum format, GLenum type, void* data )
 {
-	Bind();
+	if (directStateAccess)
+	{
+		glGetTextureImageEXT(id, GL_TEXTURE_2D, 0, format, type, data);
+		return;
+	}
+
+	BindForEdit();
 	glGetTexImage(GL_TEXTURE_2D, 0, format, type, data);
 	Unbind();
 }
 
 void GLTexture2D::GenerateMipmap()
 {
-	if (minFilter == GL_LINEAR_MIPMAP_LINEAR && magFilter == GL_LINEAR)
+	// Nothing to generate without the lower levels
+	if (allocatedLevels <= 1)
+	{
+		return;
+	}
+
+	if (directStateAccess)
 	{
-		glGenerateMipmap(GL_TEXTURE_2D);
+		glGenerateTextureMipmapEXT(id, GL_TEXTURE_2D);
+		return;
 	}
+
+	BindForEdit();
+	glGenerateMipmap(GL_TEXTURE_2D);
+	Unbind();
+}
+
+int GLTexture2D::FullMipmapLevels( int width, int height )
+{
+	int levels = 1;
+	for (int size = std::max(width, height); size > 1; size /= 2)
+	{
+		levels++;
+	}
+
+	return levels;
 }
 
 void GLTexture2D::UpdateTextureParams()
 {
+	// The texture must be bound unless the direct state access is enabled
+	auto setParameter = [this](GLenum pname, GLint param)
+	{
+		if (directStateAccess)
+		{
+			glTextureParameteriEXT(id, GL_TEXTURE_2D, pname, param);
+		}
+		else
+		{
+			glTexParameteri(GL_TEXTURE_2D, pname, param);
+		}
+	};
+
 	if (anisotropicFiltering)
 	{
 		// If the anisotropic filtering can be used,
@@ -821,16 +1885,23 @@ void GLTexture2D::UpdateTextureParams()
 		float maxAnisoropy;
 
 		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisoropy);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisoropy);
+		if (directStateAccess)
+		{
+			glTextureParameterfEXT(id, GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisoropy);
+		}
+		else
+		{
+			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisoropy);
+		}
 	}
 
 	// Wrap mode
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+	setParameter(GL_TEXTURE_WRAP_S, wrap);
+	setParameter(GL_TEXTURE_WRAP_T, wrap);
 
 	// Filters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+	setParameter(GL_TEXTURE_MIN_FILTER, minFilter);
+	setParameter(GL_TEXTURE_MAG_FILTER, magFilter);
 }
 
 // ------------------------------------------------------------------------
@@ -838,6 +1909,13 @@ void GLTexture2D::UpdateTextureParams()
 GLRenderBuffer::GLRenderBuffer( int width, int height, GLenum format )
 {
 	glGenRenderbuffers(1, &id);
+
+	if (directStateAccess)
+	{
+		glNamedRenderbufferStorageEXT(id, format, width, height);
+		return;
+	}
+
 	Bind();
 	glRenderbufferStorage(GL_RENDERBUFFER, format, width, height);
 	Unbind();
@@ -867,6 +1945,8 @@ public:
 	int width;
 	int height;
 	glm::vec4 clearColor;
+	bool defaultFramebuffer;
+	bool ownDepthStencilRBO;
 	GLRenderBuffer* depthStencilRBO;
 	std::vector<GLenum> colorAttachmentList;
 	std::vector<GLTexture2D*> renderTargets;
@@ -880,15 +1960,68 @@ GLFrameBuffer::GLFrameBuffer( int width, int height, const glm::vec4& clearColor
 	p->width = width;
 	p->height = height;
 	p->clearColor = clearColor;
-
+	p->defaultFramebuffer = false;
+	p->ownDepthStencilRBO = true;
 	p->depthStencilRBO = new GLRenderBuffer(width, height, GL_DEPTH_STENCIL);
+	Create();
+}
+
+GLFrameBuffer::GLFrameBuffer( int width, int height, const glm::vec4& clearColor, GLRenderBuffer* depthStencil )
+	: p(new Impl)
+{
+	p->width = width;
+	p->height = height;
+	p->clearColor = clearColor;
+	p->defaultFramebuffer = false;
+	p->ownDepthStencilRBO = false;
+	p->depthStencilRBO = depthStencil;
+	Create();
+}
+
+GLFrameBuffer::GLFrameBuffer()
+	: p(new Impl)
+{
 
+}
+
+GLFrameBuffer::~GLFrameBuffer()
+{
+	if (!p->defaultFramebuffer)
+	{
+		GLStateCache::FramebufferDeleted(id);
+		glDeleteFramebuffers(1, &id);
+	}
+	if (p->ownDepthStencilRBO)
+	{
+		FW_SAFE_DELETE(p->depthStencilRBO);
+	}
+	FW_SAFE_DELETE(p);
+}
+
+std::unique_ptr<GLFrameBuffer> GLFrameBuffer::DefaultFramebuffer( int width, int height, const glm::vec4& clearColor )
+{
+	std::unique_ptr<GLFrameBuffer> fbo(new GLFrameBuffer);
+	fbo->p->width = width;
+	fbo->p->height = height;
+	fbo->p->clearColor = clearColor;
+	fbo->p->defaultFramebuffer = true;
+	fbo->p->ownDepthStencilRBO = false;
+	fbo->p->depthStencilRBO = nullptr;
+	fbo->id = 0;
+	return fbo;
+}
+
+void GLFrameBuffer::Create()
+{
 	// Generate FBO
 	glGenFramebuffers(1, &id);
 
 	// Attach to FBO
 	Bind();
-	glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, p->depthStencilRBO->ID());
+	if (p->depthStencilRBO)
+	{
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, p->depthStencilRBO->ID());
+	}
 
 	// Check FBO status
 	GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
@@ -917,21 +2050,14 @@ GLFrameBuffer::GLFrameBuffer( int width, int height, const glm::vec4& clearColor
 	Unbind();
 }
 
-GLFrameBuffer::~GLFrameBuffer()
-{
-	glDeleteFramebuffers(1, &id);
-	FW_SAFE_DELETE(p->depthStencilRBO);
-	FW_SAFE_DELETE(p);
-}
-
 void GLFrameBuffer::Bind()
 {
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, id);
+	GLStateCache::BindDrawFramebuffer(id);
 }
 
 void GLFrameBuffer::Unbind()
 {
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	GLStateCache::BindDrawFramebuffer(0);
 }
 
 void GLFrameBuffer::AddRenderTarget( GLTexture2D* texture )
@@ -941,18 +2067,60 @@ void GLFrameBuffer::AddRenderTarget( GLTexture2D* texture )
 	p->colorAttachmentList.push_back(attachment);
 	p->renderTargets.push_back(texture);
 
+	if (directStateAccess)
+	{
+		glNamedFramebufferTexture2DEXT(id, attachment, GL_TEXTURE_2D, texture->ID(), 0);
+		return;
+	}
+
 	Bind();
 	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture->ID(), 0);
 	Unbind();
 }
 
+bool GLFrameBuffer::IsDefault()
+{
+	return p->defaultFramebuffer;
+}
+
+void GLFrameBuffer::SetClearColor( const glm::vec4& clearColor )
+{
+	p->clearColor = clearColor;
+}
+
+int GLFrameBuffer::Width()
+{
+	return p->width;
+}
+
+int GLFrameBuffer::Height()
+{
+	return p->height;
+}
+
 void GLFrameBuffer::Begin()
 {
 	// Save current viewport
 	glGetIntegerv(GL_VIEWPORT, &p->viewport.x);
 
+	// Render targets left bound by the previous passes cause the feedback loop
+	for (auto* renderTarget : p->renderTargets)
+	{
+		GLStateCache::UnbindTexture(renderTarget->ID());
+	}
+
 	Bind();
 
+	if (p->defaultFramebuffer)
+	{
+		// Clear the back buffer and keep the viewport
+		float depth = 1.0f;
+		glDrawBuffer(GL_BACK_LEFT);
+		glClearBufferfv(GL_DEPTH, 0, &depth);
+		glClearBufferfv(GL_COLOR, 0, glm::value_ptr(p->clearColor));
+		return;
+	}
+
 	// Enable buffers
 	glDrawBuffers((int)p->colorAttachmentList.size(), &p->colorAttachmentList[0]);
 
@@ -972,13 +2140,7 @@ void GLFrameBuffer::End()
 {
 	Unbind();
 
-	// Generate mipmap if needed
-	for (size_t i = 0; i < p->renderTargets.size(); i++)
-	{
-		p->renderTargets[i]->Bind();
-		p->renderTargets[i]->GenerateMipmap();
-		p->renderTargets[i]->Unbind();
-	}
+	// The mipmaps of the render targets are generated by the users that sample them
 
 	// Restore
 	glDrawBuffer(GL_BACK_LEFT);
@@ -6,9 +6,13 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <GL/glew.h>	// glew 1.10.0
 #include <string>
+#include <memory>
+#include <vector>
 
 FW_NAMESPACE_BEGIN
 
+class GLStreamBuffer;
+
 //! OpenGL utilities.
 class GLUtils
 {
@@ -36,6 +40,28 @@ public:
 	static bool CheckExtension(const std::string& name);
 	static void CheckGLErrors(const char* filename, const int line);
 
+	/*!
+		Check if the resources are modified with the direct state access.
+		If enabled (GL_EXT_direct_state_access is supported), the wrappers modify the objects
+		by their names and never change the bindings of the context.
+		Otherwise the objects are modified by binding them and the bindings are reset to zero afterwards.
+		Determined in InitializeGlew.
+	*/
+	static bool DirectStateAccess();
+
+	/*!
+		Enable the program binary cache.
+		Linked programs are stored in the directory with glGetProgramBinary
+		and loaded with glProgramBinary instead of compiling the shaders on the next launch.
+		The files are keyed by the hash of the sources and the driver,
+		and the programs are recompiled if the driver rejects the binaries.
+		Must be called after InitializeGlew.
+		\param directory Directory of the cache. Created if not exists.
+		\retval true Succeeded to enable the cache.
+		\retval false Program binaries are not supported or the directory cannot be created.
+	*/
+	static bool EnableProgramCache(const std::string& directory);
+
 };
 
 //! OpenGL vertex attribute.
@@ -82,6 +108,7 @@ public:
 	static const GLVertexAttribute TexCoord4;
 	static const GLVertexAttribute Tangent;
 	static const GLVertexAttribute Color;
+	static const GLVertexAttribute DrawID;		//!< Index of the draw in a GLDrawBatch (unsigned integer).
 
 };
 
@@ -122,8 +149,17 @@ public:
 
 public:
 
+	/*!
+		Bind the buffer to its target.
+		An index buffer is bound to the default vertex array,
+		because the element buffer binding is the state of the vertex array.
+	*/
 	void Bind();
 	void Unbind();
+
+	// Without direct state access the buffer is bound only during the call
+	// (or until Unmap), to GL_COPY_WRITE_BUFFER for an index buffer,
+	// thus the bound vertex array is not affected.
 	void Allocate(int size, const void* data, GLenum usage);
 	void Replace(int offset, int size, const void* data);
 	void Clear(GLenum internalformat, GLenum format, GLenum type, const void* data);
@@ -133,6 +169,13 @@ public:
 	void Unmap();
 	int Size() { return size; }
 
+private:
+
+	//! Target to which the buffer is bound by the non-DSA edits.
+	GLenum EditTarget() const;
+	void BindForEdit();
+	void UnbindForEdit();
+
 protected:
 
 	int size;
@@ -172,6 +215,95 @@ public:
 	GLIndexBuffer();
 	void AddStatic(int n, const GLuint* idx);
 	void Draw(GLenum mode);
+	void DrawInstanced(GLenum mode, int instanceCount);
+
+};
+
+/*!
+	Uniform buffer.
+	Holds the contents of a std140 uniform block updated every frame.
+	If a stream buffer is given, the contents are written into a region of the stream buffer
+	and the buffer object itself is left unused.
+	Otherwise the buffer object is updated in place.
+*/
+class GLUniformBuffer : public GLBufferObject
+{
+public:
+
+	GLUniformBuffer();
+
+	/*!
+		Update the contents.
+		\param data Contents of the block.
+		\param size Size of the block in bytes.
+		\param streamBuffer Stream buffer from which the contents are allocated. Can be null.
+	*/
+	void Update(const void* data, int size, GLStreamBuffer* streamBuffer);
+
+	/*!
+		Bind the latest contents to a uniform block binding point.
+		\param binding Binding point specified by the layout qualifier of the block.
+	*/
+	void BindBlock(int binding);
+
+private:
+
+	GLuint blockBuffer;
+	int blockOffset;
+	int blockSize;
+
+};
+
+//! Storage format of the components of a vertex attribute, converted to float by the vertex fetch except UInt.
+enum class GLVertexFormat
+{
+	Float,				//!< 32-bit float per component.
+	HalfFloat,			//!< 16-bit float per component.
+	UNorm8,				//!< Unsigned byte per component normalized to [0, 1].
+	SNorm8,				//!< Signed byte per component normalized to [-1, 1].
+	UNorm16,			//!< Unsigned short per component normalized to [0, 1].
+	SNorm16,			//!< Signed short per component normalized to [-1, 1].
+	UNorm2_10_10_10,	//!< Four components packed in 32 bits (GL_UNSIGNED_INT_2_10_10_10_REV) normalized to [0, 1].
+	SNorm2_10_10_10,	//!< Four components packed in 32 bits (GL_INT_2_10_10_10_REV) normalized to [-1, 1].
+	UInt				//!< 32-bit unsigned integer per component read as uint in the shader.
+};
+
+/*!
+	Vertex layout.
+	Describes the attributes interleaved in a vertex buffer.
+	The offsets are usually given by offsetof of the vertex structure.
+*/
+class GLVertexLayout
+{
+public:
+
+	struct Element
+	{
+		int index;				//!< Attribute location.
+		int size;				//!< Number of components. Must be 4 for the packed formats.
+		GLVertexFormat format;
+		int offset;				//!< Offset in bytes from the beginning of the vertex.
+	};
+
+public:
+
+	//! \param stride Size of a vertex in bytes.
+	explicit GLVertexLayout(int stride);
+
+public:
+
+	void Add(const GLVertexAttribute& attr, GLVertexFormat format, int offset);
+	void Add(int index, int size, GLVertexFormat format, int offset);
+	int Stride() const { return stride; }
+	const std::vector<Element>& Elements() const { return elements; }
+
+	//! Pack a vector in [-1, 1] into GLVertexFormat::SNorm2_10_10_10.
+	static GLuint PackSNorm2_10_10_10(const glm::vec4& v);
+
+private:
+
+	int stride;
+	std::vector<Element> elements;
 
 };
 
@@ -186,10 +318,57 @@ public:
 	void Unbind();
 	void Add(const GLVertexAttribute& attr, GLVertexBuffer* vb);
 	void Add(int index, int size, GLVertexBuffer* vb);
+
+	/*!
+		Set the divisor of an attribute added by Add(attr, vb) or Add(index, size, vb).
+		\param index Attribute location.
+		\param divisor Number of instances sharing an element of the attribute. Zero advances per vertex.
+	*/
+	void SetDivisor(int index, int divisor);
+	void SetDivisor(const GLVertexAttribute& attr, int divisor);
+
+	/*!
+		Add the attributes interleaved in a vertex buffer (GL_ARB_vertex_attrib_binding).
+		The attributes added by the other overloads use the binding points of their indices,
+		thus the binding must differ from them when both are used in the same array.
+		Without the extension the attributes are specified with glVertexAttribPointer,
+		so the buffer is fixed and cannot be switched by rebinding the binding point.
+		\param layout Layout of the vertices in the buffer.
+		\param vb Vertex buffer.
+		\param binding Binding point of the buffer.
+		\param divisor Number of instances sharing a vertex of the buffer. Zero advances per vertex.
+	*/
+	void Add(const GLVertexLayout& layout, GLVertexBuffer* vb, int binding = 0, int divisor = 0);
+
+	/*!
+		Attach an index buffer.
+		The binding is kept by the vertex array, so the buffer needs not to be bound for each draw.
+		\param ib Index buffer.
+	*/
+	void SetIndexBuffer(GLIndexBuffer* ib);
 	void Draw(GLenum mode, int count);
 	void Draw(GLenum mode, int first, int count);
 	void Draw(GLenum mode, GLIndexBuffer* ib);
 
+	/*!
+		Draw instances of the vertices in one call.
+		The attributes with non-zero divisors advance per instance.
+		\param mode Primitive type.
+		\param first Index of the first vertex.
+		\param count Number of vertices.
+		\param instanceCount Number of instances.
+	*/
+	void DrawInstanced(GLenum mode, int count, int instanceCount);
+	void DrawInstanced(GLenum mode, int first, int count, int instanceCount);
+
+	/*!
+		Draw instances of the indexed vertices in one call.
+		\param mode Primitive type.
+		\param ib Index buffer.
+		\param instanceCount Number of instances.
+	*/
+	void DrawElementsInstanced(GLenum mode, GLIndexBuffer* ib, int instanceCount);
+
 };
 
 enum class GLShaderType
@@ -201,6 +380,45 @@ enum class GLShaderType
 	FragmentShader = GL_FRAGMENT_SHADER
 };
 
+//! GLSL type of the uniform variables set with a C++ type.
+template <typename T> struct GLUniformType;
+template <> struct GLUniformType<int> { static const GLenum Value = GL_INT; };
+template <> struct GLUniformType<float> { static const GLenum Value = GL_FLOAT; };
+template <> struct GLUniformType<glm::vec2> { static const GLenum Value = GL_FLOAT_VEC2; };
+template <> struct GLUniformType<glm::vec3> { static const GLenum Value = GL_FLOAT_VEC3; };
+template <> struct GLUniformType<glm::vec4> { static const GLenum Value = GL_FLOAT_VEC4; };
+template <> struct GLUniformType<glm::mat3> { static const GLenum Value = GL_FLOAT_MAT3; };
+template <> struct GLUniformType<glm::mat4> { static const GLenum Value = GL_FLOAT_MAT4; };
+
+/*!
+	Uniform handle.
+	Location of a uniform variable resolved once from the active uniforms of a linked program,
+	so setting the value needs neither a string nor a lookup.
+	The handle also keeps the program owning the variable,
+	which is needed to set the value of a stage in a program pipeline.
+	\tparam T C++ type of the value. int is also used for bool and sampler uniforms.
+*/
+template <typename T>
+class GLUniformHandle
+{
+public:
+
+	GLUniformHandle() : program(0), location(-1) {}
+	GLUniformHandle(GLuint program, GLint location) : program(program), location(location) {}
+
+public:
+
+	GLuint Program() const { return program; }
+	GLint Location() const { return location; }
+	bool Valid() const { return location >= 0; }
+
+private:
+
+	GLuint program;
+	GLint location;
+
+};
+
 class GLShader : public GLResource
 {	
 public:
@@ -212,8 +430,88 @@ public:
 	void End();
 	bool Compile(const std::string& path);
 	bool Compile(GLShaderType type, const std::string& path);
+
+	/*!
+		Add a shader source.
+		The sources are compiled in LinkAsync, thus the compilation errors are reported by WaitLink.
+		\param type Type of the shader.
+		\param content Source string.
+	*/
 	bool CompileString(GLShaderType type, const std::string& content);
+
+	/*!
+		Make the program separable (GL_ARB_separate_shader_objects).
+		A separable program can be used as a stage of GLProgramPipeline.
+		Must be called before LinkAsync.
+	*/
+	void SetSeparable(bool separable);
+
+	/*!
+		Compile the sources and link the program.
+		Equivalent to LinkAsync followed by WaitLink.
+	*/
 	bool Link();
+
+	/*!
+		Submit the compilation and linking of the program without waiting for the result.
+		Submitting all programs before waiting for any of them lets the driver
+		compile them in parallel (GL_ARB_parallel_shader_compile) or in the background.
+		If the program cache is enabled, the program is loaded from the cache instead if exists.
+	*/
+	void LinkAsync();
+
+	/*!
+		Check if the program submitted by LinkAsync is ready without blocking.
+		Always true if the parallel shader compilation is not supported.
+	*/
+	bool IsLinkCompleted();
+
+	/*!
+		Wait for the program submitted by LinkAsync.
+		The errors are reported to the logger and the active uniforms are introspected.
+		The program can be used only after this function succeeds.
+		\retval true Succeeded to link the program.
+		\retval false Failed to compile or link the program.
+	*/
+	bool WaitLink();
+
+	/*!
+		Resolve a uniform handle.
+		Intended to be called once after Link, so a misspelled name fails at setup.
+		\param name Name of the uniform. Arrays are referred by the name without the subscript.
+		\param handle Resolved handle.
+		\retval true Succeeded to resolve the handle.
+		\retval false The uniform is not active or the type does not match.
+	*/
+	template <typename T>
+	bool ResolveUniform(const std::string& name, GLUniformHandle<T>& handle)
+	{
+		GLint location;
+		if (!ResolveUniformLocation(name, GLUniformType<T>::Value, location))
+		{
+			return false;
+		}
+
+		handle = GLUniformHandle<T>(id, location);
+		return true;
+	}
+
+	//! Check if the uniform is active in the linked program.
+	bool IsUniformActive(const std::string& name) const;
+
+	// Set uniforms through the handles
+	void SetUniform(GLUniformHandle<glm::mat4> handle, const glm::mat4& mat);
+	void SetUniform(GLUniformHandle<glm::mat3> handle, const glm::mat3& mat);
+	void SetUniform(GLUniformHandle<float> handle, float v);
+	void SetUniform(GLUniformHandle<glm::vec2> handle, const glm::vec2& v);
+	void SetUniform(GLUniformHandle<glm::vec3> handle, const glm::vec3& v);
+	void SetUniform(GLUniformHandle<glm::vec4> handle, const glm::vec4& v);
+	void SetUniform(GLUniformHandle<int> handle, int v);
+	void SetUniform(GLUniformHandle<float> handle, const float* v, int count);
+	void SetUniform(GLUniformHandle<int> handle, const int* v, int count);
+
+	// Set uniforms by the names
+	// The locations are looked up on every call, thus not intended for the per-frame uniforms.
 	void SetUniform(const std::string& name, const glm::mat4& mat);
 	void SetUniform(const std::string& name, const glm::mat3& mat);
 	void SetUniform(const std::string& name, float v);
@@ -222,6 +520,90 @@ public:
 	void SetUniform(const std::string& name, const glm::vec4& v);
 	void SetUniform(const std::string& name, int v);
 
+private:
+
+	bool ResolveUniformLocation(const std::string& name, GLenum type, GLint& location);
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+/*!
+	Program pipeline.
+	Combines the separable programs of the stages (GL_ARB_separate_shader_objects),
+	so that a compiled stage is shared by the pipelines instead of being linked into every program.
+	The uniforms belong to the programs of the stages, thus the values are shared
+	by all pipelines using the same stage. They are set with glProgramUniform,
+	so the pipeline need not to be bound while setting them.
+*/
+class GLProgramPipeline : public GLResource
+{
+public:
+
+	GLProgramPipeline();
+	~GLProgramPipeline();
+
+	void Begin();
+	void End();
+
+	/*!
+		Add a stage.
+		The program is attached in WaitLink after its linking is finished.
+		\param type Type of the stage.
+		\param program Separable program containing the stage.
+	*/
+	void AddStage(GLShaderType type, const std::shared_ptr<GLShader>& program);
+
+	/*!
+		Wait for the programs of the stages and attach them to the pipeline.
+		The pipeline can be used only after this function succeeds.
+		\retval true Succeeded to link all stages.
+		\retval false Failed to compile or link a stage.
+	*/
+	bool WaitLink();
+
+	/*!
+		Resolve a uniform handle from the stage where the uniform is active.
+		\param name Name of the uniform.
+		\param handle Resolved handle.
+		\retval true Succeeded to resolve the handle.
+		\retval false The uniform is not active in any stage or the type does not match.
+	*/
+	template <typename T>
+	bool ResolveUniform(const std::string& name, GLUniformHandle<T>& handle)
+	{
+		auto* program = FindUniformProgram(name);
+		return program != nullptr && program->ResolveUniform(name, handle);
+	}
+
+	// Set uniforms through the handles
+	void SetUniform(GLUniformHandle<glm::mat4> handle, const glm::mat4& mat);
+	void SetUniform(GLUniformHandle<glm::mat3> handle, const glm::mat3& mat);
+	void SetUniform(GLUniformHandle<float> handle, float v);
+	void SetUniform(GLUniformHandle<glm::vec2> handle, const glm::vec2& v);
+	void SetUniform(GLUniformHandle<glm::vec3> handle, const glm::vec3& v);
+	void SetUniform(GLUniformHandle<glm::vec4> handle, const glm::vec4& v);
+	void SetUniform(GLUniformHandle<int> handle, int v);
+	void SetUniform(GLUniformHandle<float> handle, const float* v, int count);
+	void SetUniform(GLUniformHandle<int> handle, const int* v, int count);
+
+	// Set uniforms by the names
+	// The handles are resolved on every call, thus intended only for the constants set at setup.
+	void SetUniform(const std::string& name, const glm::mat4& mat);
+	void SetUniform(const std::string& name, const glm::mat3& mat);
+	void SetUniform(const std::string& name, float v);
+	void SetUniform(const std::string& name, const glm::vec2& v);
+	void SetUniform(const std::string& name, const glm::vec3& v);
+	void SetUniform(const std::string& name, const glm::vec4& v);
+	void SetUniform(const std::string& name, int v);
+
+private:
+
+	GLShader* FindUniformProgram(const std::string& name);
+
 private:
 
 	class Impl;
@@ -252,12 +634,27 @@ public:
 	void Bind(int unit = 0);
 	void Unbind();
 
+protected:
+
+	//! Bind to the unit 0 and select the unit, for the calls modifying the texture bound to the active unit.
+	void BindForEdit();
+
 protected:
 
 	GLenum target;
 
 };
 
+/*!
+	2D texture.
+	The storage is immutable (glTexStorage2D) with the number of levels given by SetLevels,
+	thus the internal format must be a sized one (e.g. GL_RGBA8, GL_R8) or a compressed one.
+	Allocating again replaces the texture object.
+	The mipmaps are not generated implicitly;
+	call GenerateMipmap after the base level is written when the lower levels are sampled.
+	The compressed textures are written with AllocateCompressed and ReplaceCompressed
+	(e.g. the blocks encoded by BlockCompressor), and cannot generate the mipmaps.
+*/
 class GLTexture2D : public GLTexture
 {
 public:
@@ -272,13 +669,44 @@ public:
 	void Replace(const glm::ivec4& rect, GLenum format, GLenum type, const void* data);
 	void Replace(GLPixelUnpackBuffer* pbo, const glm::ivec4& rect, GLenum format, GLenum type, int offset = 0);
 	void GetInternalData(GLenum format, GLenum type, void* data);
+
+	/*!
+		Allocate the storage in a compressed format.
+		\param width Width of the texture.
+		\param height Height of the texture.
+		\param internalFormat Compressed internal format (e.g. GL_COMPRESSED_RGBA_BPTC_UNORM).
+		\param imageSize Size in bytes of the compressed data.
+		\param data Compressed blocks of the base level. Can be null.
+	*/
+	void AllocateCompressed(int width, int height, GLenum internalFormat, int imageSize, const void* data);
+
+	/*!
+		Replace a region of the base level of a compressed texture.
+		\param rect Region (x, y, width, height), aligned to the blocks except on the right and bottom edges.
+		\param imageSize Size in bytes of the compressed data.
+		\param data Compressed blocks of the region in the internal format of the texture.
+	*/
+	void ReplaceCompressed(const glm::ivec4& rect, int imageSize, const void* data);
+
+	//! Generate the levels other than the base level from the base level.
 	void GenerateMipmap();
 	void UpdateTextureParams();
 
+	/*!
+		Get number of levels of the full mipmap chain.
+		\param width Width of the base level.
+		\param height Height of the base level.
+	*/
+	static int FullMipmapLevels(int width, int height);
+
 	int Width() { return width; }
 	int Height() { return height; }
 	GLenum InternalFormat() { return internalFormat; }
 
+	//! Number of levels allocated by Allocate (1 by default). Zero allocates the full mipmap chain.
+	int Levels() { return levels; }
+	void SetLevels(int levels) { this->levels = levels; }
+
 	GLenum MinFilter() { return minFilter; }
 	GLenum MagFilter() { return magFilter; }
 	GLenum Wrap() { return wrap; }
@@ -288,11 +716,17 @@ public:
 	void SetWrap(GLenum wrap) { this->wrap = wrap; }
 	void SetAnisotropicFiltering(bool anisotropicFiltering) { this->anisotropicFiltering = anisotropicFiltering; }
 
+private:
+
+	void AllocateStorage(int width, int height, GLenum internalFormat);
+
 private:
 
 	int width;
 	int height;
 	GLenum internalFormat;
+	int levels;
+	int allocatedLevels;
 	GLenum minFilter;
 	GLenum magFilter;
 	GLenum wrap;
@@ -319,8 +753,34 @@ class GLFrameBuffer : public GLResource
 public:
 
 	GLFrameBuffer(int width, int height, const glm::vec4& clearColor);
+
+	/*!
+		Creates a framebuffer sharing the given depth-stencil buffer.
+		The buffer is not owned by the framebuffer.
+		Framebuffers of the same size can share one depth-stencil buffer
+		because the depth is cleared in Begin.
+		\param depthStencil Depth-stencil buffer of the same size.
+	*/
+	GLFrameBuffer(int width, int height, const glm::vec4& clearColor, GLRenderBuffer* depthStencil);
+
 	~GLFrameBuffer();
 
+	/*!
+		Wrap the default framebuffer of the window.
+		Begin and End clear the back buffer and keep the current viewport,
+		so a pass can render directly to the window through the same interface.
+		\param width Width of the window.
+		\param height Height of the window.
+		\param clearColor Clear color of the back buffer.
+		\return Framebuffer wrapping the default framebuffer.
+	*/
+	static std::unique_ptr<GLFrameBuffer> DefaultFramebuffer(int width, int height, const glm::vec4& clearColor);
+
+private:
+
+	//! Used by DefaultFramebuffer.
+	GLFrameBuffer();
+
 public:
 
 	void Bind();
@@ -328,6 +788,14 @@ public:
 	void AddRenderTarget(GLTexture2D* texture);
 	void Begin();
 	void End();
+	bool IsDefault();
+	void SetClearColor(const glm::vec4& clearColor);
+	int Width();
+	int Height();
+
+private:
+
+	void Create();
 
 private:
 
@@ -350,6 +818,10 @@ FW_NAMESPACE_END
 	"#define TEXCOORD3 5\n" \
 	"#define TEXCOORD4 6\n" \
 	"#define TANGENT 7\n" \
-	"#define COLOR 8\n"
+	"#define COLOR 8\n" \
+	"#define DRAWID 9\n"
+
+// Extensions required by the shaders reading the draw parameters of GLDrawBatch
+#define FW_GL_DRAW_BATCH_EXTENSIONS "#extension GL_ARB_shader_storage_buffer_object : require\n"
 
 #endif // LIB_FW_CORE_GL_H
\ No newline at end of file
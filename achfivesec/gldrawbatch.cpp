@@ -0,0 +1,356 @@
+#include "pch.h"
+#include "gldrawbatch.h"
+#include "gl.h"
+#include "glgeometrypool.h"
+#include "glstreambuffer.h"
+#include "glstatecache.h"
+#include "logger.h"
+
+FW_NAMESPACE_BEGIN
+
+namespace
+{
+
+	// Layouts of the indirect commands defined by ARB_multi_draw_indirect
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	struct DrawArraysIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+
+	// Indirect command being built
+	struct DrawEntry
+	{
+		GLGeometryRange range;
+		GLTexture* texture;
+		int firstInstance;		//!< Index of the parameters of the first instance.
+		int numInstances;
+	};
+
+	bool SameRange(const GLGeometryRange& a, const GLGeometryRange& b)
+	{
+		return
+			a.baseVertex == b.baseVertex &&
+			a.numVertices == b.numVertices &&
+			a.firstIndex == b.firstIndex &&
+			a.numIndices == b.numIndices;
+	}
+
+}
+
+class GLDrawBatch::Impl
+{
+public:
+
+	Impl(int drawDataSize, int maxDraws);
+	~Impl();
+
+public:
+
+	/*!
+		Write the commands and the parameters to the buffer owned by the batch.
+		Used when the stream buffer is not available.
+		The parameters are placed at the beginning so that the offset satisfies the buffer alignment.
+		\param paramsBytes Size of the range of the parameters, which can exceed the written parameters.
+	*/
+	void WriteFallback(int commandsBytes, int paramsBytes, GLuint& commandOffset);
+
+public:
+
+	int drawDataSize;
+	int maxDraws;
+	bool multiDraw;			//!< ARB_multi_draw_indirect is supported.
+	bool storageBuffer;		//!< ARB_shader_storage_buffer_object is supported.
+
+	std::unique_ptr<GLVertexBuffer> drawIDs;
+
+	std::vector<DrawEntry> draws;
+	std::vector<unsigned char> drawData;		//!< Parameters in the order of the instances.
+	int numInstances;
+	std::vector<unsigned char> commands;		//!< Written in Submit.
+
+	GLuint fallbackBuffer;
+	int numSubmittedCalls;
+
+};
+
+GLDrawBatch::Impl::Impl( int drawDataSize, int maxDraws )
+	: drawDataSize(drawDataSize)
+	, maxDraws(maxDraws)
+	, multiDraw(GLEW_ARB_multi_draw_indirect != GL_FALSE)
+	, storageBuffer(GLEW_ARB_shader_storage_buffer_object != GL_FALSE)
+	, numInstances(0)
+	, fallbackBuffer(0)
+	, numSubmittedCalls(0)
+{
+
+}
+
+GLDrawBatch::Impl::~Impl()
+{
+	if (fallbackBuffer != 0)
+	{
+		GLStateCache::BufferDeleted(fallbackBuffer);
+		glDeleteBuffers(1, &fallbackBuffer);
+	}
+}
+
+void GLDrawBatch::Impl::WriteFallback( int commandsBytes, int paramsBytes, GLuint& commandOffset )
+{
+	if (fallbackBuffer == 0)
+	{
+		glGenBuffers(1, &fallbackBuffer);
+	}
+
+	// The storage is orphaned every submission, so the previous draws are not waited for
+	commandOffset = (GLuint)paramsBytes;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, fallbackBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, paramsBytes + commandsBytes, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, drawData.size(), &drawData[0]);
+	if (commandsBytes > 0)
+	{
+		glBufferSubData(GL_COPY_WRITE_BUFFER, commandOffset, commandsBytes, &commands[0]);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// --------------------------------------------------------------------------------
+
+GLDrawBatch::GLDrawBatch( int drawDataSize, int maxDraws )
+	: p(new Impl(drawDataSize, maxDraws))
+{
+	// Draw IDs read at the base instance of the commands
+	std::vector<GLuint> ids(maxDraws);
+	for (int i = 0; i < maxDraws; i++)
+	{
+		ids[i] = (GLuint)i;
+	}
+
+	p->drawIDs.reset(new GLVertexBuffer);
+	p->drawIDs->Allocate(maxDraws * sizeof(GLuint), &ids[0], GL_STATIC_DRAW);
+
+	p->draws.reserve(maxDraws);
+	p->drawData.reserve(maxDraws * drawDataSize);
+
+	if (!p->multiDraw)
+	{
+		FW_LOG_WARN("GL_ARB_multi_draw_indirect is not supported, the draws are issued one by one");
+	}
+
+	if (!p->storageBuffer)
+	{
+		// The parameters are read from a std140 uniform block, whose array stride is a multiple of 16 bytes
+		GLint maxBlockSize;
+		glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+		if (drawDataSize % 16 != 0 || maxDraws * drawDataSize > maxBlockSize)
+		{
+			FW_LOG_ERROR(boost::str(boost::format("Draw parameters do not fit in a uniform block (%d bytes x %d draws)") % drawDataSize % maxDraws));
+		}
+	}
+}
+
+GLDrawBatch::~GLDrawBatch()
+{
+	FW_SAFE_DELETE(p);
+}
+
+void GLDrawBatch::Attach( GLGeometryPool& pool )
+{
+	GLVertexLayout layout(sizeof(GLuint));
+	layout.Add(GLDefaultVertexAttribute::DrawID, GLVertexFormat::UInt, 0);
+	pool.VertexArray()->Add(layout, p->drawIDs.get(), DrawIDBinding, 1);
+}
+
+bool GLDrawBatch::Add( const GLGeometryRange& range, const void* drawData, GLTexture* texture )
+{
+	return Add(range, drawData, 1, texture);
+}
+
+bool GLDrawBatch::Add( const GLGeometryRange& range, const void* drawData, int numInstances, GLTexture* texture )
+{
+	if (p->numInstances + numInstances > p->maxDraws)
+	{
+		FW_LOG_WARN(boost::str(boost::format("Draw batch is full (%d draws)") % p->maxDraws));
+		return false;
+	}
+
+	if (!p->draws.empty() && (p->draws[0].range.numIndices > 0) != (range.numIndices > 0))
+	{
+		FW_LOG_ERROR("Indexed and non-indexed meshes cannot be added to the same submission");
+		return false;
+	}
+
+	// Repeated draws of the same mesh become the instances of one command,
+	// as the parameters of the instances are contiguous
+	if (!p->draws.empty() && p->draws.back().texture == texture && SameRange(p->draws.back().range, range))
+	{
+		p->draws.back().numInstances += numInstances;
+	}
+	else
+	{
+		DrawEntry entry;
+		entry.range = range;
+		entry.texture = texture;
+		entry.firstInstance = p->numInstances;
+		entry.numInstances = numInstances;
+		p->draws.push_back(entry);
+	}
+
+	const auto* data = static_cast<const unsigned char*>(drawData);
+	p->drawData.insert(p->drawData.end(), data, data + numInstances * p->drawDataSize);
+	p->numInstances += numInstances;
+
+	return true;
+}
+
+void GLDrawBatch::Submit( GLenum mode, GLGeometryPool& pool, int binding, GLStreamBuffer* streamBuffer )
+{
+	p->numSubmittedCalls = 0;
+	if (p->draws.empty())
+	{
+		return;
+	}
+
+	bool indexed = p->draws[0].range.numIndices > 0;
+	int numDraws = (int)p->draws.size();
+	int commandSize = indexed ? sizeof(DrawElementsIndirectCommand) : sizeof(DrawArraysIndirectCommand);
+
+	// The commands are only written for the multi-draws
+	int numCommands = p->multiDraw ? numDraws : 0;
+	p->commands.resize(numCommands * commandSize);
+
+	for (int i = 0; i < numCommands; i++)
+	{
+		// The base instance selects the draw ID, which is the index of the parameters
+		const auto& draw = p->draws[i];
+		if (indexed)
+		{
+			auto& command = reinterpret_cast<DrawElementsIndirectCommand*>(&p->commands[0])[i];
+			command.count = (GLuint)draw.range.numIndices;
+			command.instanceCount = (GLuint)draw.numInstances;
+			command.firstIndex = (GLuint)draw.range.firstIndex;
+			command.baseVertex = draw.range.baseVertex;
+			command.baseInstance = (GLuint)draw.firstInstance;
+		}
+		else
+		{
+			auto& command = reinterpret_cast<DrawArraysIndirectCommand*>(&p->commands[0])[i];
+			command.count = (GLuint)draw.range.numVertices;
+			command.instanceCount = (GLuint)draw.numInstances;
+			command.first = (GLuint)draw.range.baseVertex;
+			command.baseInstance = (GLuint)draw.firstInstance;
+		}
+	}
+
+	int commandsBytes = (int)p->commands.size();
+
+	// The uniform block is bound with its declared size of maxDraws parameters
+	int paramsBytes = p->storageBuffer ? p->numInstances * p->drawDataSize : p->maxDraws * p->drawDataSize;
+
+	// Upload the commands and the parameters
+	GLuint commandBuffer = 0, paramsBuffer;
+	GLuint commandOffset = 0, paramsOffset;
+	GLStreamAllocation commandAllocation, paramsAllocation;
+	if (streamBuffer &&
+		(commandsBytes == 0 || streamBuffer->Allocate(commandsBytes, sizeof(GLuint), commandAllocation)) &&
+		streamBuffer->Allocate(paramsBytes, p->storageBuffer ? streamBuffer->StorageBufferAlignment() : streamBuffer->UniformBufferAlignment(), paramsAllocation))
+	{
+		if (commandsBytes > 0)
+		{
+			memcpy(commandAllocation.data, &p->commands[0], commandsBytes);
+			commandBuffer = commandAllocation.buffer;
+			commandOffset = (GLuint)commandAllocation.offset;
+		}
+
+		memcpy(paramsAllocation.data, &p->drawData[0], p->drawData.size());
+		paramsBuffer = paramsAllocation.buffer;
+		paramsOffset = (GLuint)paramsAllocation.offset;
+	}
+	else
+	{
+		p->WriteFallback(commandsBytes, paramsBytes, commandOffset);
+		commandBuffer = p->fallbackBuffer;
+		paramsBuffer = p->fallbackBuffer;
+		paramsOffset = 0;
+	}
+
+	glBindBufferRange(p->storageBuffer ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER, binding, paramsBuffer, paramsOffset, paramsBytes);
+
+	if (p->multiDraw)
+	{
+		// Issue a multi-draw for each run of the draws using the same texture
+		pool.Bind();
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+		for (int begin = 0; begin < numDraws;)
+		{
+			auto* texture = p->draws[begin].texture;
+			int end = begin + 1;
+			while (end < numDraws && p->draws[end].texture == texture)
+			{
+				end++;
+			}
+
+			if (texture)
+			{
+				texture->Bind(0);
+			}
+
+			const GLvoid* offset = (const GLvoid*)(size_t)(commandOffset + begin * commandSize);
+			if (indexed)
+			{
+				glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, offset, end - begin, 0);
+			}
+			else
+			{
+				glMultiDrawArraysIndirect(mode, offset, end - begin, 0);
+			}
+
+			p->numSubmittedCalls++;
+			begin = end;
+		}
+	}
+	else
+	{
+		// Issue the commands one by one, with the same base instances as the indirect commands
+		GLTexture* boundTexture = nullptr;
+		for (const auto& draw : p->draws)
+		{
+			if (draw.texture && draw.texture != boundTexture)
+			{
+				draw.texture->Bind(0);
+				boundTexture = draw.texture;
+			}
+
+			pool.DrawInstanced(mode, draw.range, draw.numInstances, draw.firstInstance);
+			p->numSubmittedCalls++;
+		}
+	}
+
+	p->draws.clear();
+	p->drawData.clear();
+	p->numInstances = 0;
+}
+
+int GLDrawBatch::NumDraws() const
+{
+	return p->numInstances;
+}
+
+int GLDrawBatch::NumSubmittedCalls() const
+{
+	return p->numSubmittedCalls;
+}
+
+FW_NAMESPACE_END
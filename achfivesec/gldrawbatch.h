@@ -0,0 +1,124 @@
+#pragma once
+#ifndef LIB_FW_GL_DRAW_BATCH_H
+#define LIB_FW_GL_DRAW_BATCH_H
+
+#include "common.h"
+#include <GL/glew.h>
+
+FW_NAMESPACE_BEGIN
+
+class GLTexture;
+class GLStreamBuffer;
+class GLGeometryPool;
+struct GLGeometryRange;
+
+/*!
+	Draw batch.
+	Collects the draws of meshes in a geometry pool sharing a program and render states,
+	and submits them with one glMultiDrawElementsIndirect (or glMultiDrawArraysIndirect)
+	for each run of consecutive draws using the same texture,
+	so the cost on the CPU does not grow with the number of draws.
+	The draws are issued in the order of addition, thus the draws should be added grouped by the textures
+	unless the order matters (e.g. blending without depth test).
+	Consecutive draws of the same mesh with the same texture are merged into one instanced command,
+	where each instance reads its own parameters, so repeated objects cost one command
+	instead of one per copy.
+	The parameters of each draw (model matrix etc.) are written to a shader storage buffer
+	instead of the uniforms, and the shaders index the array with the DRAWID vertex attribute.
+	The attribute is an instanced attribute holding 0, 1, 2, ... which is read at the base instance
+	of each indirect command, thus the draw index is available without ARB_shader_draw_parameters.
+	The shaders declare the parameters as follows, where {{DrawBlock}} is given by ShaderUtil::DrawBlock
+	and the parameters are bound to ShaderUtil::DrawBlockBinding.
+
+		{{GLDrawBatchExtensions}}
+		layout (location = DRAWID) in uint drawID;
+		struct DrawParams { mat4 ModelMatrix; };
+		{{DrawBlock}}
+
+	Without ARB_multi_draw_indirect the commands are issued one by one with the same base instances.
+	Without ARB_shader_storage_buffer_object the parameters are bound as a uniform buffer instead,
+	and DrawBlock is declared as a std140 uniform block of maxDraws parameters,
+	whose size must be a multiple of 16 bytes.
+	All functions must be called from the thread owning the OpenGL context.
+*/
+class GLDrawBatch
+{
+public:
+
+	//! Binding point of the vertex buffer of the draw IDs in the vertex arrays.
+	static const int DrawIDBinding = 15;
+
+public:
+
+	/*!
+		Constructor.
+		\param drawDataSize Size in bytes of the parameters of a draw.
+			Must match the std430 array stride of the parameters in the shaders.
+		\param maxDraws Maximum number of draws in a submission, counting each instance.
+	*/
+	GLDrawBatch(int drawDataSize, int maxDraws);
+	~GLDrawBatch();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(GLDrawBatch);
+
+public:
+
+	/*!
+		Attach the draw IDs to the vertex array of a geometry pool.
+		Must be called once for each pool before the draws in the pool are submitted.
+		\param pool Geometry pool.
+	*/
+	void Attach(GLGeometryPool& pool);
+
+	/*!
+		Add a draw.
+		The meshes in a submission must be either all indexed or all without indices.
+		\param range Range of the mesh in the geometry pool.
+		\param drawData Parameters of the draw (drawDataSize bytes).
+		\param texture Texture bound to the unit 0 for the draw. Can be null.
+		\retval true Succeeded to add the draw.
+		\retval false The batch is full, or the mesh is not drawn in the same way as the other draws.
+	*/
+	bool Add(const GLGeometryRange& range, const void* drawData, GLTexture* texture = nullptr);
+
+	/*!
+		Add instances of a mesh.
+		\param range Range of the mesh in the geometry pool.
+		\param drawData Parameters of the instances (drawDataSize bytes each, contiguous).
+		\param numInstances Number of instances.
+		\param texture Texture bound to the unit 0 for the instances. Can be null.
+		\retval true Succeeded to add the instances.
+		\retval false The batch is full, or the mesh is not drawn in the same way as the other draws.
+	*/
+	bool Add(const GLGeometryRange& range, const void* drawData, int numInstances, GLTexture* texture = nullptr);
+
+	/*!
+		Submit the added draws and clear the batch.
+		The program and the render states must be set beforehand.
+		\param mode Primitive type.
+		\param pool Geometry pool holding the meshes, attached with Attach.
+		\param binding Binding point of the shader storage block of the parameters,
+			or of the uniform block without ARB_shader_storage_buffer_object.
+		\param streamBuffer Stream buffer from which the commands and the parameters are allocated.
+			If null or exhausted, they are written to a buffer owned by the batch.
+	*/
+	void Submit(GLenum mode, GLGeometryPool& pool, int binding, GLStreamBuffer* streamBuffer);
+
+	//! Get number of draws (instances) added since the last submission.
+	int NumDraws() const;
+
+	//! Get number of draw calls issued by the last submission.
+	int NumSubmittedCalls() const;
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_GL_DRAW_BATCH_H
@@ -0,0 +1,163 @@
+#include "pch.h"
+#include "glgeometrypool.h"
+#include "logger.h"
+
+FW_NAMESPACE_BEGIN
+
+class GLGeometryPool::Impl
+{
+public:
+
+	Impl(const GLVertexLayout& layout);
+
+public:
+
+	void Reserve(int numVertices, int numIndices);
+
+public:
+
+	GLVertexLayout layout;
+	std::unique_ptr<GLVertexArray> vao;
+	std::unique_ptr<GLVertexBuffer> vb;
+	std::unique_ptr<GLIndexBuffer> ib;
+	int vertexCapacity;
+	int indexCapacity;
+	int numVertices;
+	int numIndices;
+
+};
+
+GLGeometryPool::Impl::Impl( const GLVertexLayout& layout )
+	: layout(layout)
+	, vertexCapacity(0)
+	, indexCapacity(0)
+	, numVertices(0)
+	, numIndices(0)
+{
+
+}
+
+void GLGeometryPool::Impl::Reserve( int requiredVertices, int requiredIndices )
+{
+	// Buffers are replaced by larger ones keeping the contents,
+	// and the new ones are attached to the vertex array.
+	if (requiredVertices > vertexCapacity)
+	{
+		int capacity = std::max(requiredVertices, vertexCapacity * 2);
+		std::unique_ptr<GLVertexBuffer> newVb(new GLVertexBuffer);
+		newVb->Allocate(capacity * layout.Stride(), nullptr, GL_STATIC_DRAW);
+		if (numVertices > 0)
+		{
+			FW_LOG_WARN(boost::str(boost::format("Growing vertex buffer of geometry pool to %d vertices") % capacity));
+			vb->Copy(*newVb, 0, 0, numVertices * layout.Stride());
+		}
+
+		vb = std::move(newVb);
+		vertexCapacity = capacity;
+		vao->Add(layout, vb.get());
+	}
+
+	if (requiredIndices > indexCapacity)
+	{
+		int capacity = std::max(requiredIndices, indexCapacity * 2);
+		std::unique_ptr<GLIndexBuffer> newIb(new GLIndexBuffer);
+		newIb->Allocate(capacity * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
+		if (numIndices > 0)
+		{
+			FW_LOG_WARN(boost::str(boost::format("Growing index buffer of geometry pool to %d indices") % capacity));
+			ib->Copy(*newIb, 0, 0, numIndices * sizeof(GLuint));
+		}
+
+		ib = std::move(newIb);
+		indexCapacity = capacity;
+		vao->SetIndexBuffer(ib.get());
+	}
+}
+
+// --------------------------------------------------------------------------------
+
+GLGeometryPool::GLGeometryPool( const GLVertexLayout& layout, int vertexCapacity, int indexCapacity )
+	: p(new Impl(layout))
+{
+	p->vao.reset(new GLVertexArray);
+	p->Reserve(std::max(1, vertexCapacity), std::max(1, indexCapacity));
+}
+
+GLGeometryPool::~GLGeometryPool()
+{
+	FW_SAFE_DELETE(p);
+}
+
+GLGeometryRange GLGeometryPool::Add( const void* vertices, int numVertices, const GLuint* indices, int numIndices )
+{
+	p->Reserve(p->numVertices + numVertices, p->numIndices + numIndices);
+
+	GLGeometryRange range;
+	range.baseVertex = p->numVertices;
+	range.numVertices = numVertices;
+	range.firstIndex = p->numIndices;
+	range.numIndices = numIndices;
+
+	int stride = p->layout.Stride();
+	p->vb->Replace(p->numVertices * stride, numVertices * stride, vertices);
+	if (numIndices > 0)
+	{
+		p->ib->Replace(p->numIndices * sizeof(GLuint), numIndices * sizeof(GLuint), indices);
+	}
+	p->numVertices += numVertices;
+	p->numIndices += numIndices;
+
+	return range;
+}
+
+GLGeometryRange GLGeometryPool::Add( const void* vertices, int numVertices )
+{
+	return Add(vertices, numVertices, nullptr, 0);
+}
+
+void GLGeometryPool::Bind()
+{
+	p->vao->Bind();
+}
+
+GLVertexArray* GLGeometryPool::VertexArray()
+{
+	return p->vao.get();
+}
+
+void GLGeometryPool::Draw( GLenum mode, const GLGeometryRange& range )
+{
+	// The index buffer is a state of the vertex array, thus no buffer is bound here
+	p->vao->Bind();
+	if (range.numIndices == 0)
+	{
+		glDrawArrays(mode, range.baseVertex, range.numVertices);
+		return;
+	}
+
+	glDrawElementsBaseVertex(mode, range.numIndices, GL_UNSIGNED_INT, (const GLvoid*)(range.firstIndex * sizeof(GLuint)), range.baseVertex);
+}
+
+void GLGeometryPool::DrawInstanced( GLenum mode, const GLGeometryRange& range, int instanceCount, int baseInstance )
+{
+	p->vao->Bind();
+	if (range.numIndices == 0)
+	{
+		glDrawArraysInstancedBaseInstance(mode, range.baseVertex, range.numVertices, instanceCount, baseInstance);
+		return;
+	}
+
+	glDrawElementsInstancedBaseVertexBaseInstance(mode, range.numIndices, GL_UNSIGNED_INT, (const GLvoid*)(range.firstIndex * sizeof(GLuint)), instanceCount, range.baseVertex, baseInstance);
+}
+
+int GLGeometryPool::NumVertices() const
+{
+	return p->numVertices;
+}
+
+int GLGeometryPool::NumIndices() const
+{
+	return p->numIndices;
+}
+
+FW_NAMESPACE_END
@@ -0,0 +1,108 @@
+#pragma once
+#ifndef LIB_FW_GL_GEOMETRY_POOL_H
+#define LIB_FW_GL_GEOMETRY_POOL_H
+
+#include "common.h"
+#include "gl.h"
+
+FW_NAMESPACE_BEGIN
+
+//! Range of a mesh in a geometry pool.
+struct GLGeometryRange
+{
+	int baseVertex;		//!< Index of the first vertex, added to the indices of the mesh.
+	int numVertices;	//!< Number of vertices.
+	int firstIndex;		//!< Position of the first index in the index buffer.
+	int numIndices;		//!< Number of indices. Zero if the mesh is drawn without indices.
+};
+
+/*!
+	Geometry pool.
+	Sub-allocates the vertices and the indices of any number of meshes sharing a vertex layout
+	from one vertex buffer and one index buffer.
+	The buffers are attached to a vertex array once, so drawing a mesh binds nothing
+	but the vertex array and the meshes are drawn with glDrawElementsBaseVertex
+	using the indices relative to their own first vertex.
+	Meshes without indices (e.g. point sprites) are drawn with glDrawArrays.
+	The buffers grow when a mesh does not fit, which copies the contents on the GPU,
+	thus the capacities should be large enough to hold the meshes added at setup.
+*/
+class GLGeometryPool
+{
+public:
+
+	/*!
+		Create the buffers and the vertex array.
+		\param layout Layout of the vertices.
+		\param vertexCapacity Initial number of vertices.
+		\param indexCapacity Initial number of indices.
+	*/
+	GLGeometryPool(const GLVertexLayout& layout, int vertexCapacity, int indexCapacity);
+	~GLGeometryPool();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(GLGeometryPool);
+
+public:
+
+	/*!
+		Add a mesh.
+		\param vertices Vertices in the layout of the pool.
+		\param numVertices Number of vertices.
+		\param indices Indices relative to the first vertex of the mesh.
+		\param numIndices Number of indices.
+		\return Range of the mesh in the pool.
+	*/
+	GLGeometryRange Add(const void* vertices, int numVertices, const GLuint* indices, int numIndices);
+
+	/*!
+		Add a mesh drawn without indices.
+		\param vertices Vertices in the layout of the pool.
+		\param numVertices Number of vertices.
+		\return Range of the mesh in the pool.
+	*/
+	GLGeometryRange Add(const void* vertices, int numVertices);
+
+	//! Bind the vertex array of the pool.
+	void Bind();
+
+	/*!
+		Get the vertex array of the pool.
+		Used to attach per-instance attributes to the binding points other than zero.
+	*/
+	GLVertexArray* VertexArray();
+
+	/*!
+		Draw a mesh.
+		\param mode Primitive type.
+		\param range Range of the mesh returned by Add.
+	*/
+	void Draw(GLenum mode, const GLGeometryRange& range);
+
+	/*!
+		Draw instances of a mesh in one call.
+		The attributes attached with non-zero divisors advance per instance from the base instance.
+		\param mode Primitive type.
+		\param range Range of the mesh returned by Add.
+		\param instanceCount Number of instances.
+		\param baseInstance Index of the first instance in the per-instance attributes.
+	*/
+	void DrawInstanced(GLenum mode, const GLGeometryRange& range, int instanceCount, int baseInstance = 0);
+
+	//! Get number of vertices in the pool.
+	int NumVertices() const;
+
+	//! Get number of indices in the pool.
+	int NumIndices() const;
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_GL_GEOMETRY_POOL_H
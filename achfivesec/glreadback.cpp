@@ -0,0 +1,311 @@
+#include "pch.h"
+#include "glreadback.h"
+#include "gl.h"
+#include "glstatecache.h"
+#include "logger.h"
+#include "profiler.h"
+
+FW_NAMESPACE_BEGIN
+
+namespace
+{
+
+	// Offset alignment of the slots, enough for any texel type
+	const int SlotAlignment = 256;
+
+	enum class SlotState
+	{
+		Free,
+		InFlight,		//!< Copy issued, protected by the fence.
+		Retrieved		//!< Held by the consumer until released.
+	};
+
+	struct Slot
+	{
+		SlotState state;
+		GLsync fence;
+		GLReadbackFrame frame;
+	};
+
+	// Size of a texel in bytes, zero if not supported
+	int BytesPerTexel(GLenum format, GLenum type)
+	{
+		int components = 0;
+		switch (format)
+		{
+			case GL_RED: components = 1; break;
+			case GL_RG: components = 2; break;
+			case GL_RGB: components = 3; break;
+			case GL_RGBA: case GL_BGRA: components = 4; break;
+		}
+
+		switch (type)
+		{
+			case GL_UNSIGNED_BYTE: return components;
+			case GL_HALF_FLOAT: return components * 2;
+			case GL_FLOAT: return components * 4;
+		}
+
+		return 0;
+	}
+
+}
+
+class GLReadback::Impl
+{
+public:
+
+	Impl();
+	~Impl();
+
+public:
+
+	//! Retrieve the oldest readback after its fence is signaled.
+	void Retrieve(GLReadbackFrame& frame);
+
+public:
+
+	GLuint id;
+	unsigned char* mapped;
+	int slotSize;
+
+	std::vector<Slot> slots;
+	std::deque<int> pending;		//!< Slots in flight in the order of Read.
+	int next;						//!< Slot written by the next Read.
+	int numStalls;
+
+	std::mutex mutex;				//!< Protects the states of the slots released by the consumers.
+
+};
+
+GLReadback::Impl::Impl()
+	: id(0)
+	, mapped(nullptr)
+	, slotSize(0)
+	, next(0)
+	, numStalls(0)
+{
+
+}
+
+GLReadback::Impl::~Impl()
+{
+	for (const auto& slot : slots)
+	{
+		if (slot.fence)
+		{
+			glDeleteSync(slot.fence);
+		}
+	}
+
+	if (mapped)
+	{
+		if (GLUtils::DirectStateAccess())
+		{
+			glUnmapNamedBufferEXT(id);
+		}
+		else
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, id);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+	}
+
+	if (id != 0)
+	{
+		GLStateCache::BufferDeleted(id);
+		glDeleteBuffers(1, &id);
+	}
+}
+
+void GLReadback::Impl::Retrieve( GLReadbackFrame& frame )
+{
+	int index = pending.front();
+	pending.pop_front();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& slot = slots[index];
+	glDeleteSync(slot.fence);
+	slot.fence = nullptr;
+	slot.state = SlotState::Retrieved;
+	frame = slot.frame;
+}
+
+// --------------------------------------------------------------------------------
+
+GLReadback::GLReadback()
+	: p(new Impl)
+{
+
+}
+
+GLReadback::~GLReadback()
+{
+	FW_SAFE_DELETE(p);
+}
+
+bool GLReadback::Create( int slotSize, int numSlots )
+{
+	if (!GLEW_ARB_buffer_storage || !GLEW_ARB_sync)
+	{
+		FW_LOG_ERROR("GL_ARB_buffer_storage or GL_ARB_sync is not supported");
+		return false;
+	}
+
+	p->slotSize = (slotSize + SlotAlignment - 1) / SlotAlignment * SlotAlignment;
+	p->next = 0;
+
+	Slot slot;
+	slot.state = SlotState::Free;
+	slot.fence = nullptr;
+	p->slots.assign(numSlots, slot);
+
+	// The storage is immutable and kept mapped until the buffer is deleted.
+	// The client storage is preferred as the data is read by the CPU.
+	int size = p->slotSize * numSlots;
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &p->id);
+	if (GLUtils::DirectStateAccess())
+	{
+		glNamedBufferStorageEXT(p->id, size, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+		p->mapped = (unsigned char*)glMapNamedBufferRangeEXT(p->id, 0, size, flags);
+	}
+	else
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, p->id);
+		glBufferStorage(GL_COPY_READ_BUFFER, size, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+		p->mapped = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, flags);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	if (p->mapped == nullptr)
+	{
+		FW_LOG_ERROR("Failed to map the readback buffer");
+		return false;
+	}
+
+	return true;
+}
+
+bool GLReadback::Read( GLTexture2D& texture, GLenum format, GLenum type, long long tag )
+{
+	int bytesPerTexel = BytesPerTexel(format, type);
+	if (bytesPerTexel == 0)
+	{
+		FW_LOG_ERROR("Unsupported readback format");
+		return false;
+	}
+
+	GLint packAlignment;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+	int rowSize = (texture.Width() * bytesPerTexel + packAlignment - 1) / packAlignment * packAlignment;
+	int size = rowSize * texture.Height();
+	if (size > p->slotSize)
+	{
+		FW_LOG_ERROR(boost::str(boost::format("Readback is too large (%d bytes requested, %d bytes per slot)") % size % p->slotSize));
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(p->mutex);
+		if (p->slots[p->next].state != SlotState::Free)
+		{
+			return false;
+		}
+	}
+
+	// The copy into the pack buffer is done by the GPU after the preceding commands,
+	// without synchronizing the pipeline
+	int offset = p->next * p->slotSize;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, p->id);
+	texture.GetInternalData(format, type, (void*)(size_t)offset);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	auto& slot = p->slots[p->next];
+	slot.state = SlotState::InFlight;
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.frame.slot = p->next;
+	slot.frame.width = texture.Width();
+	slot.frame.height = texture.Height();
+	slot.frame.rowSize = rowSize;
+	slot.frame.data = p->mapped + offset;
+	slot.frame.tag = tag;
+
+	p->pending.push_back(p->next);
+	p->next = (p->next + 1) % (int)p->slots.size();
+
+	return true;
+}
+
+bool GLReadback::Poll( GLReadbackFrame& frame )
+{
+	if (p->pending.empty())
+	{
+		return false;
+	}
+
+	// Flushed so that the fence is eventually signaled without Wait
+	GLenum result = glClientWaitSync(p->slots[p->pending.front()].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (result == GL_TIMEOUT_EXPIRED)
+	{
+		return false;
+	}
+
+	if (result == GL_WAIT_FAILED)
+	{
+		FW_LOG_ERROR("Failed to wait for the fence of the readback");
+	}
+
+	p->Retrieve(frame);
+	return true;
+}
+
+bool GLReadback::Wait( GLReadbackFrame& frame )
+{
+	if (p->pending.empty())
+	{
+		return false;
+	}
+
+	if (Poll(frame))
+	{
+		return true;
+	}
+
+	FW_PROFILE_SCOPE("Readback.Wait");
+	p->numStalls++;
+
+	const GLuint64 timeout = 1000000000;
+	GLenum result;
+	do
+	{
+		result = glClientWaitSync(p->slots[p->pending.front()].fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+	} while (result == GL_TIMEOUT_EXPIRED);
+
+	if (result == GL_WAIT_FAILED)
+	{
+		FW_LOG_ERROR("Failed to wait for the fence of the readback");
+	}
+
+	p->Retrieve(frame);
+	return true;
+}
+
+void GLReadback::Release( const GLReadbackFrame& frame )
+{
+	std::lock_guard<std::mutex> lock(p->mutex);
+	p->slots[frame.slot].state = SlotState::Free;
+}
+
+int GLReadback::NumPending() const
+{
+	return (int)p->pending.size();
+}
+
+int GLReadback::NumStalls() const
+{
+	return p->numStalls;
+}
+
+FW_NAMESPACE_END
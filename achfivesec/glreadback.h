@@ -0,0 +1,106 @@
+#pragma once
+#ifndef LIB_FW_GL_READBACK_H
+#define LIB_FW_GL_READBACK_H
+
+#include "common.h"
+#include <GL/glew.h>
+
+FW_NAMESPACE_BEGIN
+
+class GLTexture2D;
+
+//! Finished readback.
+struct GLReadbackFrame
+{
+	int slot;			//!< Index of the slot.
+	int width;			//!< Width of the image.
+	int height;			//!< Height of the image.
+	int rowSize;		//!< Size in bytes of a row, aligned as specified by GL_PACK_ALIGNMENT.
+	const void* data;	//!< Pointer to the mapped memory of the slot, from the bottom row. Valid until Release.
+	long long tag;		//!< Value given to Read (e.g. frame number).
+};
+
+/*!
+	Asynchronous readback.
+	Copies textures (e.g. rendered frames) into pixel pack buffers without waiting for the GPU,
+	and hands the data to the CPU a few frames later.
+	The buffer is allocated with ARB_buffer_storage, kept mapped persistently and coherently,
+	and divided into a ring of slots.
+	A slot goes through the copy protected by a fence (Read), the retrieval once the fence is signaled (Poll or Wait),
+	and the release by the consumer (Release), after which it is reused.
+	The readbacks are retrieved in the order of Read.
+	Read, Poll and Wait must be called from the thread owning the OpenGL context,
+	whereas the data of a retrieved slot can be read and released from any thread.
+*/
+class GLReadback
+{
+public:
+
+	GLReadback();
+	~GLReadback();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(GLReadback);
+
+public:
+
+	/*!
+		Create the buffer.
+		\param slotSize Maximum size in bytes of a readback.
+		\param numSlots Number of readbacks which can be in flight or held by the consumers.
+		\retval true Succeeded to create the buffer.
+		\retval false ARB_buffer_storage is not supported.
+	*/
+	bool Create(int slotSize, int numSlots = 4);
+
+	/*!
+		Copy the base level of a texture into the next slot.
+		\param texture Texture.
+		\param format Format of the data (GL_RED, GL_RG, GL_RGB, GL_RGBA, GL_BGRA).
+		\param type Type of the data (GL_UNSIGNED_BYTE, GL_HALF_FLOAT, GL_FLOAT).
+		\param tag Value returned with the data.
+		\retval true Succeeded to issue the copy.
+		\retval false The next slot is not released yet, or the data does not fit in a slot.
+	*/
+	bool Read(GLTexture2D& texture, GLenum format, GLenum type, long long tag);
+
+	/*!
+		Retrieve the oldest readback if the copy is finished, without waiting.
+		\param frame Retrieved readback.
+		\retval true Retrieved a readback.
+		\retval false No readback is finished.
+	*/
+	bool Poll(GLReadbackFrame& frame);
+
+	/*!
+		Retrieve the oldest readback, waiting for the copy to finish.
+		\param frame Retrieved readback.
+		\retval true Retrieved a readback.
+		\retval false No readback is in flight.
+	*/
+	bool Wait(GLReadbackFrame& frame);
+
+	/*!
+		Release the slot of a retrieved readback.
+		Can be called from any thread.
+		\param frame Retrieved readback.
+	*/
+	void Release(const GLReadbackFrame& frame);
+
+	//! Get number of readbacks in flight, not retrieved yet.
+	int NumPending() const;
+
+	//! Get number of calls to Wait which actually waited for the GPU.
+	int NumStalls() const;
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_GL_READBACK_H
@@ -0,0 +1,161 @@
+#include "pch.h"
+#include "glshaderregistry.h"
+#include "logger.h"
+#include <map>
+
+FW_NAMESPACE_BEGIN
+
+class GLShaderRegistry::Impl
+{
+public:
+
+	Impl();
+
+public:
+
+	unsigned long long Hash(GLShaderType type, const std::string& source);
+	std::shared_ptr<GLShader> Stage(GLShaderType type, const std::string& source);
+	std::shared_ptr<GLProgramPipeline> Pipeline(const std::vector<std::pair<GLShaderType, const std::string*>>& sources);
+
+public:
+
+	typedef boost::unordered_map<unsigned long long, std::shared_ptr<GLShader>> StageMap;
+	StageMap stages;
+
+	// Pipelines are keyed by the names of the stage programs
+	typedef std::map<std::vector<GLuint>, std::shared_ptr<GLProgramPipeline>> PipelineMap;
+	PipelineMap pipelines;
+
+	int numStageRequests;
+
+};
+
+GLShaderRegistry::Impl::Impl()
+	: numStageRequests(0)
+{
+
+}
+
+unsigned long long GLShaderRegistry::Impl::Hash( GLShaderType type, const std::string& source )
+{
+	// 64-bit FNV-1a
+	unsigned long long hash = 14695981039346656037ULL;
+	auto update = [&hash](unsigned char c)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	};
+
+	auto typeValue = (unsigned int)type;
+	for (int i = 0; i < 4; i++)
+	{
+		update((unsigned char)(typeValue >> (i * 8)));
+	}
+
+	for (auto c : source)
+	{
+		update((unsigned char)c);
+	}
+
+	return hash;
+}
+
+std::shared_ptr<GLShader> GLShaderRegistry::Impl::Stage( GLShaderType type, const std::string& source )
+{
+	auto hash = Hash(type, source);
+	numStageRequests++;
+
+	auto it = stages.find(hash);
+	if (it != stages.end())
+	{
+		return it->second;
+	}
+
+	// Compiled in the background until the first WaitLink
+	auto program = std::make_shared<GLShader>();
+	program->CompileString(type, source);
+	program->SetSeparable(true);
+	program->LinkAsync();
+	stages[hash] = program;
+
+	return program;
+}
+
+std::shared_ptr<GLProgramPipeline> GLShaderRegistry::Impl::Pipeline( const std::vector<std::pair<GLShaderType, const std::string*>>& sources )
+{
+	std::vector<std::pair<GLShaderType, std::shared_ptr<GLShader>>> programs;
+	std::vector<GLuint> key;
+	for (const auto& source : sources)
+	{
+		auto program = Stage(source.first, *source.second);
+		programs.push_back(std::make_pair(source.first, program));
+		key.push_back(program->ID());
+	}
+
+	auto it = pipelines.find(key);
+	if (it != pipelines.end())
+	{
+		return it->second;
+	}
+
+	auto pipeline = std::make_shared<GLProgramPipeline>();
+	for (const auto& program : programs)
+	{
+		pipeline->AddStage(program.first, program.second);
+	}
+
+	pipelines[key] = pipeline;
+	return pipeline;
+}
+
+// --------------------------------------------------------------------------------
+
+GLShaderRegistry::GLShaderRegistry()
+	: p(new Impl)
+{
+
+}
+
+GLShaderRegistry::~GLShaderRegistry()
+{
+	FW_SAFE_DELETE(p);
+}
+
+std::shared_ptr<GLShader> GLShaderRegistry::Stage( GLShaderType type, const std::string& source )
+{
+	return p->Stage(type, source);
+}
+
+std::shared_ptr<GLProgramPipeline> GLShaderRegistry::Pipeline( const std::string& vs, const std::string& fs )
+{
+	std::vector<std::pair<GLShaderType, const std::string*>> sources;
+	sources.push_back(std::make_pair(GLShaderType::VertexShader, &vs));
+	sources.push_back(std::make_pair(GLShaderType::FragmentShader, &fs));
+	return p->Pipeline(sources);
+}
+
+std::shared_ptr<GLProgramPipeline> GLShaderRegistry::Pipeline( const std::string& vs, const std::string& gs, const std::string& fs )
+{
+	std::vector<std::pair<GLShaderType, const std::string*>> sources;
+	sources.push_back(std::make_pair(GLShaderType::VertexShader, &vs));
+	sources.push_back(std::make_pair(GLShaderType::GeometryShader, &gs));
+	sources.push_back(std::make_pair(GLShaderType::FragmentShader, &fs));
+	return p->Pipeline(sources);
+}
+
+int GLShaderRegistry::NumStages() const
+{
+	return (int)p->stages.size();
+}
+
+int GLShaderRegistry::NumStageRequests() const
+{
+	return p->numStageRequests;
+}
+
+int GLShaderRegistry::NumPipelines() const
+{
+	return (int)p->pipelines.size();
+}
+
+FW_NAMESPACE_END
@@ -0,0 +1,76 @@
+#pragma once
+#ifndef LIB_FW_GL_SHADER_REGISTRY_H
+#define LIB_FW_GL_SHADER_REGISTRY_H
+
+#include "common.h"
+#include "gl.h"
+
+FW_NAMESPACE_BEGIN
+
+/*!
+	Shader registry.
+	Shares the compiled stages and the program pipelines among the scenes.
+	Each stage is compiled once into a separable program keyed by the hash of its type and source,
+	and the pipelines are keyed by their stages, so a source used by several scenes
+	(e.g. the vertex shader of the full screen quad) is compiled and held by the driver only once.
+	The stages are submitted with GLShader::LinkAsync when first requested,
+	thus the pipelines must be collected with GLProgramPipeline::WaitLink before use.
+	Requires GL_ARB_separate_shader_objects.
+*/
+class GLShaderRegistry
+{
+public:
+
+	GLShaderRegistry();
+	~GLShaderRegistry();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(GLShaderRegistry);
+
+public:
+
+	/*!
+		Get a stage.
+		\param type Type of the stage.
+		\param source Expanded source string.
+		\return Separable program of the stage, shared with the other requests of the same source.
+	*/
+	std::shared_ptr<GLShader> Stage(GLShaderType type, const std::string& source);
+
+	/*!
+		Get a pipeline of the vertex and fragment stages.
+		\param vs Expanded source of the vertex shader.
+		\param fs Expanded source of the fragment shader.
+		\return Pipeline shared with the other requests of the same stages.
+	*/
+	std::shared_ptr<GLProgramPipeline> Pipeline(const std::string& vs, const std::string& fs);
+
+	/*!
+		Get a pipeline of the vertex, geometry and fragment stages.
+		\param vs Expanded source of the vertex shader.
+		\param gs Expanded source of the geometry shader.
+		\param fs Expanded source of the fragment shader.
+		\return Pipeline shared with the other requests of the same stages.
+	*/
+	std::shared_ptr<GLProgramPipeline> Pipeline(const std::string& vs, const std::string& gs, const std::string& fs);
+
+	//! Get number of the compiled stages.
+	int NumStages() const;
+
+	//! Get number of the stages requested including the shared ones.
+	int NumStageRequests() const;
+
+	//! Get number of the pipelines.
+	int NumPipelines() const;
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_GL_SHADER_REGISTRY_H
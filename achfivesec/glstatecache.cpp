@@ -0,0 +1,449 @@
+#include "pch.h"
+#include "glstatecache.h"
+
+namespace
+{
+	// Number of texture units tracked.
+	// Units beyond this are bound without the cache.
+	const int MaxTextureUnits = 32;
+
+	template <typename T>
+	struct CachedValue
+	{
+		CachedValue() : valid(false) {}
+		T value;
+		bool valid;		//!< False if the state in GL is unknown.
+	};
+}
+
+FW_NAMESPACE_BEGIN
+
+struct GLRenderState
+{
+	CachedValue<bool> blend;
+	CachedValue<bool> depthTest;
+	CachedValue<bool> cullFace;
+	CachedValue<std::pair<GLenum, GLenum>> blendFunc;
+	CachedValue<GLenum> depthFunc;
+	CachedValue<bool> depthMask;
+	CachedValue<GLenum> cullFaceMode;
+};
+
+class GLStateCacheImpl
+{
+public:
+
+	static GLStateCacheImpl& Instance()
+	{
+		static GLStateCacheImpl instance;
+		return instance;
+	}
+
+public:
+
+	GLStateCacheImpl()
+	{
+		current.issuedCalls = current.avoidedCalls = 0;
+		last.issuedCalls = last.avoidedCalls = 0;
+	}
+
+public:
+
+	// Update the cached value and check if the GL call is needed
+	template <typename T>
+	bool Update(CachedValue<T>& cached, const T& value)
+	{
+		if (cached.valid && cached.value == value)
+		{
+			current.avoidedCalls++;
+			return false;
+		}
+
+		cached.value = value;
+		cached.valid = true;
+		current.issuedCalls++;
+		return true;
+	}
+
+	void Uncached()
+	{
+		current.issuedCalls++;
+	}
+
+	void ActiveTexture(int unit)
+	{
+		if (Update(activeTexture, unit))
+		{
+			glActiveTexture((GLenum)(GL_TEXTURE0 + unit));
+		}
+	}
+
+	CachedValue<bool>* Capability(GLenum cap)
+	{
+		switch (cap)
+		{
+			case GL_BLEND:		return &state.blend;
+			case GL_DEPTH_TEST:	return &state.depthTest;
+			case GL_CULL_FACE:	return &state.cullFace;
+			default:			return nullptr;
+		}
+	}
+
+	void SetCapability(GLenum cap, bool enable)
+	{
+		auto* cached = Capability(cap);
+		if (cached == nullptr)
+		{
+			Uncached();
+			enable ? glEnable(cap) : glDisable(cap);
+		}
+		else if (Update(*cached, enable))
+		{
+			enable ? glEnable(cap) : glDisable(cap);
+		}
+	}
+
+	// Query the unknown render states from GL
+	void QueryState()
+	{
+		const GLenum caps[] = { GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE };
+		for (auto cap : caps)
+		{
+			auto* cached = Capability(cap);
+			if (!cached->valid)
+			{
+				cached->value = glIsEnabled(cap) != GL_FALSE;
+				cached->valid = true;
+			}
+		}
+
+		if (!state.blendFunc.valid)
+		{
+			GLint src, dst;
+			glGetIntegerv(GL_BLEND_SRC_RGB, &src);
+			glGetIntegerv(GL_BLEND_DST_RGB, &dst);
+			state.blendFunc.value = std::make_pair((GLenum)src, (GLenum)dst);
+			state.blendFunc.valid = true;
+		}
+
+		if (!state.depthFunc.valid)
+		{
+			GLint func;
+			glGetIntegerv(GL_DEPTH_FUNC, &func);
+			state.depthFunc.value = (GLenum)func;
+			state.depthFunc.valid = true;
+		}
+
+		if (!state.depthMask.valid)
+		{
+			GLboolean mask;
+			glGetBooleanv(GL_DEPTH_WRITEMASK, &mask);
+			state.depthMask.value = mask != GL_FALSE;
+			state.depthMask.valid = true;
+		}
+
+		if (!state.cullFaceMode.valid)
+		{
+			GLint mode;
+			glGetIntegerv(GL_CULL_FACE_MODE, &mode);
+			state.cullFaceMode.value = (GLenum)mode;
+			state.cullFaceMode.valid = true;
+		}
+	}
+
+public:
+
+	// Bindings
+	CachedValue<GLuint> program;
+	CachedValue<GLuint> programPipeline;
+	CachedValue<GLuint> vertexArray;
+	CachedValue<int> activeTexture;
+	CachedValue<GLuint> textures[MaxTextureUnits];
+	CachedValue<GLuint> drawFramebuffer;
+
+	// Element buffers are the states of the vertex arrays
+	std::unordered_map<GLuint, CachedValue<GLuint>> elementBuffers;
+
+	// Render states
+	GLRenderState state;
+	std::vector<GLRenderState> stateStack;
+
+	GLStateCacheStats current;
+	GLStateCacheStats last;
+
+};
+
+// --------------------------------------------------------------------------------
+
+void GLStateCache::UseProgram( GLuint program )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.Update(p.program, program))
+	{
+		glUseProgram(program);
+	}
+}
+
+void GLStateCache::BindProgramPipeline( GLuint pipeline )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.Update(p.programPipeline, pipeline))
+	{
+		glBindProgramPipeline(pipeline);
+	}
+}
+
+void GLStateCache::BindVertexArray( GLuint vertexArray )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.Update(p.vertexArray, vertexArray))
+	{
+		glBindVertexArray(vertexArray);
+	}
+}
+
+void GLStateCache::BindElementBuffer( GLuint buffer )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (!p.vertexArray.valid)
+	{
+		// Unknown vertex array
+		p.Uncached();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+	}
+	else if (p.Update(p.elementBuffers[p.vertexArray.value], buffer))
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+	}
+}
+
+void GLStateCache::BindTexture( int unit, GLenum target, GLuint texture )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (target != GL_TEXTURE_2D || unit >= MaxTextureUnits)
+	{
+		p.ActiveTexture(unit);
+		p.Uncached();
+		glBindTexture(target, texture);
+	}
+	else if (p.Update(p.textures[unit], texture))
+	{
+		// Selecting the unit is also avoided if the texture is already bound
+		p.ActiveTexture(unit);
+		glBindTexture(target, texture);
+	}
+}
+
+void GLStateCache::BindTextureForEdit( int unit, GLenum target, GLuint texture )
+{
+	// BindTexture skips selecting the unit if the texture is already bound
+	GLStateCacheImpl::Instance().ActiveTexture(unit);
+	BindTexture(unit, target, texture);
+}
+
+void GLStateCache::BindDrawFramebuffer( GLuint framebuffer )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.Update(p.drawFramebuffer, framebuffer))
+	{
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+	}
+}
+
+void GLStateCache::UnbindTexture( GLuint texture )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	for (int unit = 0; unit < MaxTextureUnits; unit++)
+	{
+		if (p.textures[unit].valid && p.textures[unit].value == texture)
+		{
+			BindTexture(unit, GL_TEXTURE_2D, 0);
+		}
+	}
+}
+
+void GLStateCache::Enable( GLenum cap )
+{
+	GLStateCacheImpl::Instance().SetCapability(cap, true);
+}
+
+void GLStateCache::Disable( GLenum cap )
+{
+	GLStateCacheImpl::Instance().SetCapability(cap, false);
+}
+
+void GLStateCache::BlendFunc( GLenum src, GLenum dst )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.Update(p.state.blendFunc, std::make_pair(src, dst)))
+	{
+		glBlendFunc(src, dst);
+	}
+}
+
+void GLStateCache::DepthFunc( GLenum func )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.Update(p.state.depthFunc, func))
+	{
+		glDepthFunc(func);
+	}
+}
+
+void GLStateCache::DepthMask( bool mask )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.Update(p.state.depthMask, mask))
+	{
+		glDepthMask(mask ? GL_TRUE : GL_FALSE);
+	}
+}
+
+void GLStateCache::CullFace( GLenum mode )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.Update(p.state.cullFaceMode, mode))
+	{
+		glCullFace(mode);
+	}
+}
+
+void GLStateCache::PushState()
+{
+	auto& p = GLStateCacheImpl::Instance();
+	p.QueryState();
+	p.stateStack.push_back(p.state);
+}
+
+void GLStateCache::PopState()
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.stateStack.empty())
+	{
+		return;
+	}
+
+	auto saved = p.stateStack.back();
+	p.stateStack.pop_back();
+
+	p.SetCapability(GL_BLEND, saved.blend.value);
+	p.SetCapability(GL_DEPTH_TEST, saved.depthTest.value);
+	p.SetCapability(GL_CULL_FACE, saved.cullFace.value);
+	BlendFunc(saved.blendFunc.value.first, saved.blendFunc.value.second);
+	DepthFunc(saved.depthFunc.value);
+	DepthMask(saved.depthMask.value);
+	CullFace(saved.cullFaceMode.value);
+}
+
+void GLStateCache::ProgramDeleted( GLuint program )
+{
+	// A program in use is not deleted until it is unbound
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.program.valid && p.program.value == program)
+	{
+		UseProgram(0);
+	}
+}
+
+void GLStateCache::ProgramPipelineDeleted( GLuint pipeline )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.programPipeline.valid && p.programPipeline.value == pipeline)
+	{
+		p.programPipeline.value = 0;
+	}
+}
+
+void GLStateCache::VertexArrayDeleted( GLuint vertexArray )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.vertexArray.valid && p.vertexArray.value == vertexArray)
+	{
+		p.vertexArray.value = 0;
+	}
+
+	p.elementBuffers.erase(vertexArray);
+}
+
+void GLStateCache::BufferDeleted( GLuint buffer )
+{
+	// The name can be reused while the vertex arrays not bound still refer to the buffer
+	auto& p = GLStateCacheImpl::Instance();
+	for (auto& elementBuffer : p.elementBuffers)
+	{
+		if (elementBuffer.second.value == buffer)
+		{
+			elementBuffer.second.valid = false;
+		}
+	}
+}
+
+void GLStateCache::TextureDeleted( GLuint texture )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	for (auto& cached : p.textures)
+	{
+		if (cached.valid && cached.value == texture)
+		{
+			cached.value = 0;
+		}
+	}
+}
+
+void GLStateCache::FramebufferDeleted( GLuint framebuffer )
+{
+	auto& p = GLStateCacheImpl::Instance();
+	if (p.drawFramebuffer.valid && p.drawFramebuffer.value == framebuffer)
+	{
+		p.drawFramebuffer.value = 0;
+	}
+}
+
+void GLStateCache::Reset()
+{
+	auto& p = GLStateCacheImpl::Instance();
+	UseProgram(0);
+	BindProgramPipeline(0);
+	BindVertexArray(0);
+	for (int unit = 0; unit < MaxTextureUnits; unit++)
+	{
+		if (p.textures[unit].valid && p.textures[unit].value != 0)
+		{
+			BindTexture(unit, GL_TEXTURE_2D, 0);
+		}
+	}
+
+	// Fixed function rendering uses the first unit
+	p.ActiveTexture(0);
+}
+
+void GLStateCache::Invalidate()
+{
+	auto& p = GLStateCacheImpl::Instance();
+	p.program.valid = false;
+	p.programPipeline.valid = false;
+	p.vertexArray.valid = false;
+	p.activeTexture.valid = false;
+	for (auto& cached : p.textures)
+	{
+		cached.valid = false;
+	}
+	p.drawFramebuffer.valid = false;
+	p.elementBuffers.clear();
+	p.state = GLRenderState();
+}
+
+void GLStateCache::BeginFrame()
+{
+	auto& p = GLStateCacheImpl::Instance();
+	p.last = p.current;
+	p.current.issuedCalls = 0;
+	p.current.avoidedCalls = 0;
+}
+
+GLStateCacheStats GLStateCache::LastFrameStats()
+{
+	return GLStateCacheImpl::Instance().last;
+}
+
+FW_NAMESPACE_END
@@ -0,0 +1,120 @@
+#pragma once
+#ifndef LIB_FW_GL_STATE_CACHE_H
+#define LIB_FW_GL_STATE_CACHE_H
+
+#include "common.h"
+#include <GL/glew.h>
+
+FW_NAMESPACE_BEGIN
+
+//! Number of GL calls issued and avoided by the state cache in a frame.
+struct GLStateCacheStats
+{
+	int issuedCalls;
+	int avoidedCalls;
+};
+
+/*!
+	OpenGL state cache.
+	Shadows the bindings (program, vertex array, element buffer, 2D textures, draw framebuffer)
+	and the render states (blend, depth, cull) of the context,
+	and issues the GL calls only if they actually change the state.
+	The wrappers in gl.h go through the cache, so the bindings are left as they are
+	after a resource is used and are replaced lazily by the next one.
+	Code modifying the states without the cache (e.g. drawing with SFML)
+	must be enclosed with Reset and Invalidate.
+	All functions must be called from the thread owning the OpenGL context.
+*/
+class GLStateCache
+{
+private:
+
+	GLStateCache();
+	~GLStateCache();
+
+	FW_DISABLE_COPY_AND_MOVE(GLStateCache);
+
+public:
+
+	// Bindings
+	static void UseProgram(GLuint program);
+
+	//! Bind a program pipeline. Takes effect only while no program is in use.
+	static void BindProgramPipeline(GLuint pipeline);
+
+	static void BindVertexArray(GLuint vertexArray);
+
+	//! Bind an element buffer to the current vertex array.
+	static void BindElementBuffer(GLuint buffer);
+
+	static void BindTexture(int unit, GLenum target, GLuint texture);
+
+	/*!
+		Bind a texture and select the unit even if the texture is already bound to it.
+		Used before the calls operating on the texture of the active unit (glTexSubImage2D etc.).
+	*/
+	static void BindTextureForEdit(int unit, GLenum target, GLuint texture);
+	static void BindDrawFramebuffer(GLuint framebuffer);
+
+	/*!
+		Unbind a texture from all units it is bound to.
+		Used before the texture is rendered into to avoid the feedback loop.
+	*/
+	static void UnbindTexture(GLuint texture);
+
+	// Render states
+	// Capabilities other than GL_BLEND, GL_DEPTH_TEST and GL_CULL_FACE are not cached.
+	static void Enable(GLenum cap);
+	static void Disable(GLenum cap);
+	static void BlendFunc(GLenum src, GLenum dst);
+	static void DepthFunc(GLenum func);
+	static void DepthMask(bool mask);
+	static void CullFace(GLenum mode);
+
+	/*!
+		Save the render states.
+		The replacement of glPushAttrib for the cached states.
+	*/
+	static void PushState();
+
+	/*!
+		Restore the render states saved by PushState.
+		Only the states changed since PushState are restored.
+	*/
+	static void PopState();
+
+	// Notifications from the wrappers.
+	// Deleting a bound object resets the binding in GL, so the cache follows it.
+	static void ProgramDeleted(GLuint program);
+	static void ProgramPipelineDeleted(GLuint pipeline);
+	static void VertexArrayDeleted(GLuint vertexArray);
+	static void BufferDeleted(GLuint buffer);
+	static void TextureDeleted(GLuint texture);
+	static void FramebufferDeleted(GLuint framebuffer);
+
+	/*!
+		Bind zero to the program, vertex array and textures.
+		Call before handing the context to code not using the cache.
+	*/
+	static void Reset();
+
+	/*!
+		Forget the cached states.
+		Call after code not using the cache has modified the states.
+	*/
+	static void Invalidate();
+
+	/*!
+		Begin a frame.
+		The counters of the current frame are moved to the last frame.
+	*/
+	static void BeginFrame();
+
+	//! Get the counters of the last frame.
+	static GLStateCacheStats LastFrameStats();
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_GL_STATE_CACHE_H
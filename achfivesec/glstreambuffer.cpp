@@ -0,0 +1,242 @@
+#include "pch.h"
+#include "glstreambuffer.h"
+#include "gl.h"
+#include "glstatecache.h"
+#include "logger.h"
+#include "profiler.h"
+
+FW_NAMESPACE_BEGIN
+
+class GLStreamBuffer::Impl
+{
+public:
+
+	Impl();
+	~Impl();
+
+public:
+
+	void WaitFence(GLsync fence);
+
+public:
+
+	GLuint id;
+	unsigned char* mapped;
+	int frameSize;
+	int uniformBufferAlignment;
+	int storageBufferAlignment;
+
+	std::vector<GLsync> fences;		//!< Fence of each region, null if the region is not in use.
+	int region;						//!< Region of the current frame.
+	int head;						//!< Offset of the next allocation in the region.
+	bool exhausted;					//!< True if an allocation failed in the current frame.
+	int numStalls;
+
+};
+
+GLStreamBuffer::Impl::Impl()
+	: id(0)
+	, mapped(nullptr)
+	, frameSize(0)
+	, uniformBufferAlignment(256)
+	, storageBufferAlignment(256)
+	, region(0)
+	, head(0)
+	, exhausted(false)
+	, numStalls(0)
+{
+
+}
+
+GLStreamBuffer::Impl::~Impl()
+{
+	for (auto fence : fences)
+	{
+		if (fence)
+		{
+			glDeleteSync(fence);
+		}
+	}
+
+	if (mapped)
+	{
+		if (GLUtils::DirectStateAccess())
+		{
+			glUnmapNamedBufferEXT(id);
+		}
+		else
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+	}
+
+	if (id != 0)
+	{
+		GLStateCache::BufferDeleted(id);
+		glDeleteBuffers(1, &id);
+	}
+}
+
+void GLStreamBuffer::Impl::WaitFence( GLsync fence )
+{
+	// Check without waiting first to count the stalls
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if (result == GL_TIMEOUT_EXPIRED)
+	{
+		FW_PROFILE_SCOPE("StreamBuffer.Wait");
+		numStalls++;
+
+		// Flush the commands so that the fence is eventually signaled
+		const GLuint64 timeout = 1000000000;
+		do
+		{
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		} while (result == GL_TIMEOUT_EXPIRED);
+	}
+
+	if (result == GL_WAIT_FAILED)
+	{
+		FW_LOG_ERROR("Failed to wait for the fence of the stream buffer");
+	}
+
+	glDeleteSync(fence);
+}
+
+// --------------------------------------------------------------------------------
+
+GLStreamBuffer::GLStreamBuffer()
+	: p(new Impl)
+{
+
+}
+
+GLStreamBuffer::~GLStreamBuffer()
+{
+	FW_SAFE_DELETE(p);
+}
+
+bool GLStreamBuffer::Create( int frameSize, int framesInFlight )
+{
+	if (!GLEW_ARB_buffer_storage || !GLEW_ARB_sync)
+	{
+		FW_LOG_ERROR("GL_ARB_buffer_storage or GL_ARB_sync is not supported");
+		return false;
+	}
+
+	GLint alignment;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	p->uniformBufferAlignment = std::max(1, (int)alignment);
+
+	alignment = 0;
+	if (GLEW_ARB_shader_storage_buffer_object)
+	{
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	}
+	p->storageBufferAlignment = std::max(1, (int)alignment);
+
+	// Regions start at the uniform and storage buffer alignments
+	int regionAlignment = std::max(p->uniformBufferAlignment, p->storageBufferAlignment);
+	p->frameSize = (frameSize + regionAlignment - 1) / regionAlignment * regionAlignment;
+	p->fences.assign(framesInFlight, nullptr);
+	p->region = 0;
+	p->head = 0;
+
+	// The storage is immutable and kept mapped until the buffer is deleted
+	int size = p->frameSize * framesInFlight;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &p->id);
+	if (GLUtils::DirectStateAccess())
+	{
+		glNamedBufferStorageEXT(p->id, size, nullptr, flags);
+		p->mapped = (unsigned char*)glMapNamedBufferRangeEXT(p->id, 0, size, flags);
+	}
+	else
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, p->id);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+		p->mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	if (p->mapped == nullptr)
+	{
+		FW_LOG_ERROR("Failed to map the stream buffer");
+		return false;
+	}
+
+	return true;
+}
+
+void GLStreamBuffer::BeginFrame()
+{
+	p->region = (p->region + 1) % (int)p->fences.size();
+	p->head = 0;
+	p->exhausted = false;
+
+	auto& fence = p->fences[p->region];
+	if (fence)
+	{
+		p->WaitFence(fence);
+		fence = nullptr;
+	}
+}
+
+void GLStreamBuffer::EndFrame()
+{
+	auto& fence = p->fences[p->region];
+	if (fence)
+	{
+		glDeleteSync(fence);
+	}
+
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool GLStreamBuffer::Allocate( int size, int alignment, GLStreamAllocation& allocation )
+{
+	int offset = (p->head + alignment - 1) & ~(alignment - 1);
+	if (offset + size > p->frameSize)
+	{
+		if (!p->exhausted)
+		{
+			FW_LOG_WARN(boost::str(boost::format("Stream buffer is exhausted (%d bytes requested, %d bytes per frame)") % size % p->frameSize));
+			p->exhausted = true;
+		}
+
+		return false;
+	}
+
+	p->head = offset + size;
+
+	int regionOffset = p->region * p->frameSize;
+	allocation.buffer = p->id;
+	allocation.offset = regionOffset + offset;
+	allocation.size = size;
+	allocation.data = p->mapped + regionOffset + offset;
+
+	return true;
+}
+
+GLuint GLStreamBuffer::ID() const
+{
+	return p->id;
+}
+
+int GLStreamBuffer::UniformBufferAlignment() const
+{
+	return p->uniformBufferAlignment;
+}
+
+int GLStreamBuffer::StorageBufferAlignment() const
+{
+	return p->storageBufferAlignment;
+}
+
+int GLStreamBuffer::NumStalls() const
+{
+	return p->numStalls;
+}
+
+FW_NAMESPACE_END
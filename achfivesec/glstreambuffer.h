@@ -0,0 +1,98 @@
+#pragma once
+#ifndef LIB_FW_GL_STREAM_BUFFER_H
+#define LIB_FW_GL_STREAM_BUFFER_H
+
+#include "common.h"
+#include <GL/glew.h>
+
+FW_NAMESPACE_BEGIN
+
+//! Region sub-allocated from the stream buffer.
+struct GLStreamAllocation
+{
+	GLuint buffer;		//!< Name of the buffer object.
+	int offset;			//!< Offset in bytes from the beginning of the buffer.
+	int size;			//!< Size in bytes.
+	void* data;			//!< Pointer to the mapped memory of the region.
+};
+
+/*!
+	Stream buffer.
+	Ring buffer for the data written by the CPU every frame (vertices, indices, uniforms, draw commands).
+	The buffer is allocated with ARB_buffer_storage and kept mapped persistently and coherently,
+	so the data written to the returned pointer is visible to the commands issued afterwards
+	without any map/unmap call.
+	The buffer is divided into a region per frame in flight.
+	The region of a frame is protected by a fence until the GPU finishes the frame,
+	and the CPU waits for the fence only when it comes back to the region
+	more than the given number of frames ahead of the GPU.
+	All functions must be called from the thread owning the OpenGL context.
+*/
+class GLStreamBuffer
+{
+public:
+
+	GLStreamBuffer();
+	~GLStreamBuffer();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(GLStreamBuffer);
+
+public:
+
+	/*!
+		Create the buffer.
+		\param frameSize Size in bytes available in a frame.
+		\param framesInFlight Number of frames the CPU can be ahead of the GPU.
+		\retval true Succeeded to create the buffer.
+		\retval false ARB_buffer_storage is not supported.
+	*/
+	bool Create(int frameSize, int framesInFlight = 3);
+
+	/*!
+		Begin a frame.
+		Moves to the region of the next frame, waiting for the GPU if it still uses the region.
+	*/
+	void BeginFrame();
+
+	/*!
+		End a frame.
+		Inserts the fence protecting the region written in the frame.
+		Must be called after all commands using the region are issued.
+	*/
+	void EndFrame();
+
+	/*!
+		Sub-allocate a region from the current frame.
+		The region is valid until the end of the frame.
+		\param size Size in bytes.
+		\param alignment Alignment of the offset in bytes. Must be a power of two.
+		\param allocation Allocated region.
+		\retval true Succeeded to allocate.
+		\retval false The region of the frame is exhausted.
+	*/
+	bool Allocate(int size, int alignment, GLStreamAllocation& allocation);
+
+	//! Get the name of the buffer object.
+	GLuint ID() const;
+
+	//! Get the offset alignment required to bind a region as a uniform buffer.
+	int UniformBufferAlignment() const;
+
+	//! Get the offset alignment required to bind a region as a shader storage buffer.
+	int StorageBufferAlignment() const;
+
+	//! Get number of frames which waited for the GPU.
+	int NumStalls() const;
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_GL_STREAM_BUFFER_H
@@ -0,0 +1,271 @@
+#include "pch.h"
+#include "gltextureuploader.h"
+#include "gl.h"
+#include "glstatecache.h"
+#include "logger.h"
+
+FW_NAMESPACE_BEGIN
+
+namespace
+{
+
+	// Offset alignment of the slots, enough for any texel type
+	const int SlotAlignment = 256;
+
+	enum class SlotState
+	{
+		Free,
+		Acquired,		//!< Being written by the user.
+		InFlight		//!< Copy submitted, protected by the fence.
+	};
+
+	struct Slot
+	{
+		SlotState state;
+		GLsync fence;
+	};
+
+}
+
+class GLTextureUploader::Impl
+{
+public:
+
+	Impl();
+	~Impl();
+
+public:
+
+	//! Create and map the buffer.
+	bool AllocateBuffer();
+
+	//! Bind the slot as the pixel unpack buffer and get the offset passed as the pointer.
+	const void* BindSlot(const GLTextureUpload& upload);
+
+	//! Unbind the pixel unpack buffer and insert the fence of the slot.
+	void FenceSlot(const GLTextureUpload& upload);
+
+public:
+
+	GLuint id;
+	unsigned char* mapped;
+	int slotSize;
+	bool allocationFailed;
+
+	std::vector<Slot> slots;
+	int next;						//!< Slot acquired next. Slots are reused in the order of submission.
+	int numRefused;
+
+};
+
+GLTextureUploader::Impl::Impl()
+	: id(0)
+	, mapped(nullptr)
+	, slotSize(0)
+	, allocationFailed(false)
+	, next(0)
+	, numRefused(0)
+{
+
+}
+
+GLTextureUploader::Impl::~Impl()
+{
+	for (const auto& slot : slots)
+	{
+		if (slot.fence)
+		{
+			glDeleteSync(slot.fence);
+		}
+	}
+
+	if (mapped)
+	{
+		if (GLUtils::DirectStateAccess())
+		{
+			glUnmapNamedBufferEXT(id);
+		}
+		else
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+	}
+
+	if (id != 0)
+	{
+		GLStateCache::BufferDeleted(id);
+		glDeleteBuffers(1, &id);
+	}
+}
+
+bool GLTextureUploader::Impl::AllocateBuffer()
+{
+	// The storage is immutable and kept mapped until the buffer is deleted
+	int size = slotSize * (int)slots.size();
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &id);
+	if (GLUtils::DirectStateAccess())
+	{
+		glNamedBufferStorageEXT(id, size, nullptr, flags);
+		mapped = (unsigned char*)glMapNamedBufferRangeEXT(id, 0, size, flags);
+	}
+	else
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	if (mapped == nullptr)
+	{
+		FW_LOG_ERROR("Failed to map the texture upload buffer");
+		allocationFailed = true;
+		return false;
+	}
+
+	return true;
+}
+
+const void* GLTextureUploader::Impl::BindSlot( const GLTextureUpload& upload )
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+	return (const void*)(size_t)(upload.slot * slotSize);
+}
+
+void GLTextureUploader::Impl::FenceSlot( const GLTextureUpload& upload )
+{
+	// Unbound so that the other uploads read from the client memory
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	auto& slot = slots[upload.slot];
+	slot.state = SlotState::InFlight;
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// --------------------------------------------------------------------------------
+
+GLTextureUploader::GLTextureUploader()
+	: p(new Impl)
+{
+
+}
+
+GLTextureUploader::~GLTextureUploader()
+{
+	FW_SAFE_DELETE(p);
+}
+
+bool GLTextureUploader::Create( int slotSize, int numSlots )
+{
+	if (!GLEW_ARB_buffer_storage || !GLEW_ARB_sync)
+	{
+		FW_LOG_ERROR("GL_ARB_buffer_storage or GL_ARB_sync is not supported");
+		return false;
+	}
+
+	p->slotSize = (slotSize + SlotAlignment - 1) / SlotAlignment * SlotAlignment;
+	p->next = 0;
+
+	Slot slot;
+	slot.state = SlotState::Free;
+	slot.fence = nullptr;
+	p->slots.assign(numSlots, slot);
+
+	// The buffer is allocated by the first upload
+	return true;
+}
+
+bool GLTextureUploader::Acquire( int size, GLTextureUpload& upload )
+{
+	if (size > p->slotSize)
+	{
+		FW_LOG_ERROR(boost::str(boost::format("Texture upload is too large (%d bytes requested, %d bytes per slot)") % size % p->slotSize));
+		return false;
+	}
+
+	if (p->mapped == nullptr && (p->allocationFailed || !p->AllocateBuffer()))
+	{
+		return false;
+	}
+
+	// The copies finish in the order of submission,
+	// so the later slots are not available if the next one is not
+	auto& slot = p->slots[p->next];
+	if (slot.state == SlotState::InFlight)
+	{
+		GLenum result = glClientWaitSync(slot.fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+		{
+			p->numRefused++;
+			return false;
+		}
+
+		if (result == GL_WAIT_FAILED)
+		{
+			FW_LOG_ERROR("Failed to wait for the fence of the texture upload");
+		}
+
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		slot.state = SlotState::Free;
+	}
+
+	if (slot.state != SlotState::Free)
+	{
+		p->numRefused++;
+		return false;
+	}
+
+	slot.state = SlotState::Acquired;
+	upload.slot = p->next;
+	upload.size = size;
+	upload.data = p->mapped + p->next * p->slotSize;
+	p->next = (p->next + 1) % (int)p->slots.size();
+
+	return true;
+}
+
+void GLTextureUploader::Submit( const GLTextureUpload& upload, GLTexture2D& texture, const glm::ivec4& rect, GLenum format, GLenum type )
+{
+	texture.Replace(rect, format, type, p->BindSlot(upload));
+	p->FenceSlot(upload);
+}
+
+void GLTextureUploader::SubmitCompressed( const GLTextureUpload& upload, GLTexture2D& texture, const glm::ivec4& rect )
+{
+	texture.ReplaceCompressed(rect, upload.size, p->BindSlot(upload));
+	p->FenceSlot(upload);
+}
+
+void GLTextureUploader::Cancel( const GLTextureUpload& upload )
+{
+	p->slots[upload.slot].state = SlotState::Free;
+}
+
+bool GLTextureUploader::Upload( GLTexture2D& texture, const glm::ivec4& rect, GLenum format, GLenum type, const void* data, int size )
+{
+	GLTextureUpload upload;
+	if (!Acquire(size, upload))
+	{
+		return false;
+	}
+
+	memcpy(upload.data, data, size);
+	Submit(upload, texture, rect, format, type);
+	return true;
+}
+
+int GLTextureUploader::SlotSize() const
+{
+	return p->slotSize;
+}
+
+int GLTextureUploader::NumRefused() const
+{
+	return p->numRefused;
+}
+
+FW_NAMESPACE_END
@@ -0,0 +1,119 @@
+#pragma once
+#ifndef LIB_FW_GL_TEXTURE_UPLOADER_H
+#define LIB_FW_GL_TEXTURE_UPLOADER_H
+
+#include "common.h"
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+FW_NAMESPACE_BEGIN
+
+class GLTexture2D;
+
+//! Slot of the texture uploader being written.
+struct GLTextureUpload
+{
+	int slot;			//!< Index of the slot.
+	int size;			//!< Size in bytes requested by Acquire.
+	void* data;			//!< Pointer to the mapped memory of the slot.
+};
+
+/*!
+	Texture uploader.
+	Streams texel data (e.g. image sequences or video frames) into textures through pixel unpack buffers,
+	so the copy to the texture is done by the GPU asynchronously with the render thread.
+	The buffer is allocated with ARB_buffer_storage on the first upload,
+	so nothing is allocated unless a texture is actually streamed,
+	kept mapped persistently and coherently, and divided into a ring of slots.
+	A slot is protected by a fence from the submission of its copy until the GPU finishes it.
+	Acquire never waits for a fence; when the oldest slot is still in use the upload is refused
+	and should be retried later (e.g. the next frame keeps showing the previous image).
+	Acquire, Submit and Cancel must be called from the thread owning the OpenGL context,
+	but the memory of an acquired slot can be written from any thread until it is submitted.
+*/
+class GLTextureUploader
+{
+public:
+
+	GLTextureUploader();
+	~GLTextureUploader();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(GLTextureUploader);
+
+public:
+
+	/*!
+		Set up the slots. The buffer itself is allocated by the first Acquire.
+		\param slotSize Maximum size in bytes of an upload.
+		\param numSlots Number of uploads which can be in flight.
+		\retval true Succeeded to set up.
+		\retval false ARB_buffer_storage is not supported.
+	*/
+	bool Create(int slotSize, int numSlots = 4);
+
+	/*!
+		Acquire the next slot.
+		\param size Size in bytes of the data to be written.
+		\param upload Acquired slot.
+		\retval true Succeeded to acquire.
+		\retval false The size exceeds the slot size, the next slot is still in use, or the buffer cannot be allocated.
+	*/
+	bool Acquire(int size, GLTextureUpload& upload);
+
+	/*!
+		Copy the data of a slot to a region of a texture.
+		The rows of the data are aligned as specified by GL_UNPACK_ALIGNMENT.
+		The slot is reused once the GPU finishes the copy.
+		\param upload Slot acquired by Acquire.
+		\param texture Texture.
+		\param rect Region (x, y, width, height).
+		\param format Format of the data.
+		\param type Type of the data.
+	*/
+	void Submit(const GLTextureUpload& upload, GLTexture2D& texture, const glm::ivec4& rect, GLenum format, GLenum type);
+
+	/*!
+		Copy the compressed blocks of a slot to a region of a compressed texture.
+		\param upload Slot acquired by Acquire, holding upload.size bytes of the blocks.
+		\param texture Compressed texture.
+		\param rect Region (x, y, width, height).
+	*/
+	void SubmitCompressed(const GLTextureUpload& upload, GLTexture2D& texture, const glm::ivec4& rect);
+
+	/*!
+		Release a slot without copying.
+		\param upload Slot acquired by Acquire.
+	*/
+	void Cancel(const GLTextureUpload& upload);
+
+	/*!
+		Acquire a slot, copy the data to it, and submit it.
+		\param texture Texture.
+		\param rect Region (x, y, width, height).
+		\param format Format of the data.
+		\param type Type of the data.
+		\param data Data.
+		\param size Size in bytes of the data.
+		\retval true Succeeded to submit.
+		\retval false No slot is available.
+	*/
+	bool Upload(GLTexture2D& texture, const glm::ivec4& rect, GLenum format, GLenum type, const void* data, int size);
+
+	//! Get the maximum size in bytes of an upload.
+	int SlotSize() const;
+
+	//! Get number of uploads refused because the slots were in use.
+	int NumRefused() const;
+
+private:
+
+	class Impl;
+	Impl* p;
+
+};
+
+FW_NAMESPACE_END
+
+#endif // LIB_FW_GL_TEXTURE_UPLOADER_H
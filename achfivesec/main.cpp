@@ -1,13 +1,23 @@
 #include "pch.h"
 #include "gl.h"
+#include "glstatecache.h"
+#include "glshaderregistry.h"
+#include "glreadback.h"
 #include "logger.h"
+#include "profiler.h"
 #include "util.h"
-#include "shaderutil.h"
 #include "achscene.h"
 #include "achscene_2.h"
+#include "compositor.h"
+#include "presentationclock.h"
+#include "dynamicresolution.h"
+#include "assetbundle.h"
 #include <boost/program_options.hpp>
 #include <SFML/Audio.hpp>
 #include <sync/sync.h>
+#ifdef FW_PLATFORM_WINDOWS
+#include <Windows.h>
+#endif
 
 using namespace fw;
 namespace po = boost::program_options;
@@ -15,45 +25,75 @@ namespace po = boost::program_options;
 namespace
 {
 
-	const std::string QuadVs =
-		FW_GL_SHADER_SOURCE(
-		
-			{{GLShaderVersion}}
-			{{GLVertexAttributes}}
+#ifdef FW_PLATFORM_WINDOWS
 
-			layout (location = POSITION) in vec3 position;
-			out vec2 vTexCoord;
+	// Creates a window which is never shown, used as the render target of the offline mode.
+	// SFML creates its own windows visible, so we create the native window by ourselves
+	// and let SFML attach the OpenGL context to it.
+	HWND CreateHiddenWindow(int width, int height)
+	{
+		const wchar_t* className = L"achfivesec_offline";
+
+		WNDCLASSW wc;
+		ZeroMemory(&wc, sizeof(wc));
+		wc.style = CS_OWNDC;
+		wc.lpfnWndProc = DefWindowProcW;
+		wc.hInstance = GetModuleHandleW(NULL);
+		wc.lpszClassName = className;
+		RegisterClassW(&wc);
+
+		// No WS_VISIBLE, the window stays hidden
+		return CreateWindowW(className, L"achfivesec", WS_POPUP, 0, 0, width, height, NULL, NULL, wc.hInstance, NULL);
+	}
 
-			void main()
-			{
-				vTexCoord = (position.xy + 1) * 0.5;
-				gl_Position = vec4(position, 1);
-			}
+#endif
+
+	const std::string MusicPath = "achop.wav";
 
-		);
+	// Number of frames of the offline mode read back or being written at the same time
+	const int ReadbackSlots = 4;
 
-	const std::string QuadFs = 
-		FW_GL_SHADER_SOURCE(
-		
-			{{GLShaderVersion}}
+	// Decode the music and write the PCM samples into the bundle
+	bool LoadMusic(AssetBundleWriter& writer)
+	{
+		FW_PROFILE_SCOPE("LoadMusic");
 
-			in vec2 vTexCoord;
-			out vec4 fragColor;
+		sf::SoundBuffer buffer;
+		if (!buffer.loadFromFile(MusicPath))
+		{
+			FW_LOG_ERROR("Failed to load " + MusicPath);
+			return false;
+		}
 
-			uniform sampler2D RT1;
-			uniform sampler2D RT2;
-			uniform float Alpha;
-			uniform float Blend;
+		auto& entry = writer.AddEntry(MusicPath);
+		entry.Write<unsigned int>(buffer.getChannelCount());
+		entry.Write<unsigned int>(buffer.getSampleRate());
+		entry.WriteArray(buffer.getSamples(), (size_t)buffer.getSampleCount());
 
-			void main()
-			{
-				vec3 c1 = texture(RT1, vTexCoord).rgb;
-				vec3 c2 = texture(RT2, vTexCoord).rgb;
-				fragColor.rgb = mix(c1, c2, Blend);
-				fragColor.a = Alpha;
-			}
-		
-		);
+		return true;
+	}
+
+	// Create the sound buffer from the samples written by LoadMusic
+	bool UploadMusic(const AssetBundle& bundle, sf::SoundBuffer& buffer)
+	{
+		AssetBundleReader reader;
+		if (!bundle.Find(MusicPath, reader))
+		{
+			return false;
+		}
+
+		size_t count;
+		unsigned int channels = reader.Read<unsigned int>();
+		unsigned int sampleRate = reader.Read<unsigned int>();
+		const auto* samples = reader.ReadArray<sf::Int16>(count);
+		if (reader.Failed() || count == 0)
+		{
+			FW_LOG_ERROR("Invalid bundle entry: " + MusicPath);
+			return false;
+		}
+
+		return buffer.loadFromSamples(samples, count, channels, sampleRate);
+	}
 
 }
 
@@ -63,6 +103,12 @@ public:
 
 	Application()
 		: paused(false)
+		, buildBundle(false)
+		, fps(60)
+		, width(1280)
+		, height(720)
+		, minRenderScale(0.5f)
+		, maxRenderScale(1.0f)
 	{
 
 	}
@@ -75,7 +121,16 @@ public:
 		po::options_description opt("Allowed options");
 		opt.add_options()
 			("help", "Display help message")
-			("log,l", po::value<std::string>(&logFilePath)->default_value(""), "Output image path");
+			("log,l", po::value<std::string>(&logFilePath)->default_value(""), "Output image path")
+			("render-out,o", po::value<std::string>(&renderOutputDir)->default_value(""), "Render frames offline into the directory instead of playing")
+			("fps", po::value<int>(&fps)->default_value(60), "Frame rate of the offline mode, or the target frame rate of the dynamic resolution")
+			("min-scale", po::value<float>(&minRenderScale)->default_value(0.5f), "Minimum render scale of the dynamic resolution")
+			("max-scale", po::value<float>(&maxRenderScale)->default_value(1.0f), "Maximum render scale of the dynamic resolution")
+			("size,s", po::value<std::string>(&sizeString)->default_value("1280x720"), "Frame size (WxH)")
+			("trace,t", po::value<std::string>(&traceFilePath)->default_value(""), "Write per-pass CPU/GPU timings to the file in Chrome trace format")
+			("bundle,b", po::value<std::string>(&bundlePath)->default_value("achfivesec.bundle"), "Asset bundle read instead of the source assets if exists")
+			("build-bundle", po::bool_switch(&buildBundle), "Build the asset bundle from the source assets and exit")
+			("shader-cache", po::value<std::string>(&shaderCacheDir)->default_value("shadercache"), "Directory of the program binary cache (empty to disable)");
 
 		po::variables_map vm;
 
@@ -91,6 +146,27 @@ public:
 			}
 
 			po::notify(vm);
+
+			if (std::sscanf(sizeString.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+			{
+				std::cout << "ERROR : Invalid frame size " << sizeString << std::endl;
+				PrintHelpMessage(opt);
+				return false;
+			}
+
+			if (fps <= 0)
+			{
+				std::cout << "ERROR : Invalid frame rate " << fps << std::endl;
+				PrintHelpMessage(opt);
+				return false;
+			}
+
+			if (minRenderScale <= 0.0f || maxRenderScale > 1.0f || minRenderScale > maxRenderScale)
+			{
+				std::cout << "ERROR : Invalid render scale range " << minRenderScale << " - " << maxRenderScale << std::endl;
+				PrintHelpMessage(opt);
+				return false;
+			}
 		}
 		catch (po::required_option& e)
 		{
@@ -112,12 +188,34 @@ public:
 
 	bool Run()
 	{
+		if (buildBundle)
+		{
+			return BuildBundle();
+		}
+
+		// In the offline mode, frames are rendered with the fixed time step
+		// as fast as possible and written to the output directory.
+		bool offline = !renderOutputDir.empty();
+
 		// Create window and OpenGL context
 		sf::ContextSettings settings;
 		settings.majorVersion = 4;
 		settings.minorVersion = 2;
 		settings.antialiasingLevel = 8;
-		sf::RenderWindow window(sf::VideoMode(1280, 720), "achfivesec", sf::Style::Titlebar, settings);
+		sf::RenderWindow window;
+		if (offline)
+		{
+#ifdef FW_PLATFORM_WINDOWS
+			window.create(CreateHiddenWindow(width, height), settings);
+#else
+			window.create(sf::VideoMode(width, height), "achfivesec", sf::Style::None, settings);
+			window.setVisible(false);
+#endif
+		}
+		else
+		{
+			window.create(sf::VideoMode(width, height), "achfivesec", sf::Style::Titlebar, settings);
+		}
 
 		// Initialize GLEW
 		if (!GLUtils::InitializeGlew())
@@ -129,6 +227,32 @@ public:
 		// Enable error handling
 		GLUtils::EnableDebugOutput(GLUtils::DebugOutputFrequencyHigh);
 
+		// Reuse the programs linked in the previous launches
+		if (!shaderCacheDir.empty())
+		{
+			GLUtils::EnableProgramCache(shaderCacheDir);
+		}
+
+		// Shader stages are shared among the scenes as separable programs
+		if (!GLEW_ARB_separate_shader_objects)
+		{
+			FW_LOG_ERROR("GL_ARB_separate_shader_objects is not supported");
+			return false;
+		}
+
+		// Draws are batched with the parameters in storage buffers,
+		// otherwise issued one by one with the parameters in uniform buffers
+		if (!GLEW_ARB_multi_draw_indirect || !GLEW_ARB_shader_storage_buffer_object)
+		{
+			FW_LOG_WARN("GL_ARB_multi_draw_indirect or GL_ARB_shader_storage_buffer_object is not supported, draw batches fall back to the core 4.2 path");
+		}
+
+		// Enable profiling
+		if (!traceFilePath.empty())
+		{
+			Profiler::Enable();
+		}
+
 		// --------------------------------------------------------------------------------
 
 		// Setup GNU rocket
@@ -155,92 +279,188 @@ public:
 		}
 #endif
 
-		// Some tracks
-		//const sync_track* track_ActiveSceneIndex_1;
-		//const sync_track* track_ActiveSceneIndex_2;
-		const sync_track* track_Blend;
-		const sync_track* track_Alpha;
-		track_Blend = sync_get_track(rocket, "global.Blend");
-		track_Alpha = sync_get_track(rocket, "global.Alpha");
-
-		// --------------------------------------------------------------------------------
-
 		// Setup scene
+		// Assets are read from the memory-mapped bundle if exists.
+		// Otherwise the source assets are loaded in worker threads while the OpenGL resources
+		// not depending on them are created in this thread.
 		std::vector<std::unique_ptr<Scene>> scenes;
-		scenes.emplace_back(new AchScene);
-		scenes.emplace_back(new AchScene_2);
+		CreateScenes(scenes);
+
+		GLShaderRegistry shaders;
+		AssetBundle bundle;
+		AssetBundleWriter writer;
+		std::vector<std::future<bool>> loadResults;
+		if (boost::filesystem::exists(bundlePath) && bundle.Open(bundlePath))
+		{
+			FW_LOG_INFO("Using asset bundle " + bundlePath);
+		}
+		else
+		{
+			loadResults = LoadAssets(scenes, writer, !offline);
+		}
+
+		bool setupSucceeded = true;
 		for (auto& scene : scenes)
 		{
-			if (!scene->Setup(window, rocket))
+			if (!scene->Setup(window, rocket, shaders))
 			{
 				std::cerr << "Failed to setup " << scene->Name() << std::endl;
+				setupSucceeded = false;
+				break;
+			}
+		}
+
+		// Wait for all workers even on failure
+		if (!loadResults.empty())
+		{
+			if (!WaitAssets(scenes, loadResults))
+			{
+				setupSucceeded = false;
+			}
+
+			bundle.Open(writer);
+		}
+
+		if (!setupSucceeded)
+		{
+			return false;
+		}
+
+		for (auto& scene : scenes)
+		{
+			FW_PROFILE_SCOPE("Upload");
+			if (!scene->Upload(bundle))
+			{
+				std::cerr << "Failed to upload " << scene->Name() << std::endl;
 				return false;
 			}
 		}
 
-		// Some GL resources
-		auto windowSize = window.getSize();
-		
-		GLFrameBuffer scene1Fbo(windowSize.x, windowSize.y, glm::vec4(glm::vec3(1.0f), 1.0f));
-		GLTexture2D scene1Rt;
-		scene1Rt.SetMagFilter(GL_LINEAR);
-		scene1Rt.SetMinFilter(GL_LINEAR);
-		scene1Rt.SetWrap(GL_CLAMP_TO_EDGE);
-		scene1Rt.Allocate(windowSize.x, windowSize.y, GL_RGBA16F);
-		scene1Fbo.AddRenderTarget(&scene1Rt);
-
-		GLFrameBuffer scene2Fbo(windowSize.x, windowSize.y, glm::vec4(glm::vec3(1.0f), 1.0f));
-		GLTexture2D scene2Rt;
-		scene2Rt.SetMagFilter(GL_LINEAR);
-		scene2Rt.SetMinFilter(GL_LINEAR);
-		scene2Rt.SetWrap(GL_CLAMP_TO_EDGE);
-		scene2Rt.Allocate(windowSize.x, windowSize.y, GL_RGBA16F);
-		scene2Fbo.AddRenderTarget(&scene2Rt);
-
-		ShaderUtil::ShaderTemplateDict dict;
-		GLShader quadShader;
-		quadShader.CompileString(GLShaderType::VertexShader, ShaderUtil::GenerateShaderString(QuadVs, dict));
-		quadShader.CompileString(GLShaderType::FragmentShader, ShaderUtil::GenerateShaderString(QuadFs, dict));
-		quadShader.Link();
-
-		GLVertexArray quadVao;
-		GLVertexBuffer quadPositionVbo;
-		GLIndexBuffer quadIbo;
-
-		const glm::vec3 quadPositions[] =
-		{
-			glm::vec3( 1.0f,  1.0f, 0.0f),
-			glm::vec3(-1.0f,  1.0f, 0.0f),
-			glm::vec3(-1.0f, -1.0f, 0.0f),
-			glm::vec3( 1.0f, -1.0f, 0.0f)
-		};
+		// Compositor
+		std::vector<Scene*> scenePtrs;
+		for (auto& scene : scenes)
+		{
+			scenePtrs.push_back(scene.get());
+		}
 
-		const GLuint quadIndices[] =
+		Compositor compositor;
+		if (!compositor.Setup(window, rocket, scenePtrs, shaders))
 		{
-			0, 1, 2,
-			2, 3, 0
-		};
+			std::cerr << "Failed to setup compositor" << std::endl;
+			return false;
+		}
 
-		quadPositionVbo.AddStatic(12, &quadPositions[0].x);
-		quadVao.Add(GLDefaultVertexAttribute::Position, &quadPositionVbo);
-		quadIbo.AddStatic(6, quadIndices);
+		FW_LOG_INFO(boost::str(boost::format("Shaders: %d stages compiled for %d requests, %d pipelines")
+			% shaders.NumStages() % shaders.NumStageRequests() % shaders.NumPipelines()));
+
+		// Render scale of the scenes follows the GPU load.
+		// The offline mode renders at the fixed scale for the reproducible output.
+		DynamicResolution dynamicResolution;
+		dynamicResolution.Setup(offline ? maxRenderScale : minRenderScale, maxRenderScale, 1000.0 / fps);
 
 		// --------------------------------------------------------------------------------
 
-		// Load music
-		if (!buffer.loadFromFile("achop.wav"))
+		// Output to the window
+		auto windowFbo = GLFrameBuffer::DefaultFramebuffer(width, height, glm::vec4(glm::vec3(1.0f), 1.0f));
+
+		// Output of the offline mode
+		std::unique_ptr<GLTexture2D> outputRt;
+		std::unique_ptr<GLFrameBuffer> outputFbo;
+		std::unique_ptr<GLReadback> readback;
+		std::deque<std::future<bool>> frameWriters;		// Destroyed (joined) before the readback
+		int numFrames = 0;
+		int frame = 0;
+
+		if (offline)
 		{
-			std::cerr << "Failed to load music" << std::endl;
-			return false;
+			boost::system::error_code ec;
+			boost::filesystem::create_directories(renderOutputDir, ec);
+			if (ec)
+			{
+				FW_LOG_ERROR("Failed to create output directory " + renderOutputDir);
+				return false;
+			}
+
+			outputRt.reset(new GLTexture2D);
+			outputRt->SetMagFilter(GL_LINEAR);
+			outputRt->SetMinFilter(GL_LINEAR);
+			outputRt->SetWrap(GL_CLAMP_TO_EDGE);
+			outputRt->Allocate(width, height, GL_RGBA8);
+			outputFbo.reset(new GLFrameBuffer(width, height, glm::vec4(glm::vec3(1.0f), 1.0f)));
+			outputFbo->AddRenderTarget(outputRt.get());
+
+			// The frames are read back without stalling the pipeline and written by the worker threads.
+			// Falls back to the blocking read if not supported.
+			readback.reset(new GLReadback);
+			if (!readback->Create(width * height * 4, ReadbackSlots))
+			{
+				FW_LOG_WARN("Asynchronous readback is disabled");
+				readback.reset();
+			}
+
+			// Render one loop of the sequence
+			numFrames = (int)std::ceil(Util::BeatsToMilli(Util::LengthInBeats()) * fps / 1000.0);
+			FW_LOG_INFO(boost::str(boost::format("Rendering %d frames (%dx%d, %d fps) into %s") % numFrames % width % height % fps % renderOutputDir));
 		}
+		else
+		{
+			// Load music
+			if (!UploadMusic(bundle, buffer))
+			{
+				std::cerr << "Failed to load music" << std::endl;
+				return false;
+			}
 
-		sound.setBuffer(buffer);
-		sound.play();
+			sound.setBuffer(buffer);
+			sound.play();
+		}
 
 		// --------------------------------------------------------------------------------
 
-		while (window.isOpen())
+		// Number of GL calls issued and avoided by the state cache
+		long long issuedCalls = 0;
+		long long avoidedCalls = 0;
+		long long numCacheFrames = 0;
+		auto accumulateCacheStats = [&]()
+		{
+			GLStateCache::BeginFrame();
+			auto stats = GLStateCache::LastFrameStats();
+			issuedCalls += stats.issuedCalls;
+			avoidedCalls += stats.avoidedCalls;
+		};
+
+		// Write a retrieved frame in a worker thread, which releases the slot after the frame is saved.
+		// The writers in flight are bounded by the slots, as Read fails until the oldest writer finishes.
+		auto writeFrame = [&](const GLReadbackFrame& finished)
+		{
+			auto* readbackPtr = readback.get();
+			frameWriters.push_back(std::async(std::launch::async, [this, readbackPtr, finished]() -> bool
+			{
+				sf::Image image;
+				image.create(finished.width, finished.height, static_cast<const sf::Uint8*>(finished.data));
+				bool result = SaveFrame(image, (int)finished.tag);
+				readbackPtr->Release(finished);
+				return result;
+			}));
+		};
+
+		auto finishWriter = [&]() -> bool
+		{
+			bool result = frameWriters.front().get();
+			frameWriters.pop_front();
+			return result;
+		};
+
+		// Discard the calls made while loading
+		GLStateCache::BeginFrame();
+
+		while (offline ? frame < numFrames : window.isOpen())
 		{
+			Profiler::BeginFrame();
+			accumulateCacheStats();
+			numCacheFrames++;
+			FW_PROFILE_SCOPE("Frame");
+
 			sf::Event event;
 			while (window.pollEvent(event))
 			{
@@ -264,67 +484,111 @@ public:
 				}
 			}
 
-			double time = sound.getPlayingOffset().asMilliseconds();
+			// Current time
+			// The offline mode advances the time with the fixed step
+			// instead of following the playing position of the music.
+			// Otherwise the time is the predicted display time of the frame
+			// locked to the playing position of the music.
+			double time = offline
+				? frame * 1000.0 / fps
+				: presentationClock.Update(sound.getPlayingOffset().asMicroseconds() / 1000.0, sound.getStatus() == sf::Sound::Playing);
 			double row = Util::MilliToRow(time);
 #ifndef SYNC_PLAYER
-			if (sync_update(rocket, (int)std::floor(row)))
+			if (!offline && sync_update(rocket, (int)std::floor(row)))
 			{
 				sync_connect(rocket, "localhost", SYNC_DEFAULT_PORT);
 			}
 #endif
 
-			if ((int)std::floor(Util::MilliToBeats(time)) > 18)
+			if (!offline && Util::MilliToBeats(time) >= Util::LengthInBeats())
 			{
 				sound.setPlayingOffset(sf::Time::Zero);
+				presentationClock.Reset(0);
 			}
 
-			// Active scenes
-			//int activeSceneIndex_1 = (int)sync_get_val(track_ActiveSceneIndex_1, row);
-			//int activeSceneIndex_2 = (int)sync_get_val(track_ActiveSceneIndex_2, row);
-			int activeSceneIndex_1 = 0;
-			int activeSceneIndex_2 = 1;
-			Scene* activeScene_1 = activeSceneIndex_1 >= 0
-				? scenes[activeSceneIndex_1].get()
-				: nullptr;
-			Scene* activeScene_2 = activeSceneIndex_2 >= 0
-				? scenes[activeSceneIndex_2].get()
-				: nullptr;
-
-			// Clear buffers
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			const glm::vec4 clearColor(1.0f);
-			glClearBufferfv(GL_COLOR, 0, glm::value_ptr(clearColor));
-
 			// Draw scenes
-			glEnable(GL_DEPTH_TEST);
-			float blend = sync_get_val(track_Blend, row);
-			if (activeScene_1 && blend < 1.0f)
+			GLStateCache::Enable(GL_DEPTH_TEST);
+			dynamicResolution.BeginFrame();
+			compositor.SetRenderScale(dynamicResolution.Scale());
+			compositor.Draw(window, time, offline ? *outputFbo : *windowFbo);
+			dynamicResolution.EndFrame();
+
+			if (offline)
 			{
-				activeScene_1->Draw(window, time, scene1Fbo);
+				if (readback)
+				{
+					// Make room by retrieving the oldest frame or waiting for its writer
+					while (!readback->Read(*outputRt, GL_RGBA, GL_UNSIGNED_BYTE, frame))
+					{
+						GLReadbackFrame finished;
+						if (readback->Wait(finished))
+						{
+							writeFrame(finished);
+						}
+						else if (frameWriters.empty() || !finishWriter())
+						{
+							return false;
+						}
+					}
+
+					// Frames rendered a few frames before
+					GLReadbackFrame finished;
+					while (readback->Poll(finished))
+					{
+						writeFrame(finished);
+					}
+
+					while (!frameWriters.empty() && frameWriters.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+					{
+						if (!finishWriter())
+						{
+							return false;
+						}
+					}
+				}
+				else if (!WriteFrame(*outputRt, frame))
+				{
+					return false;
+				}
+
+				frame++;
 			}
-			if (activeScene_2 && blend > 0.0f)
+			else
 			{
-				activeScene_2->Draw(window, time, scene2Fbo);
+				window.display();
 			}
+		}
 
-			// Draw mixed scene
-			glPushAttrib(GL_COLOR_BUFFER_BIT);
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-			quadShader.Begin();
-			quadShader.SetUniform("RT1", 0);
-			quadShader.SetUniform("RT2", 1);
-			quadShader.SetUniform("Blend", blend);
-			quadShader.SetUniform("Alpha", sync_get_val(track_Alpha, row));
-			scene1Rt.Bind(0);
-			scene2Rt.Bind(1);
-			quadVao.Draw(GL_TRIANGLES, &quadIbo);
-			scene2Rt.Unbind();
-			scene1Rt.Unbind();
-			quadShader.End();
-			glPopAttrib();
-
-			window.display();
+		// Remaining frames of the offline mode
+		if (readback)
+		{
+			GLReadbackFrame finished;
+			while (readback->Wait(finished))
+			{
+				writeFrame(finished);
+			}
+
+			while (!frameWriters.empty())
+			{
+				if (!finishWriter())
+				{
+					return false;
+				}
+			}
+
+			FW_LOG_INFO(boost::str(boost::format("Readback waited for the GPU %d times") % readback->NumStalls()));
+		}
+
+		accumulateCacheStats();
+		if (numCacheFrames > 0)
+		{
+			FW_LOG_INFO(boost::str(boost::format("GL state cache: %.1f calls issued, %.1f calls avoided per frame")
+				% ((double)issuedCalls / numCacheFrames) % ((double)avoidedCalls / numCacheFrames)));
+		}
+
+		if (!traceFilePath.empty())
+		{
+			Profiler::Dump(traceFilePath);
 		}
 
 		return true;
@@ -369,6 +633,99 @@ public:
 
 private:
 
+	void CreateScenes(std::vector<std::unique_ptr<Scene>>& scenes)
+	{
+		scenes.emplace_back(new AchScene);
+		scenes.emplace_back(new AchScene_2);
+	}
+
+	// Launch the loading of the source assets into the writer.
+	// One result per scene, followed by the result of the music if loaded.
+	std::vector<std::future<bool>> LoadAssets(const std::vector<std::unique_ptr<Scene>>& scenes, AssetBundleWriter& writer, bool music)
+	{
+		std::vector<std::future<bool>> loadResults;
+		for (auto& scene : scenes)
+		{
+			auto* s = scene.get();
+			loadResults.push_back(std::async(std::launch::async, [s, &writer]()
+			{
+				return s->Load(writer);
+			}));
+		}
+
+		if (music)
+		{
+			loadResults.push_back(std::async(std::launch::async, [&writer]()
+			{
+				return LoadMusic(writer);
+			}));
+		}
+
+		return loadResults;
+	}
+
+	bool WaitAssets(const std::vector<std::unique_ptr<Scene>>& scenes, std::vector<std::future<bool>>& loadResults)
+	{
+		bool result = true;
+		for (size_t i = 0; i < loadResults.size(); i++)
+		{
+			if (!loadResults[i].get())
+			{
+				std::cerr << "Failed to load " << (i < scenes.size() ? scenes[i]->Name() : "music") << std::endl;
+				result = false;
+			}
+		}
+
+		return result;
+	}
+
+	bool BuildBundle()
+	{
+		// Only the CPU side of the loading runs, thus no window is needed
+		std::vector<std::unique_ptr<Scene>> scenes;
+		CreateScenes(scenes);
+
+		AssetBundleWriter writer;
+		auto loadResults = LoadAssets(scenes, writer, true);
+		if (!WaitAssets(scenes, loadResults))
+		{
+			return false;
+		}
+
+		return writer.Save(bundlePath);
+	}
+
+	bool WriteFrame(GLTexture2D& rt, int frame)
+	{
+		// Read back the rendered frame, waiting for the GPU
+		std::vector<sf::Uint8> pixels(rt.Width() * rt.Height() * 4);
+		rt.GetInternalData(GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+		sf::Image image;
+		image.create(rt.Width(), rt.Height(), &pixels[0]);
+		return SaveFrame(image, frame);
+	}
+
+	// Write a frame read back from the bottom row. Can be called from any thread.
+	bool SaveFrame(sf::Image& image, int frame)
+	{
+		image.flipVertically();
+
+		auto path = boost::str(boost::format("%s/%06d.png") % renderOutputDir % frame);
+		if (!image.saveToFile(path))
+		{
+			FW_LOG_ERROR("Failed to write " + path);
+			return false;
+		}
+
+		if ((frame + 1) % fps == 0)
+		{
+			FW_LOG_INFO(boost::str(boost::format("Rendered %d frames") % (frame + 1)));
+		}
+
+		return true;
+	}
+
 	void PrintHelpMessage(const po::options_description& opt)
 	{
 		std::cout << "Usage: achfivesec [arguments]" << std::endl;
@@ -400,6 +757,7 @@ public:
 		auto* app = static_cast<Application*>(d);
 		double offset = Util::RowToMilli(row);
 		app->sound.setPlayingOffset(sf::milliseconds((int)offset));
+		app->presentationClock.Reset(offset);
 	}
 
 	static int is_playing(void* d)
@@ -415,10 +773,32 @@ private:
 	bool paused;
 	sf::SoundBuffer buffer;
 	sf::Sound sound;
+	PresentationClock presentationClock;
 
 	// Log file
 	std::string logFilePath;
 
+	// Trace file of the profiler
+	std::string traceFilePath;
+
+	// Asset bundle
+	std::string bundlePath;
+	bool buildBundle;
+
+	// Program binary cache
+	std::string shaderCacheDir;
+
+	// Offline mode
+	std::string renderOutputDir;
+	std::string sizeString;
+	int fps;
+	int width;
+	int height;
+
+	// Dynamic resolution
+	float minRenderScale;
+	float maxRenderScale;
+
 	// Logging thread related variables
 	std::atomic<bool> logThreadDone;
 	std::future<void> logResult;
@@ -0,0 +1,117 @@
+#include "pch.h"
+#include "presentationclock.h"
+#ifdef FW_PLATFORM_WINDOWS
+#include <Windows.h>
+#endif
+
+namespace
+{
+	// Fraction of the difference from the audio position corrected per frame.
+	// Small enough to average out the steps of the audio position.
+	const double CorrectionGain = 0.02;
+
+	// The timeline is restarted if it differs from the audio position more than this,
+	// e.g. when the audio device stalls.
+	const double ResyncThresholdMilli = 100.0;
+
+	// Smoothing factor of the frame interval
+	const double FrameIntervalSmoothing = 0.1;
+
+	// Frame intervals longer than this (hitches, window dragging) are ignored
+	const double MaxFrameIntervalMilli = 100.0;
+}
+
+PresentationClock::PresentationClock()
+	: synchronized(false)
+	, baseMilli(0)
+	, baseNow(0)
+	, lastUpdate(0)
+	, lastTime(0)
+	, frameInterval(1000.0 / 60.0)
+	, latencyFrames(1)
+{
+
+}
+
+double PresentationClock::Update( double audioMilli, bool playing )
+{
+	double now = Now();
+
+	if (!playing)
+	{
+		// Follow the audio position as it is while paused,
+		// it is changed only by seeking.
+		synchronized = false;
+		lastUpdate = now;
+		lastTime = audioMilli;
+		return audioMilli;
+	}
+
+	if (!synchronized)
+	{
+		baseMilli = audioMilli;
+		baseNow = now;
+		lastUpdate = now;
+		lastTime = audioMilli;
+		synchronized = true;
+	}
+
+	// Frame interval
+	double interval = now - lastUpdate;
+	lastUpdate = now;
+	if (interval > 0.0 && interval < MaxFrameIntervalMilli)
+	{
+		frameInterval += (interval - frameInterval) * FrameIntervalSmoothing;
+	}
+
+	// Pull the timeline toward the audio position
+	double time = baseMilli + (now - baseNow);
+	double error = audioMilli - time;
+	if (std::abs(error) > ResyncThresholdMilli)
+	{
+		baseMilli = audioMilli;
+		baseNow = now;
+		time = audioMilli;
+	}
+	else
+	{
+		baseMilli += error * CorrectionGain;
+		time += error * CorrectionGain;
+	}
+
+	// The frame is displayed after the latency
+	double displayTime = time + frameInterval * latencyFrames;
+
+	// Never go back in time
+	displayTime = std::max(displayTime, lastTime);
+	lastTime = displayTime;
+
+	return displayTime;
+}
+
+void PresentationClock::Reset( double audioMilli )
+{
+	baseMilli = audioMilli;
+	baseNow = Now();
+	lastUpdate = baseNow;
+	lastTime = audioMilli;
+}
+
+double PresentationClock::Now()
+{
+#ifdef FW_PLATFORM_WINDOWS
+	// steady_clock of VS2012 has the resolution of the system timer (~1ms or worse)
+	static LARGE_INTEGER frequency;
+	if (frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart * 1000.0 / frequency.QuadPart;
+#else
+	namespace ch = std::chrono;
+	return ch::duration_cast<ch::duration<double, std::milli>>(ch::steady_clock::now().time_since_epoch()).count();
+#endif
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef ACHFIVESEC_PRESENTATION_CLOCK_H
+#define ACHFIVESEC_PRESENTATION_CLOCK_H
+
+#include "common.h"
+
+/*!
+	Presentation clock.
+	Playing position of the audio device is coarse (it advances in chunks of the mixing buffer)
+	and sampling it directly every frame makes the animation stutter.
+	The clock keeps a smooth timeline driven by the monotonic system clock
+	and slowly pulls it toward the audio position, so it follows the music without the jitter.
+	The returned time is the predicted time at which the frame being rendered is displayed.
+*/
+class PresentationClock
+{
+public:
+
+	PresentationClock();
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(PresentationClock);
+
+public:
+
+	/*!
+		Update the clock.
+		Must be called once per frame before rendering.
+		\param audioMilli Current playing position of the audio in milliseconds.
+		\param playing True if the audio is playing.
+		\return Predicted display time of the frame in milliseconds.
+	*/
+	double Update(double audioMilli, bool playing);
+
+	/*!
+		Restart the timeline from the given position.
+		Call when the audio position jumps (seek, loop).
+		\param audioMilli New playing position of the audio in milliseconds.
+	*/
+	void Reset(double audioMilli);
+
+	/*!
+		Set the number of frames between rendering and display of a frame.
+		The default is one frame (double buffering with vsync).
+		\param latencyFrames Latency in frames.
+	*/
+	void SetLatencyFrames(double latencyFrames) { this->latencyFrames = latencyFrames; }
+
+	//! Get the smoothed frame interval in milliseconds.
+	double FrameInterval() const { return frameInterval; }
+
+private:
+
+	double Now();
+
+private:
+
+	bool synchronized;
+	double baseMilli;				//!< Audio position at baseNow.
+	double baseNow;					//!< System time of the base position.
+	double lastUpdate;				//!< System time of the last update.
+	double lastTime;				//!< Last returned time.
+	double frameInterval;			//!< Smoothed frame interval.
+	double latencyFrames;
+
+};
+
+#endif // ACHFIVESEC_PRESENTATION_CLOCK_H
@@ -0,0 +1,398 @@
+#include "pch.h"
+#include "profiler.h"
+#include "logger.h"
+#include "gl.h"
+
+namespace ch = std::chrono;
+
+namespace
+{
+	// Capacity of the event ring buffer.
+	// The oldest events are overwritten when the buffer is full.
+	const unsigned long long EventCapacity = 1 << 16;
+
+	// Number of frames to wait before reading back the GPU timer queries.
+	const int FrameLatency = 4;
+
+	// Thread ID used for the GPU track
+	const unsigned int GPUThreadID = 0;
+}
+
+FW_NAMESPACE_BEGIN
+
+struct ProfileEvent
+{
+	const char* name;			//!< Name of the scope.
+	long long begin;			//!< Begin time in nanoseconds.
+	long long duration;			//!< Duration in nanoseconds.
+	unsigned int tid;			//!< Thread ID.
+	unsigned int frame;			//!< Frame index.
+};
+
+struct ProfileGPUEvent
+{
+	const char* name;
+	unsigned int frame;
+	GLuint beginQuery;		// GL_TIMESTAMP counter at the beginning of the scope
+	GLuint endQuery;		// GL_TIMESTAMP counter at the end of the scope
+};
+
+class ProfilerImpl
+{
+public:
+
+	static ProfilerImpl& Instance()
+	{
+		static ProfilerImpl instance;
+		return instance;
+	}
+
+public:
+
+	ProfilerImpl();
+	~ProfilerImpl();
+
+public:
+
+	void Enable();
+	bool Enabled() { return enabled; }
+	void BeginFrame();
+	bool Dump(const std::string& path);
+	void BeginGPU(const char* name);
+	void EndGPU();
+	void AddCPUEvent(const char* name, long long begin, long long end);
+	long long Now();
+
+private:
+
+	void Record(const ProfileEvent& event);
+	void ResolveFrame(int index);
+	GLuint QueryCounter();
+	unsigned int CurrentThreadID();
+
+private:
+
+	std::atomic<bool> enabled;
+	ch::high_resolution_clock::time_point origin;
+	std::atomic<unsigned int> frame;
+
+	// Lock-free ring buffer of the events.
+	// A slot is valid when its sequence number equals to (index of the event + 1).
+	std::vector<ProfileEvent> events;
+	boost::scoped_array<std::atomic<unsigned long long>> sequences;
+	std::atomic<unsigned long long> writeIndex;
+
+	// GPU timer queries (accessed only from the GL thread).
+	// The offset converts the GPU time of the frame to the time of Now.
+	std::vector<ProfileGPUEvent> gpuFrames[FrameLatency];
+	long long gpuTimeOffsets[FrameLatency];
+	std::vector<int> activeGPUScopes;
+	std::vector<GLuint> freeQueries;
+	std::vector<GLuint> allQueries;
+
+};
+
+ProfilerImpl::ProfilerImpl()
+	: enabled(false)
+	, origin(ch::high_resolution_clock::now())
+	, frame(0)
+	, writeIndex(0)
+{
+	for (int i = 0; i < FrameLatency; i++)
+	{
+		gpuTimeOffsets[i] = 0;
+	}
+}
+
+ProfilerImpl::~ProfilerImpl()
+{
+
+}
+
+void ProfilerImpl::Enable()
+{
+	if (!GLEW_ARB_timer_query)
+	{
+		FW_LOG_WARN("GL_ARB_timer_query is not supported");
+	}
+
+	if (enabled)
+	{
+		return;
+	}
+
+	// The ring buffer is allocated only when the profiler is used
+	events.resize(EventCapacity);
+	sequences.reset(new std::atomic<unsigned long long>[EventCapacity]);
+	for (unsigned long long i = 0; i < EventCapacity; i++)
+	{
+		sequences[i] = 0;
+	}
+
+	origin = ch::high_resolution_clock::now();
+	enabled = true;
+}
+
+void ProfilerImpl::BeginFrame()
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	if (!activeGPUScopes.empty())
+	{
+		// Closed here so that every recorded scope has both counters
+		FW_LOG_WARN("GPU profile scope is not closed at the end of the frame");
+		while (!activeGPUScopes.empty())
+		{
+			EndGPU();
+		}
+	}
+
+	// Queries issued FrameLatency frames ago are most likely available
+	frame++;
+	int index = frame % FrameLatency;
+	ResolveFrame(index);
+
+	// Align the GPU clock to the CPU clock for the queries of this frame
+	if (GLEW_ARB_timer_query)
+	{
+		GLint64 gpuTime;
+		glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+		gpuTimeOffsets[index] = Now() - (long long)gpuTime;
+	}
+}
+
+bool ProfilerImpl::Dump( const std::string& path )
+{
+	if (!enabled)
+	{
+		return false;
+	}
+
+	// Resolve all pending queries.
+	// The scopes still open are dropped and ignored when they are closed.
+	for (int i = 0; i < FrameLatency; i++)
+	{
+		ResolveFrame(i);
+	}
+
+	activeGPUScopes.clear();
+
+	if (!allQueries.empty())
+	{
+		glDeleteQueries((GLsizei)allQueries.size(), &allQueries[0]);
+		allQueries.clear();
+		freeQueries.clear();
+	}
+
+	// Collect valid events
+	std::vector<ProfileEvent> validEvents;
+	unsigned long long end = writeIndex;
+	unsigned long long begin = end > EventCapacity ? end - EventCapacity : 0;
+	for (unsigned long long i = begin; i < end; i++)
+	{
+		size_t slot = (size_t)(i % EventCapacity);
+		if (sequences[slot].load(std::memory_order_acquire) == i + 1)
+		{
+			validEvents.push_back(events[slot]);
+		}
+	}
+
+	std::sort(validEvents.begin(), validEvents.end(), [](const ProfileEvent& a, const ProfileEvent& b)
+	{
+		return a.begin < b.begin;
+	});
+
+	// Write in trace event format
+	std::ofstream ofs(path.c_str(), std::ios::out | std::ios::trunc);
+	if (!ofs.is_open())
+	{
+		FW_LOG_ERROR("Failed to open " + path);
+		return false;
+	}
+
+	ofs << "{\"traceEvents\":[" << std::endl;
+	ofs << boost::format("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}") % GPUThreadID;
+	for (const auto& e : validEvents)
+	{
+		ofs << "," << std::endl;
+		ofs << boost::format("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}")
+			% e.name
+			% (e.tid == GPUThreadID ? "gpu" : "cpu")
+			% e.tid
+			% (e.begin / 1000.0)
+			% (e.duration / 1000.0)
+			% e.frame;
+	}
+	ofs << std::endl << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+
+	FW_LOG_INFO(boost::str(boost::format("Wrote %d profile events to %s") % validEvents.size() % path));
+	return true;
+}
+
+void ProfilerImpl::BeginGPU( const char* name )
+{
+	if (!GLEW_ARB_timer_query)
+	{
+		return;
+	}
+
+	// Timestamps can be nested unlike GL_TIME_ELAPSED queries,
+	// so the time of a scope includes the nested scopes
+	auto& gpuEvents = gpuFrames[frame % FrameLatency];
+	ProfileGPUEvent event;
+	event.name = name;
+	event.frame = frame;
+	event.beginQuery = QueryCounter();
+	event.endQuery = 0;
+
+	activeGPUScopes.push_back((int)gpuEvents.size());
+	gpuEvents.push_back(event);
+}
+
+void ProfilerImpl::EndGPU()
+{
+	if (!GLEW_ARB_timer_query || activeGPUScopes.empty())
+	{
+		return;
+	}
+
+	auto& gpuEvents = gpuFrames[frame % FrameLatency];
+	gpuEvents[activeGPUScopes.back()].endQuery = QueryCounter();
+	activeGPUScopes.pop_back();
+}
+
+void ProfilerImpl::AddCPUEvent( const char* name, long long begin, long long end )
+{
+	ProfileEvent event;
+	event.name = name;
+	event.begin = begin;
+	event.duration = end - begin;
+	event.tid = CurrentThreadID();
+	event.frame = frame;
+	Record(event);
+}
+
+long long ProfilerImpl::Now()
+{
+	return ch::duration_cast<ch::nanoseconds>(ch::high_resolution_clock::now() - origin).count();
+}
+
+void ProfilerImpl::Record( const ProfileEvent& event )
+{
+	// Reserve a slot and invalidate it while writing
+	unsigned long long index = writeIndex.fetch_add(1);
+	size_t slot = (size_t)(index % EventCapacity);
+	sequences[slot].store(0, std::memory_order_relaxed);
+	events[slot] = event;
+	sequences[slot].store(index + 1, std::memory_order_release);
+}
+
+void ProfilerImpl::ResolveFrame( int index )
+{
+	auto& gpuEvents = gpuFrames[index];
+	for (auto& e : gpuEvents)
+	{
+		// Scope still open when dumped
+		if (e.endQuery == 0)
+		{
+			freeQueries.push_back(e.beginQuery);
+			continue;
+		}
+
+		// Blocks only if the results are not yet available
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(e.beginQuery, GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(e.endQuery, GL_QUERY_RESULT, &end);
+		freeQueries.push_back(e.beginQuery);
+		freeQueries.push_back(e.endQuery);
+
+		// Placed at the GPU time so that the nested scopes lie within their parents
+		ProfileEvent event;
+		event.name = e.name;
+		event.begin = (long long)begin + gpuTimeOffsets[index];
+		event.duration = (long long)(end - begin);
+		event.tid = GPUThreadID;
+		event.frame = e.frame;
+		Record(event);
+	}
+
+	gpuEvents.clear();
+}
+
+GLuint ProfilerImpl::QueryCounter()
+{
+	if (freeQueries.empty())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		freeQueries.push_back(query);
+		allQueries.push_back(query);
+	}
+
+	GLuint query = freeQueries.back();
+	freeQueries.pop_back();
+
+	glQueryCounter(query, GL_TIMESTAMP);
+	return query;
+}
+
+unsigned int ProfilerImpl::CurrentThreadID()
+{
+	unsigned int id = (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id());
+	return id == GPUThreadID ? id + 1 : id;
+}
+
+// --------------------------------------------------------------------------------
+
+void Profiler::Enable()
+{
+	auto& p = ProfilerImpl::Instance();
+	p.Enable();
+}
+
+bool Profiler::Enabled()
+{
+	auto& p = ProfilerImpl::Instance();
+	return p.Enabled();
+}
+
+void Profiler::BeginFrame()
+{
+	auto& p = ProfilerImpl::Instance();
+	p.BeginFrame();
+}
+
+bool Profiler::Dump( const std::string& path )
+{
+	auto& p = ProfilerImpl::Instance();
+	return p.Dump(path);
+}
+
+void Profiler::BeginGPU( const char* name )
+{
+	auto& p = ProfilerImpl::Instance();
+	p.BeginGPU(name);
+}
+
+void Profiler::EndGPU()
+{
+	auto& p = ProfilerImpl::Instance();
+	p.EndGPU();
+}
+
+void Profiler::AddCPUEvent( const char* name, long long begin, long long end )
+{
+	auto& p = ProfilerImpl::Instance();
+	p.AddCPUEvent(name, begin, end);
+}
+
+long long Profiler::Now()
+{
+	auto& p = ProfilerImpl::Instance();
+	return p.Now();
+}
+
+FW_NAMESPACE_END
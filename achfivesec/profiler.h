@@ -0,0 +1,131 @@
+#pragma once
+#ifndef LIB_FW_PROFILER_H
+#define LIB_FW_PROFILER_H
+
+#include "common.h"
+#include <string>
+#include <chrono>
+
+FW_NAMESPACE_BEGIN
+
+/*!
+	Profiler.
+	Records CPU and GPU timings of named scopes and
+	exports them in Chrome's trace event format (chrome://tracing).
+	GPU scopes are measured with timestamps, so the time of a scope includes its nested scopes,
+	and are placed on the GPU track at the GPU time converted to the CPU clock.
+	The profiler is disabled by default and the scopes cost almost nothing in that case.
+*/
+class Profiler
+{
+private:
+
+	Profiler();
+	~Profiler();
+
+	FW_DISABLE_COPY_AND_MOVE(Profiler);
+
+public:
+
+	/*!
+		Enable the profiler.
+		Must be called after the OpenGL context is created
+		because the GPU timer queries are created here.
+	*/
+	static void Enable();
+
+	/*!
+		Check if the profiler is enabled.
+		\retval true The profiler is enabled.
+		\retval false The profiler is disabled.
+	*/
+	static bool Enabled();
+
+	/*!
+		Begin a frame.
+		Collects the results of GPU timer queries issued a few frames ago.
+		The function must be called once per frame from the thread owning the OpenGL context.
+	*/
+	static void BeginFrame();
+
+	/*!
+		Write recorded events to a file.
+		Pending GPU queries are resolved before writing.
+		\param path Output path of the JSON file.
+		\retval true Succeeded to write the file.
+		\retval false Failed to write the file.
+	*/
+	static bool Dump(const std::string& path);
+
+public:
+
+	// Called by ProfileScope
+	static void BeginGPU(const char* name);
+	static void EndGPU();
+	static void AddCPUEvent(const char* name, long long begin, long long end);
+	static long long Now();
+
+};
+
+/*!
+	Profile scope.
+	Measures CPU time (and optionally GPU time) elapsed in the scope.
+	GPU scopes must be used only in the thread owning the OpenGL context.
+	The name must be a string literal because the pointer is recorded as it is.
+*/
+class ProfileScope
+{
+public:
+
+	ProfileScope(const char* name, bool gpu)
+		: name(name)
+		, gpu(gpu)
+		, enabled(Profiler::Enabled())
+	{
+		if (enabled)
+		{
+			begin = Profiler::Now();
+			if (gpu) Profiler::BeginGPU(name);
+		}
+	}
+
+	~ProfileScope()
+	{
+		if (enabled)
+		{
+			if (gpu) Profiler::EndGPU();
+			Profiler::AddCPUEvent(name, begin, Profiler::Now());
+		}
+	}
+
+private:
+
+	FW_DISABLE_COPY_AND_MOVE(ProfileScope);
+
+private:
+
+	const char* name;
+	bool gpu;
+	bool enabled;
+	long long begin;
+
+};
+
+FW_NAMESPACE_END
+
+/*!
+	\def FW_PROFILE_SCOPE(name)
+	Helper macro to measure CPU time of the current scope.
+	\param name Name of the scope (string literal).
+*/
+
+/*!
+	\def FW_PROFILE_GPU_SCOPE(name)
+	Helper macro to measure CPU and GPU time of the current scope.
+	\param name Name of the scope (string literal).
+*/
+
+#define FW_PROFILE_SCOPE(name) fw::ProfileScope _profileScope(name, false);
+#define FW_PROFILE_GPU_SCOPE(name) fw::ProfileScope _profileScope(name, true);
+
+#endif // LIB_FW_PROFILER_H
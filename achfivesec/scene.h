@@ -2,6 +2,7 @@
 #ifndef ACHFIVESEC_SCENE_H
 #define ACHFIVESEC_SCENE_H
 
+#include "framegraph.h"
 #include <string>
 
 namespace sf
@@ -9,13 +10,15 @@ namespace sf
 	class RenderWindow;
 }
 
+struct sync_device;
+
 namespace fw
 {
-	class GLFrameBuffer;
+	class AssetBundle;
+	class AssetBundleWriter;
+	class GLShaderRegistry;
 }
 
-struct sync_device;
-
 class Scene
 {
 public:
@@ -26,8 +29,46 @@ public:
 public:
 
 	virtual std::string Name() const = 0;
-	virtual bool Setup(sf::RenderWindow& window, sync_device* rocket) = 0;
-	virtual void Draw(sf::RenderWindow& window, double milli, fw::GLFrameBuffer& fbo) = 0;
+
+	/*!
+		Load assets.
+		Decodes the source assets and writes them into the bundle in the layout ready for upload.
+		Called in a worker thread concurrently with Setup and with Load of the other scenes,
+		thus the function must not use OpenGL nor the members touched in Setup.
+		Not called if the assets are read from a prebuilt bundle.
+		\param writer Writer of the bundle.
+	*/
+	virtual bool Load(fw::AssetBundleWriter& writer) { return true; }
+
+	/*!
+		Setup the resources not depending on the assets (tracks, shaders, etc.).
+		Called in the thread owning the OpenGL context while the assets are being loaded.
+		Shaders should only be requested here from the registry,
+		so that the driver compiles them while the assets are loaded,
+		and collected with GLProgramPipeline::WaitLink in Upload.
+		\param window Window.
+		\param rocket Rocket device.
+		\param shaders Registry sharing the shader stages among the scenes.
+	*/
+	virtual bool Setup(sf::RenderWindow& window, sync_device* rocket, fw::GLShaderRegistry& shaders) = 0;
+
+	/*!
+		Create OpenGL resources from the assets in the bundle.
+		Called in the thread owning the OpenGL context after Load and Setup are finished.
+		\param bundle Bundle containing the entries written in Load.
+	*/
+	virtual bool Upload(const fw::AssetBundle& bundle) { return true; }
+
+	/*!
+		Add the passes of the scene to the frame graph.
+		The passes are executed later when the graph is executed,
+		and are added inside a group (FrameGraph::BeginGroup) to be profiled as a whole.
+		\param window Window.
+		\param milli Current time in milliseconds.
+		\param graph Frame graph.
+		\param output Resource into which the scene is rendered.
+	*/
+	virtual void Draw(sf::RenderWindow& window, double milli, fw::FrameGraph& graph, fw::FrameGraphResource output) = 0;
 
 };
 
@@ -2,6 +2,7 @@
 #include "shaderutil.h"
 #include "logger.h"
 #include "gl.h"
+#include "uniformblocks.h"
 #include <ctemplate/template.h>
 
 namespace ct = ctemplate;
@@ -14,6 +15,23 @@ std::string ShaderUtil::GenerateShaderString( const std::string& input, const Sh
 	// Predefined values
 	tempDict["GLShaderVersion"] = FW_GL_SHADER_VERSION;
 	tempDict["GLVertexAttributes"] = FW_GL_VERTEX_ATTRIBUTES;
+	tempDict["GLDrawBatchExtensions"] = GLEW_ARB_shader_storage_buffer_object ? FW_GL_DRAW_BATCH_EXTENSIONS : "";
+
+	// Uniform blocks
+	tempDict["CameraBlock"] = boost::str(boost::format(
+		"layout (std140, binding = %d) uniform CameraBlock\n"
+		"{\n"
+		"	mat4 ViewMatrix;\n"
+		"	mat4 ProjectionMatrix;\n"
+		"};\n") % (int)UniformBlockBinding::Camera);
+	tempDict["BlurBlock"] = boost::str(boost::format(
+		"layout (std140, binding = %d) uniform BlurBlock\n"
+		"{\n"
+		"	vec2 TexelSize;\n"
+		"	float SigmaFactor;\n"
+		"	int KernelSize;\n"
+		"	float BlurStrength;\n"
+		"};\n") % (int)UniformBlockBinding::Blur);
 
 	// User-defined values
 	for (auto& kv : dict)
@@ -33,3 +51,26 @@ std::string ShaderUtil::GenerateShaderString( const std::string& input, const Sh
 	return output;
 }
 
+std::string ShaderUtil::DrawBlock( int maxDraws )
+{
+	if (GLEW_ARB_shader_storage_buffer_object)
+	{
+		return boost::str(boost::format(
+			"layout (std430, binding = %d) buffer DrawBlock\n"
+			"{\n"
+			"	DrawParams Draws[];\n"
+			"};\n") % (int)StorageBlockBinding::Draws);
+	}
+
+	// The std140 layout matches std430 for the parameters whose size is a multiple of 16 bytes
+	return boost::str(boost::format(
+		"layout (std140, binding = %d) uniform DrawBlock\n"
+		"{\n"
+		"	DrawParams Draws[%d];\n"
+		"};\n") % (int)UniformBlockBinding::Draws % maxDraws);
+}
+
+int ShaderUtil::DrawBlockBinding()
+{
+	return GLEW_ARB_shader_storage_buffer_object ? (int)StorageBlockBinding::Draws : (int)UniformBlockBinding::Draws;
+}
@@ -21,6 +21,17 @@ public:
 
 	static std::string GenerateShaderString(const std::string& input, const ShaderTemplateDict& dict);
 
+	/*!
+		Get the declaration of the block DrawBlock holding the array Draws of the structure DrawParams,
+		read by the shaders of fw::GLDrawBatch.
+		It is a storage block if ARB_shader_storage_buffer_object is supported, otherwise a uniform block.
+		\param maxDraws Length of the array of the uniform block.
+	*/
+	static std::string DrawBlock(int maxDraws);
+
+	//! Get the binding point of DrawBlock passed to fw::GLDrawBatch::Submit.
+	static int DrawBlockBinding();
+
 };
 
 #endif // ACHFIVESEC_SHADER_UTIL_H
\ No newline at end of file
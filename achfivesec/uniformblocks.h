@@ -0,0 +1,58 @@
+#pragma once
+#ifndef ACHFIVESEC_UNIFORM_BLOCKS_H
+#define ACHFIVESEC_UNIFORM_BLOCKS_H
+
+#include "common.h"
+#include <glm/glm.hpp>
+
+/*!
+	Binding points of the uniform blocks shared by the shaders.
+	The declarations of the blocks are available in the shaders
+	as the predefined values of ShaderUtil ({{CameraBlock}}, {{BlurBlock}}).
+*/
+enum class UniformBlockBinding
+{
+	Camera = 0,
+	Blur = 1,
+	Draws = 2		//!< Draw parameters without ARB_shader_storage_buffer_object.
+};
+
+/*!
+	Binding points of the shader storage blocks.
+	The draw parameters submitted by GLDrawBatch are bound to Draws,
+	which the shaders declare with ShaderUtil::DrawBlock.
+*/
+enum class StorageBlockBinding
+{
+	Draws = 0
+};
+
+/*!
+	Camera constants.
+	Uploaded once per scene and frame, and shared by the passes rendering the geometry.
+	The layout matches the std140 block CameraBlock.
+*/
+struct CameraBlock
+{
+	glm::mat4 viewMatrix;
+	glm::mat4 projectionMatrix;
+};
+
+/*!
+	Constants of the Gaussian blur.
+	Shared by the horizontal and vertical passes.
+	The layout matches the std140 block BlurBlock.
+*/
+struct BlurBlock
+{
+	glm::vec2 texelSize;
+	float sigmaFactor;
+	int kernelSize;
+	float blurStrength;
+	float padding[3];		// Size of std140 block is a multiple of vec4
+};
+
+static_assert(sizeof(CameraBlock) == 128, "CameraBlock does not match std140 layout");
+static_assert(sizeof(BlurBlock) == 32, "BlurBlock does not match std140 layout");
+
+#endif // ACHFIVESEC_UNIFORM_BLOCKS_H
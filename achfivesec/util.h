@@ -15,6 +15,7 @@ public:
 
 	static double BPM()							{ return 164; }
 	static double RPM()							{ return 8; }
+	static double LengthInBeats()				{ return 19; }
 	static double MilliToBeats(double milli)	{ return milli * BPM() / 60000.0; }
 	static double BeatsToMilli(double beats)	{ return beats * 60000.0 / BPM(); }
 	static double RowToMilli(double row)		{ return BeatsToMilli(row / RPM()); }